@@ -0,0 +1,115 @@
+//  Copyright (C) 1999-2003 Silicon Graphics, Inc.  All Rights Reserved.
+//  
+//  This program is free software; you can redistribute it and/or modify it
+//  under the terms of version 2.1 of the GNU Lesser General Public License
+//  as published by the Free Software Foundation.
+//
+//  This program is distributed in the hope that it would be useful, but
+//  WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  Further, any
+//  license provided herein, whether implied or otherwise, is limited to
+//  this program in accordance with the express provisions of the GNU Lesser
+//  General Public License.  Patent licenses, if any, provided herein do not
+//  apply to combinations of this program with other product or programs, or
+//  any other product whatsoever. This program is distributed without any
+//  warranty that the program is delivered free of the rightful claim of any
+//  third person by way of infringement or the like.  See the GNU Lesser
+//  General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License along
+//  with this program; if not, write the Free Software Foundation, Inc., 59
+//  Temple Place - Suite 330, Boston MA 02111-1307, USA.
+
+#ifndef Record_included
+#define Record_included
+
+#include <sys/types.h>
+#include <netinet/in.h>
+#include <string.h>
+
+//  A Record is a message in version 3 of the fam protocol.  Version 2
+//  messages are text, four bytes of length followed by a printf'd
+//  line that has to be parsed number by number.  A record has a
+//  fixed header instead,
+//
+//	opcode		1 byte	a request letter from the client, or
+//				'E' for an event, 'N' or 'R' from fam
+//	code		1 byte	the event's code letter, 0 in requests
+//	path length	2 bytes
+//	request		4 bytes
+//
+//  followed by the path, without a NUL.  Numbers are MSB first.  So
+//  once the header is in, one comparison says whether the whole
+//  record is.
+//
+//  A version 2 message starts with its length, and no message is so
+//  long that the first byte isn't zero.  A record starts with its
+//  opcode, which never is, so a reader tells them apart a message at
+//  a time and a connection can change formats between any two
+//  messages.
+//
+//  A client asks for version 3 in the request number of its 'N'
+//  message.  If fam knows who the client is without being told in
+//  each message, it answers with an 'N' record whose request is the
+//  version, and sends records from then on.  The client keeps
+//  sending text until it sees that record.  Older fams ignore the
+//  'N' message's request number, and older clients send 0, so either
+//  way they go on speaking version 2.
+//
+//  A client on a local socket may also ask for a Ring (see Ring.h)
+//  by listing "ring" in its 'V' message.  fam answers with an 'R'
+//  record whose request is the ring's size and which carries the
+//  ring's file descriptors, or, if there's to be no ring, is 0 and
+//  carries none.
+//
+//  Records carry no uid or groups, so only requests about a path or
+//  a request number (W, M, C, S and U) are sent as records.
+
+struct Record {
+
+    enum { PROTOCOL = 3, HEADERSIZE = 8 };
+    enum { EVENT = 'E', HELLO = 'N', RING = 'R' };
+
+    char opcode;
+    char code;
+    unsigned pathlen;
+    int32_t request;
+    const char *path;
+
+    Record(char op, char c, int32_t req, const char *p)
+	: opcode(op), code(c), pathlen(strlen(p)), request(req), path(p) { }
+
+    //  Decode the header at p.  The path is left where it is.
+
+    Record(const char *p)
+	: opcode(p[0]), code(p[1]), pathlen(size(p) - HEADERSIZE),
+	  request(word(p + 4)), path(p + HEADERSIZE) { }
+
+    //  is_record says whether the message at p is a record, and size
+    //  says how long the record is, once its header is in.
+
+    static bool is_record(const char *p)	{ return *p != '\0'; }
+    static unsigned size(const char *p)
+	{ return HEADERSIZE + ((unsigned char) p[2] << 8 | (unsigned char) p[3]); }
+
+    //  put() encodes the record at p and returns its length.
+
+    unsigned put(char *p) const
+    {   p[0] = opcode;
+	p[1] = code;
+	p[2] = pathlen >> 8;
+	p[3] = pathlen;
+	u_int32_t n = htonl(request);
+	memcpy(p + 4, &n, sizeof n);
+	memcpy(p + HEADERSIZE, path, pathlen);
+	return HEADERSIZE + pathlen;
+    }
+
+private:
+
+    static int32_t word(const char *p)
+	{ u_int32_t n; memcpy(&n, p, sizeof n); return ntohl(n); }
+
+};
+
+#endif /* !Record_included */
@@ -0,0 +1,128 @@
+//  Copyright (C) 1999-2003 Silicon Graphics, Inc.  All Rights Reserved.
+//  
+//  This program is free software; you can redistribute it and/or modify it
+//  under the terms of version 2.1 of the GNU Lesser General Public License
+//  as published by the Free Software Foundation.
+//
+//  This program is distributed in the hope that it would be useful, but
+//  WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  Further, any
+//  license provided herein, whether implied or otherwise, is limited to
+//  this program in accordance with the express provisions of the GNU Lesser
+//  General Public License.  Patent licenses, if any, provided herein do not
+//  apply to combinations of this program with other product or programs, or
+//  any other product whatsoever. This program is distributed without any
+//  warranty that the program is delivered free of the rightful claim of any
+//  third person by way of infringement or the like.  See the GNU Lesser
+//  General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License along
+//  with this program; if not, write the Free Software Foundation, Inc., 59
+//  Temple Place - Suite 330, Boston MA 02111-1307, USA.
+
+#ifndef Ring_included
+#define Ring_included
+
+#include <sys/types.h>
+#include <limits.h>
+
+#include "Record.h"
+
+//  Rings need memfd_create(), eventfd() and, in libfam, epoll.
+
+#if HAVE_MEMFD_CREATE && HAVE_SYS_EVENTFD_H && HAVE_SYS_EPOLL_H
+#define HAVE_EVENT_RING 1
+#endif
+
+//  A Ring is a single-producer, single-consumer queue of Records in
+//  memory shared by fam and one local client.  fam makes it in a
+//  memfd and hands the memfd to the client, with two eventfds, in an
+//  'R' record.  From then on fam puts events in the ring instead of
+//  sending them, and the client takes them straight out of shared
+//  memory.  The socket carries only the client's requests.
+//
+//  head and tail count bytes taken and put; only the client moves
+//  head and only fam moves tail.  A record is never split at the end
+//  of the ring.  If it won't fit before the end, fam puts a zero byte
+//  there (a record never starts with one) and starts the record at
+//  the beginning.
+//
+//  Neither side makes a system call while the other is keeping up.
+//  When the client finds the ring empty it sets waiting, and fam,
+//  seeing it set after putting a record, clears it and writes the
+//  events eventfd.  When fam finds the ring full it sets blocked, and
+//  the client, seeing it set once taking records has made room,
+//  clears it and writes the space eventfd.  Each side sets its flag
+//  and then looks at the ring again, so neither sleeps on a ring that
+//  just changed.
+//
+//  The client can write anything in the ring, so fam keeps its own
+//  size and tail, reads only head and the flags, and checks head
+//  before believing it.  Only the client trusts the ring's fields.
+
+struct Ring {
+
+    enum { DATA = 256 };		// offset of the records
+    enum { MAXRECORD = Record::HEADERSIZE + PATH_MAX - 1 };
+    enum { MINSIZE = 65536 };
+
+    volatile u_int32_t tail;
+    char pad1[64 - sizeof (u_int32_t)];	// head and tail in different
+    volatile u_int32_t head;		// cache lines
+    char pad2[64 - sizeof (u_int32_t)];
+    volatile u_int32_t waiting;		// client is waiting for events
+    volatile u_int32_t blocked;		// fam is waiting for room
+    u_int32_t size;			// of the records, a power of two
+
+    static size_t mapsize(unsigned size)	{ return DATA + size; }
+    char *data()			{ return (char *) this + DATA; }
+
+    //  has_room() says whether there's room for the biggest record.
+    //  fam doesn't use it; see EventRing.
+
+    bool has_room() const	{ return size - (tail - head) >= 2 * MAXRECORD; }
+
+    //  For the client: peek() returns the next record and its length,
+    //  or NULL if the ring is empty.  The length is 0 if the record
+    //  doesn't fit where it is.  take() says whether to write the
+    //  space eventfd, and arm() whether the ring is still empty after
+    //  setting waiting.
+
+    const char *peek(unsigned *len)
+    {   for (;;)
+	{   unsigned h = head, avail = tail - h;
+	    if (!avail)
+		return NULL;
+	    __sync_synchronize();
+	    unsigned i = h & (size - 1);
+	    const char *p = data() + i;
+	    if (!Record::is_record(p))
+	    {   head = h + size - i;
+		continue;
+	    }
+	    *len = avail < Record::HEADERSIZE ? 0 : Record::size(p);
+	    if (*len > avail || *len > size - i || *len > MAXRECORD)
+		*len = 0;
+	    return p;
+	}
+    }
+
+    bool take(unsigned len)
+    {   __sync_synchronize();
+	head += len;
+	__sync_synchronize();
+	if (!blocked || !has_room())
+	    return false;
+	blocked = 0;
+	return true;
+    }
+
+    bool arm()
+    {   waiting = 1;
+	__sync_synchronize();
+	return head == tail;
+    }
+
+};
+
+#endif /* !Ring_included */
@@ -111,10 +111,15 @@ typedef struct FAMRequest {
 *  in the FAMMonitorFile/Directory routines).  This structure will
 *  describe what event happened to the file.  The different events
 *  that can happen to a file are listed in the FAMCodes enum.
+*
+*  FAMOverflow means that fam threw away events for the request
+*  because the application wasn't reading them.  The filename is
+*  the monitored path; the application should look at it again.
 *****************************************************************************/
 enum FAMCodes { FAMChanged=1, FAMDeleted=2, FAMStartExecuting=3, 
 		FAMStopExecuting=4, FAMCreated=5, FAMMoved=6, 
-		FAMAcknowledge=7, FAMExists=8, FAMEndExist=9 };
+		FAMAcknowledge=7, FAMExists=8, FAMEndExist=9,
+		FAMOverflow=10 };
 
 typedef struct  FAMEvent {
     FAMConnection* fc;         /* The fam connection that event occurred on */
@@ -22,8 +22,12 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <unistd.h>
+#include <poll.h>
 #include <netinet/in.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/un.h>
 #include <sys/socket.h>
 #include <rpc/rpc.h>
@@ -38,13 +42,33 @@
 
 #include "fam.h"
 #include "Client.h"
+#include "Record.h"
+#include "Ring.h"
+
+#if HAVE_EVENT_RING
+#include <sys/epoll.h>
+#endif
+
+#ifndef MSG_CMSG_CLOEXEC
+#define MSG_CMSG_CLOEXEC 0
+#endif
 
 static void getword(const char *p, u_int32_t *l);
 
 Client::Client(long host, unsigned int prog, int vers)
-    : sock(0), haveCompleteEvent(false), userData(NULL), endExist(NULL),
+    : sock(0), haveCompleteEvent(false), records(false),
+      wellKnown(false), ringAnswered(false), ringSize(0), ring(NULL),
+      pollFd(-1), userData(NULL), endExist(NULL),
       inend(inbuf)
 {
+    ringFds[0] = ringFds[1] = ringFds[2] = -1;
+
+    //  A local fam listens on a UNIX domain socket with a well-known
+    //  name.  Connecting there saves asking portmapper where fam is
+    //  and negotiating a private socket.
+    if (host == INADDR_LOOPBACK && connectLocal())
+        return;
+
     struct sockaddr_in sin;
 
     memset(&sin, 0, sizeof sin);
@@ -193,11 +217,107 @@ Client::Client(long host, unsigned int prog, int vers)
     close(insock);
 }
 
+//  connectLocal connects to the well-known socket, if there's a fam
+//  listening there.
+
+bool
+Client::connectLocal()
+{
+    struct sockaddr_un sun;
+    memset(&sun, 0, sizeof sun);
+    sun.sun_family = AF_UNIX;
+    if (strlen(FAM_SOCKET) >= sizeof(sun.sun_path))
+        return false;
+    strcpy(sun.sun_path, FAM_SOCKET);
+
+    int s = socket(PF_UNIX, SOCK_STREAM, 0);
+    if (s < 0)
+        return false;
+    if (connect(s, (const struct sockaddr *)&sun, sizeof(sun)) < 0)
+    {
+        close(s);
+        return false;
+    }
+    sock = s;
+    wellKnown = true;
+    return true;
+}
+
 Client::~Client()
 {
     if(sock >= 0) close(sock);
     if(userData != NULL) delete userData;
     if(endExist != NULL) delete endExist;
+    if(ring != NULL) munmap(ring, Ring::mapsize(ringSize));
+    for (int i = 0; i < 3; i++)
+        if (ringFds[i] >= 0) close(ringFds[i]);
+    if(pollFd >= 0) close(pollFd);
+}
+
+//  canUseRing says whether to ask fam for a ring.  Only a fam on the
+//  well-known socket is asked, since an older fam wouldn't answer.
+
+bool
+Client::canUseRing()
+{
+#if HAVE_EVENT_RING
+    return wellKnown && connected();
+#else
+    return false;
+#endif
+}
+
+//  openRing waits for fam's answer to asking for a ring (see Record.h),
+//  and maps the ring if fam sent one.  The descriptor the application
+//  polls is then an epoll set of the socket, which becomes readable
+//  when fam hangs up, and the events eventfd.
+
+void
+Client::openRing()
+{
+    while (connected() && !ringAnswered)
+    {
+        if (receive() <= 0)
+        {
+            croakConnection("no answer about an event ring");
+            return;
+        }
+        checkBufferForEvent();
+    }
+    if (connected() && ringFds[0] >= 0 && !mapRing(ringSize))
+        croakConnection("can't map event ring");
+}
+
+bool
+Client::mapRing(unsigned size)
+{
+#if HAVE_EVENT_RING
+    struct stat st;
+    if ((size < Ring::MINSIZE) || (size & (size - 1)) ||
+        (fstat(ringFds[0], &st) < 0) ||
+        ((size_t)st.st_size < Ring::mapsize(size)))
+        return false;
+    void *p = mmap(NULL, Ring::mapsize(size), PROT_READ | PROT_WRITE,
+                   MAP_SHARED, ringFds[0], 0);
+    if (p == MAP_FAILED) return false;
+    close(ringFds[0]);
+    ringFds[0] = -1;
+    ring = (Ring *)p;
+    if (ring->size != size) return false;
+
+    pollFd = epoll_create1(EPOLL_CLOEXEC);
+    if (pollFd < 0) return false;
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof ev);
+    ev.events = EPOLLIN;
+    ev.data.fd = sock;
+    if (epoll_ctl(pollFd, EPOLL_CTL_ADD, sock, &ev) < 0) return false;
+    ev.data.fd = ringFds[1];
+    if (epoll_ctl(pollFd, EPOLL_CTL_ADD, ringFds[1], &ev) < 0) return false;
+    return true;
+#else
+    return false;
+#endif
 }
 
 int
@@ -215,9 +335,24 @@ Client::writeToServer(char *buf, int nbytes)
     return write(sock, buf, nbytes);
 }
 
+//  writeRecord sends a request as a version 3 record, header and path
+//  in one write.
+
+int
+Client::writeRecord(char opcode, int reqnum, const char *path)
+{
+    if (!connected()) return -1;
+    Record record(opcode, 0, reqnum, path);
+    if (record.pathlen > PATH_MAX) return -1;
+    char buf[Record::HEADERSIZE + PATH_MAX];
+    int nbytes = record.put(buf);
+    return write(sock, buf, nbytes);
+}
+
 int
 Client::eventPending()
 {
+    if (ring && connected() && ringPending()) return 1;
     if (readEvent(false) < 0) return 1;  //  EOF or error
     return haveCompleteEvent ? 1 : 0;
 }
@@ -226,6 +361,20 @@ int
 Client::nextEvent(FAMEvent *fe)
 {
     if (!connected()) return -1;
+
+    //  With a ring, wait for an event there, or for fam to hang up.
+    while (ring && connected() && !haveCompleteEvent)
+    {
+        if (ringPending()) return nextRingEvent(fe);
+        struct pollfd pfd[2];
+        pfd[0].fd = sock;
+        pfd[0].events = POLLIN;
+        pfd[1].fd = ringFds[1];
+        pfd[1].events = POLLIN;
+        if ((poll(pfd, 2, -1) < 0) && (errno != EINTR)) return -1;
+        if (pfd[0].revents && (readEvent(false) < 0)) return -1;
+    }
+
     if ((!haveCompleteEvent) && (readEvent(true) < 0))
     {
         //  EOF now
@@ -233,56 +382,102 @@ Client::nextEvent(FAMEvent *fe)
     }
     //  readEvent(true) blocks until we have a complete event or EOF.
 
+    char code;
+    int reqnum;
     u_int32_t msglen;
-    getword(inbuf, &msglen);
+    if (Record::is_record(inbuf))
+    {
+        //  checkBufferForEvent has already made sure the whole record
+        //  is here and fits in fe->filename.
+        Record record(inbuf);
+        code = record.code;
+        reqnum = record.request;
+        memcpy(fe->filename, record.path, record.pathlen);
+        fe->filename[record.pathlen] = '\0';
+        msglen = Record::HEADERSIZE + record.pathlen;
+    }
+    else
+    {
+        if (!parseText(&code, &reqnum, fe->filename)) return -1;
+        getword(inbuf, &msglen);
+        msglen += sizeof(u_int32_t);  //  include the size now; less math
+    }
 
-    char *p = inbuf + sizeof (u_int32_t), *q;
-    int limit;
-    // 
-    char code, changeInfo[100];
-    int reqnum;
+    if (!setCode(fe, code, reqnum)) return -1;
+#ifdef DEBUG
+printf("\nFAM received %s  ", msg);
+printf("translated to event code:%d, reqnum:%d, ud:%d, filename:<%s>\n",
+	fe->code, reqnum, fe->userdata, fe->filename);
+#endif
 
-    code = *p++;
-    reqnum = strtol(p, &q, 10);
-    if (p == q)
+    //  Now that we've copied the contents out of this message, slide the
+    //  contents of the buffer over.  Crude, but easier than letting the
+    //  buffer wrap.
+    memmove(inbuf, inbuf + msglen, inend - inbuf - msglen);
+    inend -= msglen;
+    checkBufferForEvent();
+
+    return 1;
+}
+
+//  ringPending says whether there's an event in the ring.  If there
+//  isn't, it sets the ring's waiting flag, so fam will write the events
+//  eventfd when there is.  That makes the descriptor the application
+//  polls readable.
+
+bool
+Client::ringPending()
+{
+#if HAVE_EVENT_RING
+    unsigned len;
+    if (ring->peek(&len) != NULL) return true;
+    uint64_t n;
+    (void) read(ringFds[1], &n, sizeof n);
+    return !ring->arm();
+#else
+    return false;
+#endif
+}
+
+//  nextRingEvent takes the next event out of the ring.  peek() has made
+//  sure the record is all there and fits in fe->filename.
+
+int
+Client::nextRingEvent(FAMEvent *fe)
+{
+#if HAVE_EVENT_RING
+    unsigned len;
+    const char *p = ring->peek(&len);
+    if ((p == NULL) || (len == 0))
     {
-        croakConnection("Couldn't find reqnum in message!");
+        croakConnection("bad record in event ring!");
         return -1;
     }
+    Record record(p);
+    memcpy(fe->filename, record.path, record.pathlen);
+    fe->filename[record.pathlen] = '\0';
+    if (!setCode(fe, record.code, record.request)) return -1;
+    if (ring->take(len))
+    {
+        uint64_t one = 1;
+        (void) write(ringFds[2], &one, sizeof one);
+    }
+    return 1;
+#else
+    return -1;
+#endif
+}
+
+//  setCode sets the event's request, user data and code, and keeps
+//  track of what the code says about the request.
+
+bool
+Client::setCode(FAMEvent *fe, char code, int reqnum)
+{
     //  XXX it would be nice to make sure reqnum is valid, but we only store
     //  it if they gave us user data or if it needs an endexists message
     fe->fr.reqnum = reqnum;
     fe->userdata = getUserData(reqnum);
-    p = q;
-    p++;
-    if (code == 'c')
-    {
-        q = changeInfo;
-        limit = sizeof(changeInfo);
-        while ((*p != '\0') && (!isspace(*p)) && (--limit)) *q++ = *p++;
-        if (!limit)
-        {
-            char msg[100];
-            snprintf(msg, sizeof(msg),
-                     "change info too long! (%d max)", sizeof(changeInfo));
-            croakConnection(msg);
-            return -1;
-        }
-        *q = '\0';
-        while (isspace(*p)) ++p;
-    }
-
-    q = fe->filename;
-    limit = PATH_MAX;
-    while ((*p != '\0') && (*p != '\n') && (--limit)) *q++ = *p++;
-    if (!limit)
-    {
-        char msg[100];
-        snprintf(msg, sizeof(msg), "path too long! (%d max)", PATH_MAX);
-        croakConnection(msg);
-        return -1;
-    }
-    *q = '\0';
 
     switch (code) {
 	case 'c': // change
@@ -312,27 +507,68 @@ Client::nextEvent(FAMEvent *fe)
 	    fe->code = FAMEndExist;
             storeEndExist(reqnum);
 	    break;
+	case 'O': // events were thrown away; rescan
+	    fe->code = FAMOverflow;
+	    break;
 	default:
-            snprintf(changeInfo, sizeof(changeInfo),
-                     "unrecognized code '%c'!", code);
-            croakConnection(changeInfo);
-            return -1;
+        {
+            char msg[100];
+            snprintf(msg, sizeof(msg), "unrecognized code '%c'!", code);
+            croakConnection(msg);
+            return false;
+        }
     }
-#ifdef DEBUG
-printf("\nFAM received %s  ", msg);
-printf("translated to event code:%d, reqnum:%d, ud:%d, filename:<%s>\n",
-	fe->code, reqnum, fe->userdata, fe->filename);
-#endif
+    return true;
+}
 
-    //  Now that we've copied the contents out of this message, slide the
-    //  contents of the buffer over.  Crude, but easier than letting the
-    //  buffer wrap.
-    msglen += sizeof(u_int32_t);  //  include the size now; less math
-    memmove(inbuf, inbuf + msglen, inend - inbuf - msglen);
-    inend -= msglen;
-    checkBufferForEvent();
+//  parseText parses a version 2 message: the event code letter, the
+//  request number, change info if it's a change, and the path.
 
-    return 1;
+bool
+Client::parseText(char *code, int *reqnum, char *filename)
+{
+    char *p = inbuf + sizeof (u_int32_t), *q;
+    int limit;
+    char changeInfo[100];
+
+    *code = *p++;
+    *reqnum = strtol(p, &q, 10);
+    if (p == q)
+    {
+        croakConnection("Couldn't find reqnum in message!");
+        return false;
+    }
+    p = q;
+    p++;
+    if (*code == 'c')
+    {
+        q = changeInfo;
+        limit = sizeof(changeInfo);
+        while ((*p != '\0') && (!isspace(*p)) && (--limit)) *q++ = *p++;
+        if (!limit)
+        {
+            char msg[100];
+            snprintf(msg, sizeof(msg),
+                     "change info too long! (%d max)", sizeof(changeInfo));
+            croakConnection(msg);
+            return false;
+        }
+        *q = '\0';
+        while (isspace(*p)) ++p;
+    }
+
+    q = filename;
+    limit = PATH_MAX;
+    while ((*p != '\0') && (*p != '\n') && (--limit)) *q++ = *p++;
+    if (!limit)
+    {
+        char msg[100];
+        snprintf(msg, sizeof(msg), "path too long! (%d max)", PATH_MAX);
+        croakConnection(msg);
+        return false;
+    }
+    *q = '\0';
+    return true;
 }
 
 void
@@ -392,9 +628,7 @@ Client::readEvent(bool block)
 
     do
     {
-        int rc = read(sock, inend, MSGBUFSIZ - (inend - inbuf));
-        if (rc <= 0) return -1;  //  EOF now
-        inend += rc;
+        if (receive() <= 0) return -1;  //  EOF now
         checkBufferForEvent();
     } while (block && !haveCompleteEvent);
 
@@ -406,20 +640,61 @@ Client::checkBufferForEvent()
 {
     if (!connected()) return;
     haveCompleteEvent = false;
-    u_int32_t msglen = 0;
-    if ((inend - inbuf) <= (int)sizeof(u_int32_t)) return;
-    getword(inbuf, &msglen);
-    if((msglen == 0) || (msglen > MAXMSGSIZ))
+    for (;;)
     {
-        char msg[100];
-        snprintf(msg, sizeof(msg), "bad message size! (%d max)", MAXMSGSIZ);
-        croakConnection(msg);
-        return;
-    }
+        u_int32_t msglen = 0;
+        if ((inend > inbuf) && Record::is_record(inbuf))
+        {
+            //  A version 3 record says how long it is in its header.
+            if ((inend - inbuf) < Record::HEADERSIZE) return;
+            msglen = Record::size(inbuf);
+            if (msglen > MAXMSGSIZ)
+            {
+                char msg[100];
+                snprintf(msg, sizeof(msg),
+                         "bad record size! (%d max)", MAXMSGSIZ);
+                croakConnection(msg);
+                return;
+            }
+        }
+        else
+        {
+            if ((inend - inbuf) <= (int)sizeof(u_int32_t)) return;
+            getword(inbuf, &msglen);
+            if((msglen == 0) || (msglen > MAXMSGSIZ))
+            {
+                char msg[100];
+                snprintf(msg, sizeof(msg),
+                         "bad message size! (%d max)", MAXMSGSIZ);
+                croakConnection(msg);
+                return;
+            }
+            msglen += sizeof(u_int32_t);
+        }
+
+        if (inend - inbuf < (int)msglen) return;
+
+        //  fam's 'N' record says it has switched to version 3, so our
+        //  requests can be records too, and its 'R' record answers our
+        //  asking for a ring.  Neither is an event.
+        if (Record::is_record(inbuf) &&
+            (inbuf[0] == Record::HELLO || inbuf[0] == Record::RING))
+        {
+            Record record(inbuf);
+            if (record.opcode == Record::HELLO)
+                records = true;
+            else
+            {
+                ringAnswered = true;
+                ringSize = record.request;
+            }
+            memmove(inbuf, inbuf + msglen, inend - inbuf - msglen);
+            inend -= msglen;
+            continue;
+        }
 
-    if (inend - inbuf >= (int)msglen + (int)sizeof(u_int32_t))
-    {
         haveCompleteEvent = true;
+        return;
     }
 }
 
@@ -431,6 +706,50 @@ Client::croakConnection(const char *reason)
     close(sock);
     sock = -1;
     haveCompleteEvent = false;
+    if (pollFd >= 0) close(pollFd);
+    pollFd = -1;
+}
+
+//  receive reads what fam has sent into the buffer.  Descriptors sent
+//  with fam's 'R' record are kept for openRing; any others are closed.
+
+int
+Client::receive()
+{
+    struct iovec iov;
+    iov.iov_base = inend;
+    iov.iov_len = MSGBUFSIZ - (inend - inbuf);
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(3 * sizeof (int))];
+    } control;
+    struct msghdr msg;
+    memset(&msg, 0, sizeof msg);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof control.buf;
+
+    int rc = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+    if (rc <= 0) return rc;
+    for (struct cmsghdr *c = CMSG_FIRSTHDR(&msg); c != NULL;
+         c = CMSG_NXTHDR(&msg, c))
+    {
+        if ((c->cmsg_level != SOL_SOCKET) || (c->cmsg_type != SCM_RIGHTS))
+            continue;
+        int fds[3];
+        int n = (c->cmsg_len - CMSG_LEN(0)) / sizeof (int);
+        if (n > 3) n = 3;
+        memcpy(fds, CMSG_DATA(c), n * sizeof (int));
+        bool keep = (n == 3) && (ringFds[0] < 0) && !ringAnswered;
+        for (int i = 0; i < n; i++)
+        {
+            if (keep) ringFds[i] = fds[i];
+            else close(fds[i]);
+        }
+    }
+    inend += rc;
+    return rc;
 }
 
 
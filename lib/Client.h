@@ -30,13 +30,19 @@
 #define MAXMSGSIZ 300
 
 struct FAMEvent;
+struct Ring;
 
 class Client {
     public:
 	Client(long hostaddr, unsigned int prog, int vers);
 	~Client();
 	int writeToServer(char *msg, int nbytes);
+        int writeRecord(char opcode, int reqnum, const char *path);
+        bool usingRecords() { return records; }
+        bool canUseRing();
+        void openRing();
         int getSock() { return sock; }
+        int getFd() { return pollFd >= 0 ? pollFd : sock; }
         bool connected() { return sock >= 0; }
         int eventPending();
         int nextEvent(FAMEvent *fe);
@@ -48,12 +54,26 @@ class Client {
         void  freeRequest(int reqnum);
 
     private:
+        bool connectLocal();
+        bool parseText(char *code, int *reqnum, char *filename);
+        bool setCode(FAMEvent *fe, char code, int reqnum);
+        bool ringPending();
+        int nextRingEvent(FAMEvent *fe);
+        bool mapRing(unsigned size);
+        int receive();
         int readEvent(bool block);
         void checkBufferForEvent();
         void croakConnection(const char *reason);
 
 	int sock;
         bool haveCompleteEvent;
+        bool records;  //  fam has switched to version 3 (see Record.h)
+        bool wellKnown;  //  connected on fam's well-known socket
+        bool ringAnswered;
+        unsigned ringSize;
+        Ring *ring;  //  where events come from, if fam gave us one
+        int ringFds[3];  //  memfd, events eventfd, room eventfd
+        int pollFd;  //  epoll set of sock and the events eventfd
         BTree<int, void *> *userData;
         BTree<int, bool>   *endExist;
 	char *inend,inbuf[MSGBUFSIZ];
@@ -35,6 +35,7 @@
 
 #include "fam.h"
 #include "Client.h"
+#include "Record.h"
 
 //#define DEBUG
 
@@ -78,21 +79,42 @@ int FAMOpen2(FAMConnection* fc, const char* appName)
     }
 
     //  Try to connect.
-    fc->client = new Client(LOCALHOSTNUMBER, famnumber, famversion);
-    fc->fd = ((Client *)fc->client)->getSock();
-    if (fc->fd < 0) {
-	delete (Client *)fc->client;
+    Client *client = new Client(LOCALHOSTNUMBER, famnumber, famversion);
+    fc->client = client;
+    if (client->getSock() < 0) {
+	delete client;
         fc->client = NULL;
 	return(-1);
     }
 
-    // Send App name 
-    if (appName) {
+    // Send App name, and the newest protocol version we speak as the
+    // request number.  Older fams ignore the version.
+    {
 	char msg[200];
-	snprintf(msg, sizeof(msg), "N0 %d %d %s\n", geteuid(), getegid(), appName);
-	((Client *)fc->client)->writeToServer(msg, strlen(msg)+1);
+	snprintf(msg, sizeof(msg), "N%d %d %d %s\n", Record::PROTOCOL,
+		 geteuid(), getegid(), appName ? appName : "");
+	client->writeToServer(msg, strlen(msg)+1);
     }
 
+    // Tell fam we understand FAMOverflow events, and ask for a ring to
+    // take events from if we can use one.  Older fams ignore this
+    // message.
+    bool ring = client->canUseRing();
+    {
+	char msg[200];
+	snprintf(msg, sizeof(msg), "V0 %d %d overflow%s\n", geteuid(),
+		 getegid(), ring ? " ring" : "");
+	client->writeToServer(msg, strlen(msg)+1);
+    }
+    if (ring)
+	client->openRing();
+
+    fc->fd = client->getFd();
+    if (fc->fd < 0) {
+	delete client;
+        fc->client = NULL;
+	return(-1);
+    }
     return(0);
 }
 
@@ -127,6 +149,13 @@ static int FAMMonitor(FAMConnection *fc, const char *filename, FAMRequest* fr,
     // store user data if necessary
     if(userData != NULL) client->storeUserData(reqnum, userData);
 
+    // Once fam takes records, it knows who we are without being told.
+    if (client->usingRecords())
+    {
+        client->writeRecord(code, reqnum, filename);
+        return(0);
+    }
+
     GroupStuff groups;
     char msg[MSGBUFSIZ];
     int msgLen;
@@ -320,12 +349,19 @@ checkRequest(FAMRequest *fr, const char *filename)
 static int
 sendSimpleMessage(char code, FAMConnection *fc, const FAMRequest *fr)
 {
+    Client *client = (Client *)fc->client;
+    if (client->usingRecords())
+    {
+        client->writeRecord(code, fr->reqnum, "");
+        return(0);
+    }
+
     // Create FAM String
     char msg[MSGBUFSIZ];
     snprintf(msg, MSGBUFSIZ, "%c%d %d %d\n", code, fr->reqnum, geteuid(), getegid());
 
     // Send to FAM
-    ((Client *)fc->client)->writeToServer(msg, strlen(msg)+1);
+    client->writeToServer(msg, strlen(msg)+1);
     return(0);
 }
 
@@ -29,11 +29,12 @@
 
 unsigned Activity::idle_time = default_timeout;
 unsigned Activity::count;
+Scheduler::TaskID Activity::taskid;
 
 Activity::Activity()
 {
     if ((count++ == 0) && (idle_time > 0))
-	Scheduler::remove_onetime_task(task, NULL);
+	Scheduler::remove_onetime_task(taskid);
 }
 
 Activity::Activity(const Activity&)
@@ -47,7 +48,7 @@ Activity::~Activity()
     {   timeval t;
 	(void) gettimeofday(&t, NULL);
 	t.tv_sec += idle_time;
-	Scheduler::install_onetime_task(t, task, NULL);
+	taskid = Scheduler::install_onetime_task(t, task, NULL);
     }
 }
 
@@ -23,6 +23,8 @@
 #ifndef Activity_included
 #define Activity_included
 
+#include "Scheduler.h"
+
 //  The Activity class is used to keep track of when fam is doing
 //  something worthwhile, and when it isn't.  Currently, the only
 //  worthwhile activity is talking to (non-internal) clients.  So an
@@ -50,6 +52,7 @@ private:
     static void task(void *);
 
     static unsigned count;
+    static Scheduler::TaskID taskid;
     static unsigned idle_time;
 
 };
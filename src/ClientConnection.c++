@@ -23,35 +23,159 @@
 #include "ClientConnection.h"
 
 #include <assert.h>
+#include <stddef.h>
+#include <string.h>
+#include <sys/time.h>
 #include <sys/un.h>
 
 #include "Event.h"
+#include "EventRing.h"
+#include "Log.h"
+#include "Record.h"
+#include "Stats.h"
+
+unsigned ClientConnection::max_queued_events = 65536;
+unsigned ClientConnection::max_queued_bytes = 4 * 1024 * 1024;
+unsigned ClientConnection::ring_bytes = 0;
+
+static Stats::Counter events_queued("events queued for slow clients");
+static Stats::Counter events_coalesced("events coalesced");
+static Stats::Counter events_dropped("events dropped by overflow");
+static Stats::Counter queue_overflows("client queue overflows");
 
 ClientConnection::ClientConnection(int fd,
 				   InputHandler inhandler,
-				   UnblockHandler unhandler, void *closure)
+				   RecordHandler rechandler,
+				   UnblockHandler unhandler,
+				   NameHandler namehandler, void *closure)
     : NetConnection(fd, unhandler, closure),
-      ihandler(inhandler), iclosure(closure)
+      ihandler(inhandler), rhandler(rechandler), nhandler(namehandler),
+      iclosure(closure),
+      overflow_events(false), records(false),
+      ring(NULL), ring_blocked(false), ring_taskid(0), hangup_taskid(0),
+      qhead(NULL), qtail(NULL),
+      hashtable(NULL), hashsize(0), npending(0), qbytes(0),
+      queue_full(false)
 { }
 
+ClientConnection::~ClientConnection()
+{
+    while (qhead)
+	dequeue(qhead);
+    delete [] hashtable;
+    if (ring_taskid)
+	Scheduler::remove_onetime_task(ring_taskid);
+    Scheduler::remove_recurring_task(hangup_taskid);
+    delete ring;
+}
+
 bool
 ClientConnection::input_msg(const char *msg, unsigned nbytes)
 {
     return (*ihandler)(msg, nbytes, iclosure);
 }
 
+bool
+ClientConnection::input_record(const Record& record)
+{
+    return (*rhandler)(record, iclosure);
+}
+
+//  use_records switches the connection to version 3 of the protocol.
+//  The client learns of it from the 'N' record.
+
+void
+ClientConnection::use_records()
+{
+    if (!records)
+    {   records = true;
+	accept_records(true);
+	mrecord(Record(Record::HELLO, 0, Record::PROTOCOL, ""));
+    }
+}
+
+//  use_ring answers with an 'R' record.  The ring's descriptors go
+//  with it, so everything sent before has to go first; if the socket
+//  is full, the client doesn't get a ring.
+
+void
+ClientConnection::use_ring()
+{
+    EventRing *r = NULL;
+    if (ring_bytes && !ring)
+	r = EventRing::create(ring_bytes, ring_handler, this);
+    commit(true);
+    if (r && mrecord_fds(Record(Record::RING, 0, r->size(), ""),
+			 r->fds(), EventRing::NFDS))
+    {   r->sent();
+	ring = r;
+	Log::debug("fd %d: events go in a %u byte ring", get_fd(), r->size());
+    }
+    else
+    {   delete r;
+	mrecord(Record(Record::RING, 0, 0, ""));
+    }
+}
+
+//  ready_for_events says whether there's room for an event.  A
+//  caller that hears no waits for the unblock handler, so if the ring
+//  is full, ask the client to say when it isn't.
+
+bool
+ClientConnection::ready_for_events()
+{
+    if (!ring)
+	return ready_for_output();
+    if (ring->has_room())
+	return true;
+    wait_for_ring();
+    return false;
+}
+
 void
 ClientConnection::send_event(const Event& event, Request request,
 			     const char *name)
 {
+    //  If events are already waiting, or the client has stopped
+    //  reading, this one waits too.
+
+    if (qhead || !ready_for_events())
+    {   queue_event(event, request, name);
+	if (ring)
+	    wait_for_ring();
+	else
+	    want_output();
+    }
+    else
+	format_event(event, request, name);
+}
+
+void
+ClientConnection::format_event(const Event& event, Request request,
+			       const char *name)
+{
+    //  A client that doesn't know Overflow gets a Changed instead.
+
+    char code = event.code();
+    if (event == Event::Overflow && !overflow_events)
+	code = Event::Changed.code();
+
+    if (ring)
+    {   ring->put(Record(Record::EVENT, code, request, name));
+	return;
+    }
+    if (records)
+    {   mrecord(Record(Record::EVENT, code, request, name));
+	return;
+    }
+
     // Format message.
     // Have to send fake change event here, as previous versions of
     // fam (i.e. in IRIX 6.5.5) expect that change events will come with a
     // list of character flags saying what changed.  We'll use a 'c'
     // character, which means that the ctime changed.
-    char code = event.code();
-    if (event == Event::Changed)
-	mprintf("%c%lu c %s\n", code, request , name);
+    if (code == Event::Changed.code())
+	mprintf("%c%lu c %s\n", code, request, name);
     else
 	mprintf("%c%lu %s\n", code, request, name);
 }
@@ -59,5 +183,334 @@ ClientConnection::send_event(const Event& event, Request request,
 void
 ClientConnection::send_sockaddr_un(const sockaddr_un &sun)
 {
+    commit(true);
     mprintf("%s", sun.sun_path);
 }
+
+//////////////////////////////////////////////////////////////////////////////
+//  The queue of events waiting for a slow client
+
+void
+ClientConnection::more_output()
+{
+    if (!ring)
+	commit(false);
+}
+
+//  commit formats queued events, oldest first, until the queue is
+//  empty or, unless all is set, there's no more room.
+
+void
+ClientConnection::commit(bool all)
+{
+    assert(!all || !ring);
+    while (qhead && (all || room()))
+    {   if (*qhead->event == Event::Overflow)
+	{   const char *path = (*nhandler)(qhead->request, iclosure);
+	    if (path)			// NULL if the request was cancelled
+		format_event(Event::Overflow, qhead->request, path);
+	}
+	else
+	    format_event(*qhead->event, qhead->request, qhead->name);
+	dequeue(qhead);
+    }
+}
+
+bool
+ClientConnection::room() const
+{
+    return ring ? ring->has_room() : !output_full();
+}
+
+//  wait_for_ring stops reading requests until the client makes room
+//  in the ring, as NetConnection does when the socket is full.  If
+//  the client made room meanwhile, the queue is taken care of soon.
+//  Either way, the owner hears unblocked() once the queue is empty.
+//  Meanwhile nothing reads the socket, and a client that exits will
+//  never make room, so hangup_task checks that it's still there.
+
+void
+ClientConnection::wait_for_ring()
+{
+    if (!ring_blocked)
+    {   ring_blocked = true;
+	ready_for_input(false);
+	timeval interval = { HANGUP_CHECK_SECS, 0 };
+	hangup_taskid = Scheduler::install_recurring_task(interval,
+							  hangup_task, this);
+    }
+    if (!ring->wait_for_room() && !ring_taskid)
+    {   timeval now;
+	(void) gettimeofday(&now, NULL);
+	ring_taskid = Scheduler::install_onetime_task(now, ring_task, this);
+    }
+}
+
+//  ring_room puts queued events in the ring while there's room.
+
+void
+ClientConnection::ring_room()
+{
+    for (;;)
+    {   commit(false);
+	if (!qhead && ring->has_room())
+	    break;
+	if (ring->wait_for_room())
+	    return;
+    }
+    if (ring_blocked)
+    {   ring_blocked = false;
+	Scheduler::remove_recurring_task(hangup_taskid);
+	hangup_taskid = 0;
+	unblocked();
+    }
+}
+
+void
+ClientConnection::ring_task(void *closure)
+{
+    ClientConnection *cc = (ClientConnection *) closure;
+    cc->ring_taskid = 0;
+    cc->ring_room();
+}
+
+void
+ClientConnection::ring_handler(void *closure)
+{
+    ClientConnection *cc = (ClientConnection *) closure;
+    cc->ring_room();
+}
+
+void
+ClientConnection::hangup_task(void *closure)
+{
+    ClientConnection *cc = (ClientConnection *) closure;
+    if (cc->hung_up())
+	cc->drop_ring();
+}
+
+//  drop_ring is for a client that went away with its ring full.  Its
+//  queued events are thrown away, and later ones go to the socket,
+//  where they're thrown away too, as they would be for a socket
+//  client that went away.  That lets a scanner that's waiting finish,
+//  and once it has, the owner reads the EOF and shuts down.
+
+void
+ClientConnection::drop_ring()
+{
+    Log::debug("fd %d went away with its ring full", get_fd());
+    Scheduler::remove_recurring_task(hangup_taskid);
+    hangup_taskid = 0;
+    if (ring_taskid)
+    {   Scheduler::remove_onetime_task(ring_taskid);
+	ring_taskid = 0;
+    }
+    delete ring;
+    ring = NULL;
+    while (qhead)
+	dequeue(qhead);
+    ring_blocked = false;
+    unblocked();
+}
+
+void
+ClientConnection::queue_event(const Event& event, Request request,
+			      const char *name)
+{
+    //  A request that's waiting for its Overflow doesn't need the
+    //  details.
+
+    if (droppable(event) && overflows.find(request))
+    {   events_dropped++;
+	return;
+    }
+
+    unsigned hash = key_hash(request, name);
+    Pending *last;
+    while (hashtable && (last = find(request, name, hash)) != NULL)
+    {
+	if (event == Event::Changed
+	    && (*last->event == Event::Changed
+		|| *last->event == Event::Created))
+	{   events_coalesced++;
+	    return;
+	}
+	if (event == Event::Deleted && *last->event == Event::Changed)
+	{   dequeue(last);
+	    events_coalesced++;
+	    continue;
+	}
+	if (event == Event::Deleted && *last->event == Event::Created)
+	{   dequeue(last);
+	    events_coalesced += 2;
+	    return;
+	}
+	break;
+    }
+
+    //  Once overflow() has dropped all it can, don't look again until
+    //  the queue has gone down.
+
+    if (!over_limit())
+	queue_full = false;
+    else
+    {   if (!queue_full)
+	{   overflow();
+	    queue_full = over_limit();
+	}
+	if (droppable(event))
+	{   rescan(request);
+	    events_dropped++;
+	    return;
+	}
+    }
+    (void) enqueue(event, request, name, hash);
+}
+
+ClientConnection::Pending *
+ClientConnection::enqueue(const Event& event, Request request,
+			  const char *name, unsigned hash)
+{
+    if (npending >= hashsize)
+	grow();
+    size_t size = offsetof(Pending, name) + strlen(name) + 1;
+    Pending *pp = (Pending *) new char[size];
+    pp->event = &event;
+    pp->request = request;
+    strcpy(pp->name, name);
+    pp->hash = hash;
+    Pending **chain = hashchain(hash);
+    pp->hashlink = *chain;
+    *chain = pp;
+    pp->next = NULL;
+    pp->prev = qtail;
+    if (qtail)
+	qtail->next = pp;
+    else
+	qhead = pp;
+    qtail = pp;
+    npending++;
+    qbytes += size;
+    events_queued++;
+    return pp;
+}
+
+void
+ClientConnection::dequeue(Pending *pp)
+{
+    Pending **ppp = hashchain(pp->hash);
+    while (*ppp != pp)
+	ppp = &(*ppp)->hashlink;
+    *ppp = pp->hashlink;
+    if (pp->prev)
+	pp->prev->next = pp->next;
+    else
+	qhead = pp->next;
+    if (pp->next)
+	pp->next->prev = pp->prev;
+    else
+	qtail = pp->prev;
+    if (*pp->event == Event::Overflow)
+	overflows.remove(pp->request);
+    npending--;
+    qbytes -= offsetof(Pending, name) + strlen(pp->name) + 1;
+    delete [] (char *) pp;
+}
+
+bool
+ClientConnection::over_limit() const
+{
+    return (max_queued_events && npending >= max_queued_events)
+	|| (max_queued_bytes && qbytes >= max_queued_bytes);
+}
+
+//  overflow drops every queued event that a rescan would make up
+//  for, and queues an Overflow for each request that lost one.
+
+void
+ClientConnection::overflow()
+{
+    Log::info("fd %d: client isn't reading events; "
+	      "dropping %u queued events", get_fd(), npending);
+    queue_overflows++;
+    Pending *pp = qhead;
+    while (pp)
+    {   Pending *next = pp->next;
+	if (droppable(*pp->event))
+	{   Request request = pp->request;
+	    dequeue(pp);
+	    events_dropped++;
+	    rescan(request);
+	}
+	pp = next;
+    }
+}
+
+//  rescan queues an Overflow for the request, unless one is queued.
+//  The request may still be being set up, so its path isn't looked
+//  up until the Overflow is sent.
+
+void
+ClientConnection::rescan(Request request)
+{
+    if (!overflows.find(request))
+	overflows.insert(request, enqueue(Event::Overflow, request, "",
+					  key_hash(request, "")));
+}
+
+//  find returns the newest queued event for the request and name.
+
+ClientConnection::Pending *
+ClientConnection::find(Request request, const char *name, unsigned hash) const
+{
+    for (Pending *pp = *hashchain(hash); pp; pp = pp->hashlink)
+	if (pp->hash == hash && pp->request == request
+	    && !strcmp(pp->name, name))
+	    return pp;
+    return NULL;
+}
+
+//  grow doubles the hash table.  Rehashing keeps each chain's order,
+//  so the newest event for a key is still found first.
+
+void
+ClientConnection::grow()
+{
+    unsigned oldsize = hashsize;
+    Pending **oldtable = hashtable;
+    hashsize = oldsize ? oldsize * 2 : MIN_HASHSIZE;
+    hashtable = new Pending *[hashsize];
+    memset(hashtable, 0, hashsize * sizeof *hashtable);
+    Pending ***tails = new Pending **[hashsize];
+    for (unsigned i = 0; i < hashsize; i++)
+	tails[i] = &hashtable[i];
+    for (unsigned i = 0; i < oldsize; i++)
+    {   Pending *pp = oldtable[i];
+	while (pp)
+	{   Pending *next = pp->hashlink;
+	    unsigned slot = pp->hash & (hashsize - 1);
+	    pp->hashlink = NULL;
+	    *tails[slot] = pp;
+	    tails[slot] = &pp->hashlink;
+	    pp = next;
+	}
+    }
+    delete [] tails;
+    delete [] oldtable;
+}
+
+bool
+ClientConnection::droppable(const Event& event)
+{
+    return (event == Event::Changed || event == Event::Deleted
+	    || event == Event::Created || event == Event::Exists);
+}
+
+unsigned
+ClientConnection::key_hash(Request request, const char *name)
+{
+    unsigned h = 2166136261U ^ (unsigned) request;
+    while (*name)
+	h = (h ^ (unsigned char) *name++) * 16777619U;
+    return h;
+}
@@ -25,19 +25,53 @@
 
 #include <sys/param.h>
 #include <limits.h>
+#include "BTree.h"
 #include "NetConnection.h"
 #include "Request.h"
 
 class Event;
+class EventRing;
 
 //  ClientConnection implements the fam server protocol.  It generates
 //  fam events.  It does not parse fam requests because the API for its
 //  caller would be really messy.  Instead it hands received messages
 //  to its owner unparsed.
 //
+//  After use_records(), events are sent as Records (see Record.h),
+//  and Records received are handed to the owner's RecordHandler.
+//
+//  use_ring() answers a local client's request for an EventRing.  If
+//  the client gets one, events are put there instead of being sent,
+//  and the ring being full blocks events just as the socket being
+//  full does otherwise.  While it's full, the socket is checked every
+//  HANGUP_CHECK_SECS, and if the client has gone, its ring is dropped
+//  so the connection can wind down as a socket client's would.
+//  Rings are off unless ring_size() is set.
+//
 //  The field order is important -- the big net buffers are last.
 //  Since the output buffer is twice as big as the input buffer,
 //  it comes after the input buffer.
+//
+//  While the client isn't keeping up, events aren't formatted right
+//  away.  They wait in a queue, and the NetConnection takes them as
+//  it has room (see NetConnection::more_output()).  A queued event
+//  is found by its request and name, and a new event for the same
+//  request and name is coalesced with it: a Changed after a Changed
+//  or Created is dropped, a Deleted replaces a Changed, and a Deleted
+//  cancels a Created.  So however much a file changes while a client
+//  is stuck, there are at most a couple of events queued for it.
+//
+//  The queue is limited in events and bytes (see max_queued()).  When
+//  a client has queued too much, its queued Changed, Deleted, Created
+//  and Exists events are dropped, and each request that lost one
+//  gets an Overflow event instead, telling the client to rescan it.
+//  Until the Overflow is sent, more of those events for the request
+//  are dropped too.  If the queue is still full after that, of events
+//  that can't be dropped, further droppable events are dropped
+//  straight away until it isn't.  The Overflow's name is the
+//  request's path, which the NameHandler supplies when the Overflow
+//  is sent.  A client that hasn't said it knows about Overflow events
+//  (see overflow_ok()) is sent a Changed for the path instead.
 
 struct sockaddr_un;
 class ClientConnection : public NetConnection {
@@ -45,19 +79,93 @@ class ClientConnection : public NetConnection {
 public:
 
     typedef bool (*InputHandler)(const char *, unsigned nbytes, void *closure);
+    typedef bool (*RecordHandler)(const Record&, void *closure);
+    typedef const char *(*NameHandler)(Request, void *closure);
 
-    ClientConnection(int fd, InputHandler, UnblockHandler, void *closure);
+    ClientConnection(int fd, InputHandler, RecordHandler, UnblockHandler,
+		     NameHandler, void *closure);
+    ~ClientConnection();
 
     void send_event(const Event&, Request, const char *name);
     void send_sockaddr_un(const sockaddr_un &sun);
+    void overflow_ok(bool tf)		{ overflow_events = tf; }
+    void use_records();
+    void use_ring();
+    bool ready_for_events();
+
+    static void max_queued(unsigned events, unsigned bytes)
+			    { max_queued_events = events;
+			      max_queued_bytes = bytes; }
+    static void ring_size(unsigned bytes)	{ ring_bytes = bytes; }
 
 protected:
 
     bool input_msg(const char *, unsigned);
+    bool input_record(const Record&);
+    void more_output();
 
 private:
+
+    //  A Pending is a queued event.  The queue is doubly linked so
+    //  a coalesced event can be taken out of the middle, and Pendings
+    //  are also chained in a hash table, newest first.
+
+    struct Pending {
+	Pending *next, *prev;
+	Pending *hashlink;
+	unsigned hash;
+	const Event *event;
+	Request request;
+	char name[1];			// really as long as it needs to be
+    };
+
+    enum { MIN_HASHSIZE = 64, HANGUP_CHECK_SECS = 2 };
+
     InputHandler ihandler;
+    RecordHandler rhandler;
+    NameHandler nhandler;
     void *iclosure;
+    bool overflow_events;
+    bool records;
+    EventRing *ring;
+    bool ring_blocked;			// input stopped for the ring
+    Scheduler::TaskID ring_taskid;
+    Scheduler::TaskID hangup_taskid;	// while ring_blocked
+    Pending *qhead, *qtail;
+    Pending **hashtable;
+    unsigned hashsize;			// power of two
+    unsigned npending;
+    unsigned long qbytes;
+    bool queue_full;			// still full after overflow()
+    BTree<Request, Pending *> overflows;	// each request's Overflow
+
+    static unsigned max_queued_events;
+    static unsigned max_queued_bytes;
+    static unsigned ring_bytes;
+
+    void format_event(const Event&, Request, const char *name);
+    void queue_event(const Event&, Request, const char *name);
+    Pending *enqueue(const Event&, Request, const char *name, unsigned hash);
+    void dequeue(Pending *);
+    bool over_limit() const;
+    void overflow();
+    void rescan(Request);
+    void commit(bool all);
+    bool room() const;
+    void wait_for_ring();
+    void ring_room();
+    void drop_ring();
+    static void ring_task(void *closure);
+    static void ring_handler(void *closure);
+    static void hangup_task(void *closure);
+    Pending **hashchain(unsigned hash) const
+				{ return &hashtable[hash & (hashsize - 1)]; }
+    Pending *find(Request, const char *name, unsigned hash) const;
+    void grow();
+
+    static unsigned key_hash(Request, const char *name);
+    static bool droppable(const Event&);
+
 };
 
 #endif /* !ClientConnection_included */
@@ -122,6 +122,16 @@ ClientInterest::resume()
 	myfilesystem->hl_resume(fs_request);
 }
 
+//  resync tells the client to take a fresh look at the file, because
+//  fam may miss, or may have missed, changes to it.
+
+void
+ClientInterest::resync()
+{
+    if (active())
+	post_event(Event::Changed);
+}
+
 void
 ClientInterest::post_event(const Event& event, const char *eventpath)
 {
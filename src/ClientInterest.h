@@ -56,8 +56,8 @@ public:
     virtual bool do_scan();
 
     void become_user() const		{ mycred.become_user(); }
-    const Cred& cred() const		{ return mycred; }
-    FileSystem *filesystem() const	{ return myfilesystem; }
+    virtual const Cred& cred() const	{ return mycred; }
+    virtual FileSystem *filesystem() const { return myfilesystem; }
     Client *client() const		{ return myclient; }
     virtual Type type() const = 0;
 
@@ -65,6 +65,7 @@ public:
     virtual void notify_deleted(Interest *);
 
     virtual void cancel();
+    void resync();
     
 protected:
 
@@ -20,6 +20,7 @@
 //  with this program; if not, write the Free Software Foundation, Inc., 59
 //  Temple Place - Suite 330, Boston MA 02111-1307, USA.
 
+#include "config.h"
 #include "Cred.h"
 
 #include <assert.h>
@@ -31,6 +32,10 @@
 #include <ctype.h>
 #include <pwd.h>
 #include <errno.h>
+#if HAVE_SETFSUID
+#include <sys/fsuid.h>
+#include <sys/syscall.h>
+#endif
 
 #include "Log.h"
 #ifdef HAVE_MAC
@@ -42,6 +47,7 @@ static gid_t SuperUser_groups[1] = { 0 };
 const Cred Cred::SuperUser(0, 1, SuperUser_groups, -1);
 Cred Cred::untrusted;
 const Cred::Implementation *Cred::Implementation::last = NULL;
+unsigned long Cred::Implementation::serials;
 Cred::Implementation **Cred::impllist;
 unsigned Cred::nimpl;
 unsigned Cred::nimpl_alloc;
@@ -325,7 +331,7 @@ Cred::enable_insecure_compat()
 Cred::Implementation::Implementation(uid_t u, gid_t g,
                                      unsigned int ng, const gid_t *gs,
                                      mac_t m)
-    : refcount(1), myuid(u), mygid(g), nAddlGroups(ng)
+    : refcount(1), serial(++serials), myuid(u), mygid(g), nAddlGroups(ng)
 {
 #ifdef HAVE_MAC
     mac = NULL;
@@ -399,6 +405,48 @@ Cred::Implementation::getAddlGroupsString() const {
     return addlGroupsStr;
 }
 
+#if HAVE_SETFSUID
+
+//  With setfsuid, become_user changes only the calling thread's
+//  filesystem uid and gid, and its group list (glibc's setgroups
+//  changes every thread's, so the system call is made directly).
+//  The euid stays root.  That lets StatPool's threads each stat as a
+//  different user.  Implementations can be freed and their memory
+//  reused, so each thread remembers who it is by serial number.
+
+static __thread unsigned long current_serial;
+
+void
+Cred::Implementation::become_user() const
+{
+    if (serial == current_serial)
+	return;
+
+    if (syscall(SYS_setgroups, nAddlGroups, AddlGroups) != 0)
+    {   Log::perror("failed to set groups");
+	exit(1);
+    }
+    (void) setfsgid(mygid);
+    (void) setfsuid(myuid);
+    if ((uid_t) setfsuid((uid_t) -1) != myuid)
+    {   Log::error("failed to set fsuid %d", myuid);
+	exit(1);
+    }
+#ifdef HAVE_MAC
+    if (use_mac && mac_set_proc(mac) != 0)
+	Log::perror("become_user() failed to set MAC label for uid %d", myuid);
+#endif
+    current_serial = serial;
+}
+
+uid_t
+Cred::current_uid()
+{
+    return setfsuid((uid_t) -1);
+}
+
+#else
+
 void
 Cred::Implementation::become_user() const
 {
@@ -487,3 +535,11 @@ Cred::Implementation::become_user() const
     last = this;
 }
 
+uid_t
+Cred::current_uid()
+{
+    return geteuid();
+}
+
+#endif /* HAVE_SETFSUID */
+
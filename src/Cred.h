@@ -43,10 +43,12 @@ typedef void * mac_t;
 //
 //  A user of a Cred can get its uid and gid, and get an ASCII string
 //  for its group list.  A user can also pass the message
-//  become_user() which will change the process's effective uid and
-//  gid and group list to match the Cred's.  If the new IDs are the
-//  same as the current IDs, become_user() doesn't do any system
-//  calls.
+//  become_user() which will change the uid and gid and group list
+//  files are accessed with to match the Cred's.  If the new IDs are
+//  the same as the current IDs, become_user() doesn't do any system
+//  calls.  With setfsuid, that's the calling thread's filesystem uid
+//  and gid; the effective uid stays root, so don't look at geteuid()
+//  to see who we are -- current_uid() says.
 //
 //  The Cred itself is simply a pointer to the Implementation.  The
 //  Implementation is reference counted, so when the last Cred
@@ -68,6 +70,7 @@ public:
     ~Cred();
 
     bool is_valid() const               { return p != NULL; }
+    bool operator == (const Cred& that) const	{ return p == that.p; }
     uid_t uid() const			{ return p->uid(); }
     uid_t gid() const			{ return p->gid(); }
 
@@ -75,6 +78,7 @@ public:
     const char * getAddlGroupsString() const {return p->getAddlGroupsString();}
 
     void become_user() const		{ p->become_user(); }
+    static uid_t current_uid();
 
     static const Cred SuperUser;
 
@@ -106,6 +110,7 @@ private:
 	void become_user() const;
 
 	unsigned refcount;
+	const unsigned long serial;	// unique, unlike the address
 
         friend class Cred; // so that set_untrusted_user can modify myuid
 
@@ -123,6 +128,7 @@ private:
         bool addl_groups_equal(unsigned int ng, const gid_t *gs) const;
 
 	static const Implementation *last;
+	static unsigned long serials;
 
     };
 
@@ -0,0 +1,179 @@
+//  Copyright (C) 1999 Silicon Graphics, Inc.  All Rights Reserved.
+//  
+//  This program is free software; you can redistribute it and/or modify it
+//  under the terms of version 2 of the GNU General Public License as
+//  published by the Free Software Foundation.
+//
+//  This program is distributed in the hope that it would be useful, but
+//  WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  Further, any
+//  license provided herein, whether implied or otherwise, is limited to
+//  this program in accordance with the express provisions of the GNU
+//  General Public License.  Patent licenses, if any, provided herein do not
+//  apply to combinations of this program with other product or programs, or
+//  any other product whatsoever.  This program is distributed without any
+//  warranty that the program is delivered free of the rightful claim of any
+//  third person by way of infringement or the like.  See the GNU General
+//  Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License along
+//  with this program; if not, write the Free Software Foundation, Inc., 59
+//  Temple Place - Suite 330, Boston MA 02111-1307, USA.
+
+#ifndef DevInoTable_included
+#define DevInoTable_included
+
+#include <assert.h>
+#include <string.h>
+#include <sys/types.h>
+
+//  A DevInoTable maps an inode, by device and inode number, to a T.
+//  It's an open-addressed hash table that grows to stay no more than
+//  half full, so a lookup costs the same however many inodes are in
+//  it.  Removal shifts later entries back instead of leaving deleted
+//  markers, so lookups never have to step over them.
+//
+//  The table doesn't own what it points to.
+//
+//  Operations:
+//		insert()	puts a new entry in the table.
+//		remove()	removes an entry.
+//		find()		returns the T for dev/ino, or NULL.
+//		size()		returns number of entries.
+//		nslots()	returns the number of slots, and
+//		slot()		returns what's in one, or NULL, so the
+//				entries can be walked.
+
+template <class T> class DevInoTable {
+
+public:
+
+    DevInoTable()			: table(0), tsize(0), n(0) { }
+    ~DevInoTable()			{ delete [] table; }
+
+    void insert(dev_t, ino_t, T *);
+    void remove(dev_t, ino_t);
+    T *find(dev_t d, ino_t i) const	{ return n ? probe(d, i)->value : 0; }
+    unsigned size() const		{ return n; }
+    unsigned nslots() const		{ return tsize; }
+    T *slot(unsigned s) const		{ return table[s].value; }
+
+private:
+
+    enum { MINSIZE = 64 };
+
+    struct Slot {
+	dev_t dev;
+	ino_t ino;
+	T *value;			// NULL if slot is empty
+    };
+
+    Slot *table;
+    unsigned tsize;			// zero or a power of two
+    unsigned n;				// number of slots in use
+
+    static unsigned hash(dev_t, ino_t);
+    Slot *probe(dev_t, ino_t) const;
+    void grow();
+
+    DevInoTable(const DevInoTable&);	// Do not copy
+    DevInoTable & operator = (const DevInoTable&);	//  or assign.
+
+};
+
+
+//
+//  Template member implementations
+//
+
+//  hash mixes dev and ino together.  Inode numbers are often dense
+//  and sequential, so every bit of them has to reach the low bits
+//  the table is indexed by.
+
+template <class T>
+unsigned
+DevInoTable<T>::hash(dev_t d, ino_t i)
+{
+    unsigned long long h = (unsigned long long) i * 0x9E3779B97F4A7C15ULL;
+    h ^= (unsigned long long) d + (h >> 32);
+    h ^= h >> 29;
+    h *= 0xBF58476D1CE4E5B9ULL;
+    h ^= h >> 32;
+    return (unsigned) h;
+}
+
+//  probe returns the slot for dev/ino: either the one holding it or
+//  the empty slot where it would go.  The table is never more than
+//  half full, so there is always an empty slot.
+
+template <class T>
+typename DevInoTable<T>::Slot *
+DevInoTable<T>::probe(dev_t d, ino_t i) const
+{
+    unsigned mask = tsize - 1;
+    for (unsigned s = hash(d, i) & mask; ; s = (s + 1) & mask)
+    {   Slot *sp = &table[s];
+	if (!sp->value || (sp->ino == i && sp->dev == d))
+	    return sp;
+    }
+}
+
+template <class T>
+void
+DevInoTable<T>::grow()
+{
+    Slot *old = table;
+    unsigned oldsize = tsize;
+    tsize = oldsize ? oldsize * 2 : MINSIZE;
+    table = new Slot[tsize];
+    memset(table, 0, tsize * sizeof *table);
+    for (unsigned s = 0; s < oldsize; s++)
+	if (old[s].value)
+	    *probe(old[s].dev, old[s].ino) = old[s];
+    delete [] old;
+}
+
+template <class T>
+void
+DevInoTable<T>::insert(dev_t d, ino_t i, T *value)
+{
+    assert(value);
+    if ((n + 1) * 2 > tsize)
+	grow();
+    Slot *sp = probe(d, i);
+    assert(!sp->value);
+    sp->dev = d;
+    sp->ino = i;
+    sp->value = value;
+    n++;
+}
+
+//  remove empties dev/ino's slot, then refills it by shifting later
+//  entries of its probe sequence back.
+
+template <class T>
+void
+DevInoTable<T>::remove(dev_t d, ino_t i)
+{
+    assert(n);
+    Slot *sp = probe(d, i);
+    assert(sp->value);
+
+    unsigned mask = tsize - 1;
+    unsigned hole = sp - table;
+    for (unsigned s = (hole + 1) & mask; table[s].value; s = (s + 1) & mask)
+    {   unsigned home = hash(table[s].dev, table[s].ino) & mask;
+
+	//  Leave the entry alone if its home lies cyclically
+	//  in (hole, s]; moving it to the hole would hide it.
+
+	if (hole < s ? hole < home && home <= s : hole < home || home <= s)
+	    continue;
+	table[hole] = table[s];
+	hole = s;
+    }
+    table[hole].value = 0;
+    n--;
+}
+
+#endif /* !DevInoTable_included */
@@ -27,12 +27,15 @@
 #include <sys/param.h>
 
 #include "Directory.h"
+#include "Event.h"
 
 // A DirEntry may be polled iff its parent is not polled.
 
-DirEntry::DirEntry(const char *name, Directory *p, DirEntry *nx)
-    : Interest(name, p->filesystem(), p->host(), NO_VERIFY_EXPORTED),
-      parent(p), next(nx), need_to_chdir(true)
+DirEntry::DirEntry(const char *name, Directory *p, DirEntry *nx,
+		   bool watched)
+    : Interest(name, p->filesystem(), p->host(), NO_VERIFY_EXPORTED,
+	       p->dir_fd(), p->name(), watched),
+      parent(p), next(nx), deletion_reported(false)
 { }
 
 DirEntry::~DirEntry()
@@ -46,13 +49,51 @@ DirEntry::active() const
     return parent->active();
 }
 
+FileSystem *
+DirEntry::filesystem() const
+{
+    return parent->filesystem();
+}
+
+const Cred&
+DirEntry::cred() const
+{
+    return parent->cred();
+}
+
+const char *
+DirEntry::dir_name() const
+{
+    return parent->name();
+}
+
+int
+DirEntry::dir_fd() const
+{
+    return parent->dir_fd();
+}
+
 void
 DirEntry::post_event(const Event& event, const char *eventpath)
 {
     assert(!eventpath);
+    if (event == Event::Deleted)
+	deletion_reported = true;
+    else if (event == Event::Created || event == Event::Exists)
+	deletion_reported = false;
     parent->post_event(event, name());
 }
 
+//  report_deleted tells the client the entry is gone, unless it
+//  already knows.
+
+void
+DirEntry::report_deleted()
+{
+    if (!deletion_reported)
+	post_event(Event::Deleted);
+}
+
 bool
 DirEntry::scan(Interest *ip)
 {
@@ -60,15 +101,6 @@ DirEntry::scan(Interest *ip)
     return parent->scan(this);
 }
 
-void
-DirEntry::scan_no_chdir()
-{
-    need_to_chdir = false;
-    parent->scan(this);
-    need_to_chdir = true;
-
-}
-
 void
 DirEntry::unscan(Interest *ip)
 {
@@ -81,16 +113,11 @@ DirEntry::do_scan()
 {
     bool changed = false;
     if (needs_scan() && active()) {
-        if (need_to_chdir) {
-            parent->become_user();
-            if (!parent->chdir()) {
-                return false;
-            }
+        parent->become_user();
+        if (parent->dir_fd() < 0) {
+            return false;
         }
         changed = Interest::do_scan();
-        if (need_to_chdir) {
-            parent->chdir_root();
-        }
     }
     return changed;
 }
@@ -99,12 +126,14 @@ void
 DirEntry::notify_created(Interest *ip)
 {
     assert(ip == this);
-    parent->notify_created(ip);
+    if (watched())
+	parent->notify_created(ip);
 }
 
 void 
 DirEntry::notify_deleted(Interest *ip)
 {
     assert(ip == this);
-    parent->notify_deleted(ip);
+    if (watched())
+	parent->notify_deleted(ip);
 }
@@ -37,20 +37,32 @@ class Directory;
 //  list is in the parent.  Each DirEntry also has a parent pointer.
 //  The entries in the list are in the order they're returned by
 //  readdir().
+//
+//  A DirEntry that isn't watched has no imon or Pollster watch of its
+//  own; it's only seen when its Directory is scanned.
+//
+//  A DirEntry remembers whether the last event it posted was Deleted,
+//  so when it goes away, the client hears of it exactly once.  That
+//  can't be told from exists(): an entry that was gone before its
+//  first lstat never existed as far as Interest knows, but the client
+//  was sent Created or Exists for it.
 
 class DirEntry : public Interest {
 
 public:
 
     virtual bool active() const;
+    virtual FileSystem *filesystem() const;
     virtual bool scan(Interest * = 0);
-    virtual void scan_no_chdir();
     virtual void unscan(Interest * = 0);
     virtual bool do_scan();
 
 protected:
 
     void post_event(const Event&, const char * = 0);
+    virtual const Cred& cred() const;
+    virtual const char *dir_name() const;
+    virtual int dir_fd() const;
 
 private:
 
@@ -58,15 +70,17 @@ private:
 
     Directory *const parent;
     DirEntry *next;
+    bool deletion_reported;
 
-    bool need_to_chdir;
-    
     //  Private Instance Methods
 
-    DirEntry(const char *name, Directory *parent, DirEntry *next);
+    DirEntry(const char *name, Directory *parent, DirEntry *next,
+	     bool watched = true);
 				// Only a Directory may create a DirEntry.
     virtual ~DirEntry();
 
+    void report_deleted();
+
     virtual void notify_created(Interest *);
     virtual void notify_deleted(Interest *);
 
@@ -24,11 +24,13 @@
 
 #include <assert.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <string.h>
 #include <stdio.h>
 #include <sys/dir.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "Client.h"
@@ -38,16 +40,23 @@
 #include "FileSystem.h"
 #include "Log.h"
 #include "Scheduler.h"
+#include "Stats.h"
 
-Directory *Directory::current_dir;
+#ifndef O_PATH
+#define O_PATH O_RDONLY
+#endif
+
+static Stats::Counter rescans_avoided("rescans avoided");
 
 Directory::Directory(const char *name, Client *c, Request r, const Cred& cr)
-    : ClientInterest(name, c, r, cr, DIRECTORY), entries(NULL), unhangPid(-1)
+    : ClientInterest(name, c, r, cr, DIRECTORY), entries(NULL), rescan_task(0),
+      dirfd(-1), scanned(0), unhangPid(-1)
 {
     dir_bits() = 0;
     if (exported_to_host())
     {
         dir_bits() = SCANNING;
+        scanned = time(NULL);
         DirectoryScanner *scanner = new DirectoryScanner(*this,
 						         Event::Exists, false,
 						         new_done_handler, this);
@@ -71,18 +80,14 @@ Directory::~Directory()
 {
     assert(!(dir_bits() & SCANNING));
     if (dir_bits() & RESCAN_SCHEDULED)
-	Scheduler::remove_onetime_task(scan_task, this);
+	Scheduler::remove_onetime_task(rescan_task);
     DirEntry *q, *p = entries;
-    if (p)
-    {   (void) chdir();
-	while (p)
-	{   q = p->next;
-	    delete p;
-	    p = q;
-	}
+    while (p)
+    {   q = p->next;
+	delete p;
+	p = q;
     }
-    if (current_dir == this)
-	chdir_root();
+    close_dir();
 }
 
 ClientInterest::Type
@@ -140,8 +145,14 @@ Directory::do_scan()
     bool stat_changed = do_stat();
     if (stat_changed && !isdir())   // Seems like a bug to send Changed after
 	post_event(Event::Changed); // Deleted, but what would fixing it break?
-    bool scan_entries = filesystem()->dir_entries_scanned();
+    if (!stat_changed && unchanged_since_read())
+    {   rescans_avoided++;
+	return false;
+    }
+    bool scan_entries = filesystem()->scans_entries();
+    close_dir();			// the scanner reopens it
     dir_bits() |= SCANNING;
+    scanned = time(NULL);
     DirectoryScanner *scanner = new DirectoryScanner(*this, Event::Created,
 						     scan_entries,
 						     scan_done_handler,
@@ -154,6 +165,16 @@ Directory::do_scan()
     return stat_changed;
 }
 
+bool
+Directory::unchanged_since_read() const
+{
+    const struct stat *sp = last_stat();
+    return scanned && sp && S_ISDIR(sp->st_mode)
+	&& filesystem()->dir_mtime_reliable()
+	&& sp->st_mtime + RACY_SECS < scanned
+	&& sp->st_ctime + RACY_SECS < scanned;
+}
+
 void
 Directory::scan_task(void *closure)
 {
@@ -169,38 +190,36 @@ Directory::scan_done_handler(void *closure)
     dir->dir_bits() &= ~SCANNING;
 }
 
-bool
-Directory::chdir()
+//  dir_fd returns the Directory's descriptor, opening it if need be.
+//  The caller must already be the Client's user.  Returns -1 if the
+//  directory can't be opened.
+
+int
+Directory::dir_fd()
 {
-    if (current_dir == this)
-	return true;
+    if (dirfd >= 0)
+	return dirfd;
 
-    int rc = ::chdir(name());
-    Log::debug("+chdir to \"%s\"", name());
-    if (rc < 0)
-    {   Log::info("can't chdir(\"%s\"): %m", name());
+    dirfd = open(name(), O_PATH | O_DIRECTORY | O_CLOEXEC);
+    if (dirfd < 0)
+    {   Log::info("can't open directory \"%s\": %m", name());
 	if ((errno == EACCES) && (client() != NULL))
         {
             client()->suggest_insecure_compat(name());
         }
-	return false;
+	return -1;
     }
-
-    current_dir = this;
-    return true;
+    Log::debug("opened \"%s\" as descriptor %d", name(), dirfd);
+    return dirfd;
 }
 
-bool
-Directory::chdir_root()
+void
+Directory::close_dir()
 {
-    int rc = 0;
-    if (current_dir)
-    {
-        rc = ::chdir("/");
-        Log::debug("-chdir to \"/\"");
-	current_dir = NULL;
+    if (dirfd >= 0)
+    {   (void) close(dirfd);
+	dirfd = -1;
     }
-    return rc == 0;
 }
 
 //
@@ -24,6 +24,7 @@
 #define Directory_included
 
 #include "ClientInterest.h"
+#include "Scheduler.h"
 
 class DirEntry;
 class DirectoryScanner;
@@ -34,6 +35,19 @@ class DirectoryScanner;
 //
 //  Each Directory has a linked list of DirEntries.  The DirEntries
 //  are stored in the order they're returned by readdir(2).
+//
+//  A Directory holds a descriptor for itself, opened as its Client's
+//  user, and its entries are read and lstat'ed relative to it, so
+//  famd never changes its working directory.  The descriptor is
+//  reopened at each scan of the Directory, in case the name now
+//  refers to a different directory.
+//
+//  On a local filesystem, a Directory whose lstat hasn't changed since
+//  it was last read isn't read again: it can't have gained or lost
+//  entries, and its entries' own changes come to them from imon or
+//  the Pollster.  That only holds if its mtime and ctime were already
+//  RACY_SECS old when it was read, because a change in the same tick
+//  of the filesystem's clock needn't have moved them.
 
 class Directory : public ClientInterest {
 
@@ -47,9 +61,8 @@ public:
     Type type() const;
     Interest *find_name(const char *);
     virtual bool do_scan();
-    static bool chdir_root();
 
-    bool chdir();
+    int dir_fd();
 
 #if HAVE_SGI_NOHANG    
     void unhang();
@@ -58,16 +71,21 @@ public:
 private:
 
     enum { SCANNING = 1 << 0, RESCAN_SCHEDULED = 1 << 1 };
+    enum { RACY_SECS = 2 };
 
     //  Instance Variable
 
     DirEntry *entries;
+    Scheduler::TaskID rescan_task;
+    int dirfd;				// -1 if not open
+    time_t scanned;			// when last read, or 0
 
     pid_t unhangPid;
 
-    //  Class Variable
+    //  Private Instance Method
 
-    static Directory *current_dir;
+    void close_dir();
+    bool unchanged_since_read() const;
 
     //  Class Methods
 
@@ -23,13 +23,20 @@
 #include "DirectoryScanner.h"
 
 #include <assert.h>
+#include <fcntl.h>
 #include <string.h>
 #include <errno.h>
+#include <unistd.h>
 
 #include "Client.h"
 #include "Directory.h"
 #include "DirEntry.h"
+#include "FileSystem.h"
 #include "Log.h"
+#include "StatPool.h"
+#include "Stats.h"
+
+static Stats::Counter stats_deferred("entry stats deferred");
 
 //////////////////////////////////////////////////////////////////////////////
 
@@ -38,10 +45,17 @@ DirectoryScanner::DirectoryScanner(Directory& d,
 				   DoneHandler dh, void *vp)
     : directory(d), done_handler(dh), closure(vp), new_event(e),
       scan_entries(b), dir(NULL), openErrno(0),
-      epp(&d.entries), discard(NULL)
-      
+      epp(&d.entries), nentries(0), unmatched(NULL), unmatched_size(0),
+      unmatched_count(0), unmatched_next(0),
+      batching(b && !d.filesystem()->stats_may_hang()), batch(NULL)
 {
-    dir = opendir(d.name());
+    FileSystem::LatencyTimer timer;
+    int fd = d.dir_fd();
+    if (fd >= 0)
+	fd = openat(fd, ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd >= 0 && (dir = fdopendir(fd)) == NULL)
+	(void) close(fd);
+    timer.stop(d.filesystem());
     if (dir == NULL) {
 	openErrno = errno;
     }
@@ -51,21 +65,153 @@ DirectoryScanner::~DirectoryScanner()
 {
     if (dir)
 	closedir(dir);
+    delete [] unmatched;
+    delete batch;
 }
 
 //////////////////////////////////////////////////////////////////////////////
 
-// return address of ptr to entry matching name
+//  The unmatched table is open-addressed.  An entry that readdir finds
+//  is replaced by CLAIMED, so later probes go past it; the table never
+//  grows, so it never needs cleaning up.
+
+static char claimed_slot;
+#define CLAIMED ((DirEntry *) &claimed_slot)
+
+unsigned
+DirectoryScanner::name_hash(const char *name)
+{
+    unsigned h = 2166136261U;			// FNV-1a
+    while (*name)
+	h = (h ^ (unsigned char) *name++) * 16777619U;
+    return h;
+}
+
+//  index_rest moves the rest of the entry list into the unmatched table.
+
+void
+DirectoryScanner::index_rest()
+{
+    assert(!unmatched);
+    unsigned n = 0;
+    for (DirEntry *ep = *epp; ep; ep = ep->next)
+	n++;
+    for (unmatched_size = 16; unmatched_size < n * 2; unmatched_size *= 2)
+	continue;
+    unmatched = new DirEntry *[unmatched_size];
+    memset(unmatched, 0, unmatched_size * sizeof *unmatched);
+
+    unsigned mask = unmatched_size - 1;
+    for (DirEntry *next, *ep = *epp; ep; ep = next)
+    {   next = ep->next;
+	unsigned i = name_hash(ep->name()) & mask;
+	while (unmatched[i])
+	    i = (i + 1) & mask;
+	unmatched[i] = ep;
+    }
+    unmatched_count = n;
+    *epp = NULL;
+}
+
+//  claim removes the entry matching name from the unmatched table.
 
-DirEntry **
-DirectoryScanner::match_name(DirEntry **epp, const char *name)
+DirEntry *
+DirectoryScanner::claim(const char *name)
 {
-    for (DirEntry *ep; ((ep = *epp) != NULL); epp = &ep->next)
-	if (!strcmp(ep->name(), name))
-	    return epp;
+    unsigned mask = unmatched_size - 1;
+    for (unsigned i = name_hash(name) & mask; unmatched[i]; i = (i + 1) & mask)
+    {   DirEntry *ep = unmatched[i];
+	if (ep != CLAIMED && !strcmp(ep->name(), name))
+	{   unmatched[i] = CLAIMED;
+	    unmatched_count--;
+	    return ep;
+	}
+    }
     return NULL;
 }
 
+//  next_unmatched removes and returns any entry left in the table.
+
+DirEntry *
+DirectoryScanner::next_unmatched()
+{
+    while (unmatched_count && unmatched_next < unmatched_size)
+    {   DirEntry *ep = unmatched[unmatched_next];
+	unmatched[unmatched_next++] = CLAIMED;
+	if (ep && ep != CLAIMED)
+	{   unmatched_count--;
+	    return ep;
+	}
+    }
+    return NULL;
+}
+
+//  batch_entry adds an entry to the batch waiting for lstats.
+
+void
+DirectoryScanner::batch_entry(DirEntry *ep)
+{
+    if (!batch)
+    {   batch = new Batch;
+	batch->count = batch->next = 0;
+	batch->statted = false;
+    }
+    assert(!batch->statted && batch->count < StatBatch::MAX_BATCH);
+    batch->entries[batch->count] = ep;
+    batch->names[batch->count] = ep->name();
+    batch->count++;
+}
+
+//  unstat_batch drops the lstats of the entries not yet scanned, so
+//  scan_batch takes them again.  Scanning with stale ones could roll
+//  back the Watch's stat, which every Interest on it shares.
+
+void
+DirectoryScanner::unstat_batch()
+{
+    Batch *bp = batch;
+    unsigned n = 0;
+    for (unsigned i = bp->next; i < bp->count; i++, n++)
+    {   bp->entries[n] = bp->entries[i];
+	bp->names[n] = bp->names[i];
+    }
+    bp->count = n;
+    bp->next = 0;
+    bp->statted = false;
+}
+
+//  scan_batch lstats the batch, if that hasn't been done yet, and
+//  scans its entries until output blocks.  Returns whether the client
+//  is still ready for events.
+
+bool
+DirectoryScanner::scan_batch(bool ready)
+{
+    Batch *bp = batch;
+    if (!bp || !bp->count)
+	return ready;
+    if (!bp->statted)
+    {   FileSystem::LatencyTimer timer;
+	StatBatch::stat(directory.dir_fd(), bp->count, bp->names,
+			bp->statuses, bp->errors,
+			directory.filesystem()->stats_may_be_cached());
+	directory.filesystem()->record_latency(timer.usecs() / bp->count);
+	bp->statted = true;
+    }
+    while (bp->next < bp->count && ready)
+    {   unsigned i = bp->next++;
+	bp->entries[i]->scan_prefetched(bp->errors[i] ? NULL
+						      : &bp->statuses[i],
+					bp->errors[i]);
+	ready = directory.client()->ready_for_events();
+    }
+    if (bp->next == bp->count)
+    {   bp->count = bp->next = 0;
+	bp->statted = false;
+    }
+    return ready;
+}
+
 bool
 DirectoryScanner::done()
 {
@@ -81,23 +227,36 @@ DirectoryScanner::done()
     bool ready = directory.client()->ready_for_events();
 
     directory.become_user();
-    if (!directory.chdir()) {
+    if (directory.dir_fd() < 0) {
         // Didn't have permission to read the directory.  Send Delete events
         // for its contents.
         while (*epp && ready)
         {   DirEntry *ep = *epp;
 	    *epp = ep->next;
-	    ep->post_event(Event::Deleted);
+	    ep->report_deleted();
+	    ready = directory.client()->ready_for_events();
+	    delete ep;
+        }
+        while (unmatched_count && ready)
+        {   DirEntry *ep = next_unmatched();
+	    ep->report_deleted();
 	    ready = directory.client()->ready_for_events();
 	    delete ep;
         }
-        if (*epp || !ready)
+        if (*epp || unmatched_count || !ready)
 	    return false;
 
         (*done_handler)(closure);
         return true;
     }
     
+    //  Finish the batch output blocked last time, with fresh lstats.
+
+    if (batch && batch->statted)
+    {   unstat_batch();
+	ready = scan_batch(ready);
+    }
+
     while (dir && ready)
     {
 	struct direct *dp = readdir(dir);
@@ -112,71 +271,85 @@ DirectoryScanner::done()
 	if (!strcmp(dp->d_name, ".") || !strcmp(dp->d_name, ".."))
 	    continue;
 
-	DirEntry *ep = *epp, **epp2;
+	//  While readdir agrees with the list, just walk the list.
+	//  At the first disagreement, move the rest of the list
+	//  into the unmatched table, and from then on append
+	//  entries to the list in the order readdir returns them.
+
+	DirEntry *ep = *epp;
 	if (ep && !strcmp(dp->d_name, ep->name()))
 	{
 	    //  Next entry in list matches. Do not change list.
 
 	    // Log::debug("checkdir match %s", dp->d_name);
 	}
-	else if ((epp2 = match_name(&discard, dp->d_name)) != NULL)
-	{
-	    //  Found in discard.  Insert discarded entry before ep.
-
-	    // Log::debug("checkdir fdisc %s", dp->d_name);
-	    ep = *epp2;
-	    *epp2 = ep->next;
-	    ep->next = *epp;
-	    *epp = ep;
-	}
-	else if (ep && (epp2 = match_name(&ep->next, dp->d_name)))
-	{
-	    //  Found further in list.  Prepend internode segment
-	    //  to discard.
+	else
+	{   if (ep)
+		index_rest();
+	    ep = unmatched_count ? claim(dp->d_name) : NULL;
+	    if (ep)
+	    {
+		//  Found out of order.  Append it to the list.
 
-	    // Log::debug("checkdir furth %s", dp->d_name);
-	    ep = *epp2;
-	    *epp2 = discard;
-	    discard = *epp;
-	    *epp = ep;
+		// Log::debug("checkdir found %s", dp->d_name);
+		ep->next = NULL;
+		*epp = ep;
+	    }
 	}
-	else
+	if (!ep)
 	{
 	    // New entry. Insert.
 
-	    ep = new DirEntry(dp->d_name, &directory, *epp);
+	    unsigned max = directory.filesystem()->max_entries();
+	    ep = new DirEntry(dp->d_name, &directory, *epp,
+			      !max || nentries < max);
+	    nentries++;
 	    *epp = ep;
 	    ep->post_event(new_event);
 	    ready = directory.client()->ready_for_events();
 	    epp = &ep->next;
 	    continue;		// Do not scan newly created entry.
 	}
-	if (scan_entries)
-	{   ep->scan_no_chdir();
+	nentries++;
+	if (batching)
+	{   batch_entry(ep);
+	    if (batch->count == StatBatch::MAX_BATCH)
+		ready = scan_batch(ready);
+	}
+	else if (scan_entries)
+	{   //  If the pool won't take the entry and its lstat may hang,
+	    //  leave it for the next scan instead of stat'ing inline.
+
+	    if (!ep->stat_in_pool())
+	    {   if (!StatPool::enabled()
+		    || !directory.filesystem()->stats_may_hang())
+		    ep->scan();
+		else
+		    stats_deferred++;
+	    }
 	    ready = directory.client()->ready_for_events();
 	}
 	epp = &ep->next;
     }
+    if (!dir)
+	ready = scan_batch(ready);
 
-    directory.chdir_root();  // chdir back to "/"
-    
     while (*epp && ready)
     {   DirEntry *ep = *epp;
 	*epp = ep->next;
-	ep->post_event(Event::Deleted);
+	ep->report_deleted();
 	ready = directory.client()->ready_for_events();
 	delete ep;
     }
 
-    while (discard && ready)
-    {   DirEntry *ep = discard;
-	discard = discard->next;
-	ep->post_event(Event::Deleted);
+    while (unmatched_count && ready)
+    {   DirEntry *ep = next_unmatched();
+	ep->report_deleted();
 	ready = directory.client()->ready_for_events();
 	delete ep;
     }
 	
-    if (dir || *epp || discard || !ready)
+    if (dir || *epp || unmatched_count || !ready || (batch && batch->count))
 	return false;
 
     (*done_handler)(closure);
@@ -30,6 +30,7 @@
 #include <sys/dir.h>
 
 #include "Event.h"
+#include "StatBatch.h"
 
 class Client;
 class Directory;
@@ -45,6 +46,22 @@ class DirEntry;
 //
 //  This whole flow control thing needs a good redesign.
 //
+//  Usually readdir returns entries in the same order as last time, and
+//  the scanner just walks the entry list.  If it returns one out of
+//  order, the rest of the list is indexed by name so that reconciling
+//  a shuffled directory stays linear.
+//
+//  On local filesystems, the entries' lstats are done in batches with
+//  StatBatch, relative to the directory's descriptor, and then the
+//  entries are scanned with the results.  If output blocks partway
+//  through a batch, the rest of it waits in the scanner for the next
+//  call to done(), which lstats it again, since by then the results
+//  may be arbitrarily old.  Entries on filesystems that might hang
+//  are handed to the StatPool instead.
+//
+//  If the Directory's FileSystem limits how many entries are watched
+//  individually, new entries past that many aren't.
+//
 //  Since a large number of DirectoryScanners is created, we have our
 //  own new and delete operators.  They cache the most recently freed
 //  DirectoryScanner for re-use.
@@ -75,7 +92,30 @@ private:
     DIR *dir;
     int openErrno;
     DirEntry **epp;
-    DirEntry *discard;
+    unsigned nentries;			// readdir has returned so far
+
+    //  Entries not yet found by readdir, once it has returned one
+    //  out of order, hashed by name.
+
+    DirEntry **unmatched;
+    unsigned unmatched_size;		// power of two
+    unsigned unmatched_count;
+    unsigned unmatched_next;		// where to look for leftovers
+
+    //  Entries waiting for their lstats, or to be scanned with them.
+
+    struct Batch {
+	DirEntry *entries[StatBatch::MAX_BATCH];
+	const char *names[StatBatch::MAX_BATCH];
+	struct stat statuses[StatBatch::MAX_BATCH];
+	int errors[StatBatch::MAX_BATCH];
+	unsigned count;
+	unsigned next;			// next to scan, once stat'd
+	bool statted;
+    };
+
+    const bool batching;
+    Batch *batch;			// NULL until needed
 
     //  Class Variable
 
@@ -83,7 +123,16 @@ private:
 
     //  Private Instance Methods
 
-    DirEntry **match_name(DirEntry **epp, const char *name);
+    void index_rest();
+    DirEntry *claim(const char *name);
+    DirEntry *next_unmatched();
+    void batch_entry(DirEntry *);
+    void unstat_batch();
+    bool scan_batch(bool ready);
+
+    //  Private Class Method
+
+    static unsigned name_hash(const char *);
 
 };
 
@@ -35,6 +35,7 @@ const Event Event::Created     = Event(CreatedT);
 const Event Event::Acknowledge = Event(AcknowledgeT);
 const Event Event::Exists      = Event(ExistsT);
 const Event Event::EndExist    = Event(EndExistT);
+const Event Event::Overflow    = Event(OverflowT);
 const Event Event::Error       = Event(ErrorT);
 
 
@@ -61,6 +62,8 @@ Event::getEventFromOpcode(char opcode)
         return &Exists;
     case 'P':
 	return &EndExist;
+    case 'O':
+	return &Overflow;
     default:
 	Log::error("unrecognized event opcode '%c' ('\0%o')",
 		   opcode, opcode & 0377);
@@ -102,6 +105,9 @@ Event::name() const
     case EndExistT:
 	return "EndExist";
 
+    case OverflowT:
+	return "Overflow";
+
     default:
 	sprintf(buf, "UNKNOWN EVENT %d", which);
 	return buf;
@@ -113,7 +119,7 @@ Event::code() const
 {
     // Map event to letter.
 
-    static const char codeletters[] = "?cAXQFMGeP";
+    static const char codeletters[] = "?cAXQFMGePO";
     assert(which < sizeof codeletters - 1);
     char code = codeletters[which];
     assert(code != '?');
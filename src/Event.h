@@ -50,6 +50,7 @@ public:
     static const Event Acknowledge;
     static const Event Exists;
     static const Event EndExist;
+    static const Event Overflow;
 
 private: 
     static const Event Error;
@@ -63,6 +64,7 @@ private:
 	AcknowledgeT = FAMAcknowledge,    // 'G'
 	ExistsT      = FAMExists,         // 'e'
 	EndExistT    = FAMEndExist,       // 'P'
+	OverflowT    = FAMOverflow,       // 'O'
         ErrorT                            // '?'
     };
     Event(Type n)                       : which(n){};
@@ -0,0 +1,205 @@
+//  Copyright (C) 1999 Silicon Graphics, Inc.  All Rights Reserved.
+//  
+//  This program is free software; you can redistribute it and/or modify it
+//  under the terms of version 2 of the GNU General Public License as
+//  published by the Free Software Foundation.
+//
+//  This program is distributed in the hope that it would be useful, but
+//  WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  Further, any
+//  license provided herein, whether implied or otherwise, is limited to
+//  this program in accordance with the express provisions of the GNU
+//  General Public License.  Patent licenses, if any, provided herein do not
+//  apply to combinations of this program with other product or programs, or
+//  any other product whatsoever.  This program is distributed without any
+//  warranty that the program is delivered free of the rightful claim of any
+//  third person by way of infringement or the like.  See the GNU General
+//  Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License along
+//  with this program; if not, write the Free Software Foundation, Inc., 59
+//  Temple Place - Suite 330, Boston MA 02111-1307, USA.
+
+#include "config.h"
+#include "EventRing.h"
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#if HAVE_SYS_EVENTFD_H
+#include <sys/eventfd.h>
+#endif
+
+#include "Log.h"
+#include "Record.h"
+#include "Ring.h"
+#include "Scheduler.h"
+#include "Stats.h"
+
+static Stats::Counter ring_events("events put in rings");
+static Stats::Counter ring_wakeups("ring wakeups");
+static Stats::Counter rings_full("rings full");
+
+EventRing::EventRing(Ring *r, unsigned size, const int *fds,
+		     RoomHandler h, void *c)
+    : ring(r), ringsize(size), tail(0), handler(h), closure(c)
+{
+    for (int i = 0; i < NFDS; i++)
+	fd[i] = fds[i];
+    (void) Scheduler::install_read_handler(fd[2], room_handler, this);
+}
+
+EventRing::~EventRing()
+{
+    (void) Scheduler::remove_read_handler(fd[2]);
+    for (int i = 0; i < NFDS; i++)
+	if (fd[i] >= 0)
+	    (void) close(fd[i]);
+    (void) munmap(ring, Ring::mapsize(ringsize));
+}
+
+//  create rounds size up to a power of two no smaller than
+//  Ring::MINSIZE.  The memfd is sealed at that size, so the client
+//  can't shrink it out from under fam's mapping.
+
+EventRing *
+EventRing::create(unsigned size, RoomHandler h, void *c)
+{
+#if HAVE_EVENT_RING
+    unsigned n = Ring::MINSIZE;
+    while (n < size && n < 1U << 30)
+	n <<= 1;
+
+    int fds[NFDS];
+    fds[0] = memfd_create("fam event ring", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (fds[0] < 0)
+    {   Log::perror("can't create event ring");
+	return NULL;
+    }
+    if (ftruncate(fds[0], Ring::mapsize(n)) < 0)
+    {   Log::perror("can't size event ring");
+	(void) close(fds[0]);
+	return NULL;
+    }
+    if (fcntl(fds[0], F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW) < 0)
+    {   Log::perror("can't seal event ring");
+	(void) close(fds[0]);
+	return NULL;
+    }
+    void *p = mmap(NULL, Ring::mapsize(n), PROT_READ | PROT_WRITE,
+		   MAP_SHARED, fds[0], 0);
+    if (p == MAP_FAILED)
+    {   Log::perror("can't map event ring");
+	(void) close(fds[0]);
+	return NULL;
+    }
+    fds[1] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    fds[2] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (fds[1] < 0 || fds[2] < 0)
+    {   Log::perror("can't create event ring's eventfds");
+	for (int i = 0; i < NFDS; i++)
+	    if (fds[i] >= 0)
+		(void) close(fds[i]);
+	(void) munmap(p, Ring::mapsize(n));
+	return NULL;
+    }
+
+    Ring *ring = (Ring *) p;		// the memfd starts out zeroed
+    ring->size = n;			// for the client
+    ring->waiting = 1;			// client hasn't looked yet
+    return new EventRing(ring, n, fds, h, c);
+#else
+    return NULL;
+#endif
+}
+
+unsigned
+EventRing::size() const
+{
+    return ringsize;
+}
+
+//  space returns how many bytes are free, or 0 if the client's head
+//  makes no sense.
+
+unsigned
+EventRing::space() const
+{
+    unsigned used = tail - ring->head;
+    return used <= ringsize ? ringsize - used : 0;
+}
+
+bool
+EventRing::has_room() const
+{
+    return space() >= 2 * Ring::MAXRECORD;
+}
+
+void
+EventRing::sent()
+{
+    (void) close(fd[0]);
+    fd[0] = -1;
+}
+
+void
+EventRing::put(const Record& record)
+{
+    if (Record::HEADERSIZE + record.pathlen > Ring::MAXRECORD)
+    {   Log::error("tried to put a record that was too big in a ring");
+	return;
+    }
+
+    //  A record is never split at the end of the ring; a zero byte
+    //  there tells the client to start again at the beginning.
+
+    unsigned need = Record::HEADERSIZE + record.pathlen;
+    unsigned t = tail, i = t & (ringsize - 1);
+    unsigned skip = need > ringsize - i ? ringsize - i : 0;
+    if (space() < skip + need)
+	return;				// the client scribbled on head
+    char *data = ring->data();
+    if (skip)
+    {   data[i] = '\0';
+	t += skip;
+	i = 0;
+    }
+    record.put(data + i);
+    __sync_synchronize();
+    tail = ring->tail = t + need;
+    ring_events++;
+
+    //  If the client is waiting, wake it.
+
+    __sync_synchronize();
+    if (ring->waiting)
+    {   ring->waiting = 0;
+	uint64_t one = 1;
+	(void) write(fd[1], &one, sizeof one);
+	ring_wakeups++;
+    }
+}
+
+//  wait_for_room sets blocked and then looks again, so it doesn't miss
+//  room the client made meanwhile.
+
+bool
+EventRing::wait_for_room()
+{
+    ring->blocked = 1;
+    __sync_synchronize();
+    if (has_room())
+	return false;
+    rings_full++;
+    return true;
+}
+
+void
+EventRing::room_handler(int fd, void *closure)
+{
+    EventRing *er = (EventRing *) closure;
+    uint64_t n;
+    (void) read(fd, &n, sizeof n);
+    (*er->handler)(er->closure);
+}
@@ -0,0 +1,86 @@
+//  Copyright (C) 1999 Silicon Graphics, Inc.  All Rights Reserved.
+//  
+//  This program is free software; you can redistribute it and/or modify it
+//  under the terms of version 2 of the GNU General Public License as
+//  published by the Free Software Foundation.
+//
+//  This program is distributed in the hope that it would be useful, but
+//  WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  Further, any
+//  license provided herein, whether implied or otherwise, is limited to
+//  this program in accordance with the express provisions of the GNU
+//  General Public License.  Patent licenses, if any, provided herein do not
+//  apply to combinations of this program with other product or programs, or
+//  any other product whatsoever.  This program is distributed without any
+//  warranty that the program is delivered free of the rightful claim of any
+//  third person by way of infringement or the like.  See the GNU General
+//  Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License along
+//  with this program; if not, write the Free Software Foundation, Inc., 59
+//  Temple Place - Suite 330, Boston MA 02111-1307, USA.
+
+#ifndef EventRing_included
+#define EventRing_included
+
+#include "Boolean.h"
+
+struct Record;
+struct Ring;
+
+//  An EventRing is fam's end of a Ring (see Ring.h) shared with one
+//  local client.  create() makes the memfd and the two eventfds; the
+//  ClientConnection sends their descriptors to the client, then calls
+//  sent() to close the memfd, which stays mapped.
+//
+//  put() puts an event record in the ring, which must have room, and
+//  wakes the client if it's waiting.  When the ring is full,
+//  wait_for_room() sets the ring's blocked flag, and the RoomHandler
+//  is called when the client has made room.  wait_for_room() returns
+//  false if the client made room meanwhile.
+//
+//  The client can scribble on the ring, so its size and tail live
+//  here, and the client's head is checked before it's believed.  A
+//  bad head makes the ring look full, which only stalls that client.
+//
+//  create() returns NULL where there are no rings.
+
+class EventRing {
+
+public:
+
+    typedef void (*RoomHandler)(void *closure);
+    enum { NFDS = 3 };			// memfd, events, room
+
+    static EventRing *create(unsigned size, RoomHandler, void *closure);
+    ~EventRing();
+
+    unsigned size() const;
+    const int *fds() const		{ return fd; }
+    void sent();
+    bool has_room() const;
+    void put(const Record&);
+    bool wait_for_room();
+
+private:
+
+    Ring *ring;
+    unsigned ringsize;			// of the records, a power of two
+    unsigned tail;			// bytes put
+    int fd[NFDS];
+    RoomHandler handler;
+    void *closure;
+
+    EventRing(Ring *, unsigned size, const int *fds,
+	      RoomHandler, void *closure);
+
+    unsigned space() const;
+
+    static void room_handler(int fd, void *closure);
+
+    EventRing(const EventRing&);	// Do not copy
+    EventRing& operator = (const EventRing&);	//  or assign.
+
+};
+
+#endif /* !EventRing_included */
@@ -25,16 +25,41 @@
 #include <mntent.h>
 #include <string.h>
 
+#include "Cred.h"
 #include "Event.h"
+#include "FileSystemTable.h"
+#include "Log.h"
+#include "Pollster.h"
+#include "Stats.h"
+#include "timeval.h"
+
+unsigned FileSystem::slow_msecs;
+unsigned FileSystem::slow_intvl;
+
+static Stats::Counter filesystems_slowed("filesystems slowed");
 
 FileSystem::FileSystem(const mntent& mnt)
     : mydir   (strcpy(new char[strlen(mnt.mnt_dir   ) + 1], mnt.mnt_dir   )),
-      myfsname(strcpy(new char[strlen(mnt.mnt_fsname) + 1], mnt.mnt_fsname))
-{ }
+      myfsname(strcpy(new char[strlen(mnt.mnt_fsname) + 1], mnt.mnt_fsname)),
+      mypolicy(FileSystemTable::policy(mnt)),
+      nsamples(0),
+      is_slow(false),
+      fast_checks(0),
+      check_taskid(0),
+      probe(NULL),
+      probe_refused(false),
+      statgroup(StatPool::new_group())
+{
+    memset(latency, 0, sizeof latency);
+}
 
 FileSystem::~FileSystem()
 {
     assert(!myinterests.size());
+    Scheduler::remove_recurring_task(check_taskid);
+    if (probe)
+	StatPool::cancel(probe);
+    StatPool::release(statgroup);
     delete [] mydir;
     delete [] myfsname;
 }
@@ -69,3 +94,232 @@ FileSystem::cancel(ClientInterest *cip, Request request)
     hl_cancel(request);
     myinterests.remove(cip);
 }
+
+//////////////////////////////////////////////////////////////////////////////
+//  Policy
+
+//  merge takes every setting that's set in that.
+
+void
+FileSystem::Policy::merge(const Policy& that)
+{
+    if (that.kernel_only >= 0)
+	kernel_only = that.kernel_only;
+    if (that.poll_interval >= 0)
+	poll_interval = that.poll_interval;
+    if (that.max_entries >= 0)
+	max_entries = that.max_entries;
+    if (that.scan_entries >= 0)
+	scan_entries = that.scan_entries;
+}
+
+bool
+FileSystem::scans_entries() const
+{
+    if (mypolicy.scan_entries >= 0)
+	return mypolicy.scan_entries != 0;
+    return dir_entries_scanned();
+}
+
+//  polling_interval returns the fewest seconds between polls of a
+//  file on this FileSystem, or 0 if its files aren't to be polled.
+
+unsigned
+FileSystem::polling_interval() const
+{
+    if (kernel_only())
+	return 0;
+    unsigned secs = Pollster::interval();
+    if (mypolicy.poll_interval > 0)
+	secs = mypolicy.poll_interval;
+    if (is_slow)
+    {   if (!slow_intvl)
+	    return 0;
+	if (secs < slow_intvl)
+	    secs = slow_intvl;
+    }
+    return secs ? secs : 1;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+//  Latency tracking
+
+unsigned long
+FileSystem::LatencyTimer::usecs() const
+{
+    timeval now;
+    (void) gettimeofday(&now, NULL);
+    timeval t = now - start;
+    return t.tv_sec < 0 ? 0 : t.tv_sec * 1000000UL + t.tv_usec;
+}
+
+//  record_latency counts a stat or directory open that took usecs.
+//  The first one starts the checks.
+
+void
+FileSystem::record_latency(unsigned long usecs)
+{
+    if (!slow_msecs)
+	return;
+    unsigned b = 0;
+    while (usecs && b < NBUCKETS - 1)
+    {   b++;
+	usecs >>= 1;
+    }
+    latency[b]++;
+    nsamples++;
+
+    if (!check_taskid)
+    {   timeval interval = { CHECK_SECS, 0 };
+	check_taskid = Scheduler::install_recurring_task(interval,
+							 check_task, this);
+    }
+}
+
+//  percentile returns the bucket the pct'th percentile of the
+//  recorded latencies falls in.  Bucket b holds latencies from
+//  2^(b-1) up to 2^b microseconds.
+
+unsigned
+FileSystem::percentile(unsigned pct) const
+{
+    unsigned long want = ((unsigned long) nsamples * pct + 99) / 100;
+    unsigned long seen = 0;
+    for (unsigned b = 0; b < NBUCKETS; b++)
+    {   seen += latency[b];
+	if (seen >= want)
+	    return b;
+    }
+    return NBUCKETS - 1;
+}
+
+//  polled_on_pass says whether the Pollster's pass'th pass over the
+//  remote hosts should poll files on this FileSystem.  The hosts are
+//  polled every polling interval, so a FileSystem that's polled less
+//  often sits out some passes.
+
+bool
+FileSystem::polled_on_pass(unsigned pass) const
+{
+    unsigned secs = polling_interval();
+    if (!secs)
+	return false;
+    unsigned every = Pollster::interval() ? secs / Pollster::interval()
+					  : secs;
+    return every <= 1 || pass % every == 0;
+}
+
+void
+FileSystem::check_task(void *closure)
+{
+    ((FileSystem *) closure)->check();
+}
+
+void
+FileSystem::check()
+{
+    //  Slow means surely over the threshold, and fast again means
+    //  surely under half of it.
+
+    unsigned long threshold = slow_msecs * 1000UL;
+    unsigned b = nsamples ? percentile(99) : 0;
+    unsigned long p99_low = b ? 1UL << (b - 1) : 0;
+    unsigned long p99_high = (1UL << b) - 1;
+
+    //  A probe that hasn't come back is as slow as it's been gone.
+
+    unsigned long hung = 0;
+    if (probe)
+    {   timeval now;
+	(void) gettimeofday(&now, NULL);
+	timeval t = now - probe_sent;
+	hung = t.tv_sec < 0 ? 0 : t.tv_sec * 1000000UL + t.tv_usec;
+	if (hung < threshold)
+	    hung = 0;
+    }
+    else if (probe_refused)
+	hung = threshold;
+
+    if (!is_slow && (hung || (nsamples >= MIN_SAMPLES && p99_low > threshold)))
+	become_slow(hung > p99_low ? hung : p99_low);
+    else if (is_slow)
+    {   if (!hung && !probe && nsamples && p99_high <= threshold / 2)
+	    fast_checks++;
+	else
+	    fast_checks = 0;
+	if (fast_checks >= FAST_CHECKS)
+	    become_fast(p99_high);
+    }
+
+    bool idle = !nsamples && !is_slow && !probe && !probe_refused;
+    memset(latency, 0, sizeof latency);
+    nsamples = 0;
+
+    if (idle)
+    {   Scheduler::remove_recurring_task(check_taskid);
+	check_taskid = 0;
+    }
+    else if (!probe && threshold)
+    {   (void) gettimeofday(&probe_sent, NULL);
+	probe = StatPool::submit(Cred::SuperUser, mydir, false, statgroup,
+				 probe_done, this);
+
+	//  Never stat the mount point here instead: if it's hung, so
+	//  are we.  A full group means our stats are backed up, which
+	//  is as slow as the threshold.  With no pool at all, every
+	//  stat is done and timed inline anyway, so there's nothing
+	//  a probe would tell us.
+
+	probe_refused = !probe && StatPool::enabled();
+    }
+}
+
+void
+FileSystem::probe_done(const struct stat *, int,
+		       unsigned long usecs, void *closure)
+{
+    FileSystem *fs = (FileSystem *) closure;
+    fs->probe = NULL;
+    fs->record_latency(usecs);
+}
+
+void
+FileSystem::become_slow(unsigned long usecs)
+{
+    is_slow = true;
+    fast_checks = 0;
+    filesystems_slowed++;
+    if (slow_intvl)
+	Log::error("%s is slow (stats take %lu ms or more); "
+		   "will poll it every %u seconds at most",
+		   mydir, usecs / 1000, slow_intvl);
+    else
+	Log::error("%s is slow (stats take %lu ms or more); "
+		   "will stop polling it",
+		   mydir, usecs / 1000);
+    resync_interests();
+}
+
+void
+FileSystem::become_fast(unsigned long usecs)
+{
+    is_slow = false;
+    Log::info("%s is fast again (stats take %lu ms or less); "
+	      "polling it as usual",
+	      mydir, usecs / 1000);
+    resync_interests();
+}
+
+//  resync_interests sends every ClientInterest on this FileSystem a
+//  Changed event, so the client takes a fresh look at it.
+
+void
+FileSystem::resync_interests()
+{
+    for (ClientInterest *cip = myinterests.first();
+	 cip;
+	 cip = myinterests.next(cip))
+    {
+	cip->resync();
+    }
+}
@@ -23,9 +23,13 @@
 #ifndef FileSystem_included
 #define FileSystem_included
 
+#include <sys/time.h>
+
 #include "ClientInterest.h"
 #include "Request.h"
+#include "Scheduler.h"
 #include "Set.h"
+#include "StatPool.h"
 
 struct mntent;
 struct stat;
@@ -81,6 +85,39 @@ struct stat;
 //	ll_notify_created()	notify the FS that the interest was deleted.
 //	ll_notify_deleted()	notify the FS that the interest was created.
 //
+//  A FileSystem has a Policy, which fam.conf can set for its mount
+//  point or its type (see FileSystemTable).  The Policy can say:
+//
+//	kernel_only	never poll files here; watch them with imon or
+//			not at all.
+//	poll_interval	poll files here no more often than this.
+//	max_entries	watch no more than this many entries of each
+//			directory individually; the rest are seen only
+//			when their directory is scanned.
+//	scan_entries	whether to lstat a directory's entries when
+//			it's scanned.
+//
+//  A setting the Policy leaves unset (-1) takes the default.
+//
+//  A FileSystem keeps track of how long its stats and directory opens
+//  take.  Whoever does one times it with a LatencyTimer and records
+//  it.  Every CHECK_SECS, the FileSystem works out the 99th percentile
+//  of what was recorded, and also stats its mount point in the
+//  StatPool as a probe, so it hears about a filesystem that has hung
+//  outright; a probe the StatPool has no room for counts as slow.  If
+//  the 99th percentile is over the slow_fs_threshold option, or the
+//  last probe still hasn't come back after that long, the FileSystem
+//  is slow: files on it are polled no more often than every
+//  slow_fs_polling_interval seconds, or not at all if that's zero.
+//  Clients watching files on it are sent a Changed event, so they can
+//  take a look for themselves.  When the 99th percentile stays under
+//  half the threshold for FAST_CHECKS checks in a row, the FileSystem
+//  is fast again, and clients are sent another Changed event for
+//  anything polling missed.
+//
+//  Stats of files on the FileSystem go in its own StatPool::Group,
+//  so a hung filesystem can't take every stat thread.
+//
 //  The two subclasses of FileSystem are LocalFileSystem and
 //  NFSFileSystem.  LocalFileSystem implements the low level
 //  interface.  NFSFileSystem implements the high level interface.
@@ -101,9 +138,57 @@ public:
     const char *fsname() const		{ return myfsname; }
     const Interests& interests()	{ return myinterests; }
     virtual bool dir_entries_scanned() const = 0;
+    virtual bool stats_may_be_cached() const = 0;
+    virtual bool stats_may_hang() const = 0;
+    virtual bool dir_mtime_reliable() const = 0;
     void relocate_interests();
     virtual int get_attr_cache_timeout() const = 0;
 
+    //  Policy
+
+    struct Policy {
+	int kernel_only;
+	int poll_interval;		// seconds
+	int max_entries;
+	int scan_entries;
+
+	Policy()			: kernel_only(-1), poll_interval(-1),
+					  max_entries(-1), scan_entries(-1)
+					{ }
+	void merge(const Policy&);
+    };
+
+    const Policy& policy() const	{ return mypolicy; }
+    bool kernel_only() const		{ return mypolicy.kernel_only > 0; }
+    bool scans_entries() const;
+    unsigned max_entries() const	{ return mypolicy.max_entries > 0 ?
+						 mypolicy.max_entries : 0; }
+    unsigned polling_interval() const;
+
+    //  Latency tracking
+
+    class LatencyTimer {
+
+    public:
+
+	LatencyTimer()			{ (void) gettimeofday(&start, NULL); }
+	void stop(FileSystem *fs) const	{ fs->record_latency(usecs()); }
+	unsigned long usecs() const;
+
+    private:
+
+	timeval start;
+
+    };
+
+    void record_latency(unsigned long usecs);
+    bool slow() const			{ return is_slow; }
+    StatPool::Group *stat_group() const	{ return statgroup; }
+    bool polled_on_pass(unsigned pass) const;
+    static void slow_threshold(unsigned msecs) { slow_msecs = msecs; }
+    static void slow_polling_interval(unsigned secs) { slow_intvl = secs; }
+    static unsigned slow_polling_interval() { return slow_intvl; }
+
     //  High level monitoring interface
 
     Request      monitor(ClientInterest *, ClientInterest::Type);
@@ -121,11 +206,39 @@ public:
 
 private:
 
+    enum { NBUCKETS = 32, CHECK_SECS = 10, MIN_SAMPLES = 20, FAST_CHECKS = 3 };
+
     //  Instance Variables
 
     char *mydir;
     char *myfsname;
     Interests myinterests;
+    Policy mypolicy;
+    unsigned latency[NBUCKETS];		// by power of two microseconds
+    unsigned nsamples;
+    bool is_slow;
+    unsigned fast_checks;		// in a row, while slow
+    Scheduler::TaskID check_taskid;
+    StatPool::Job *probe;
+    timeval probe_sent;
+    bool probe_refused;			// StatPool group was full
+    StatPool::Group *statgroup;		// our lstats in the StatPool
+
+    //  Class Variables
+
+    static unsigned slow_msecs;
+    static unsigned slow_intvl;
+
+    //  Private Instance Methods
+
+    unsigned percentile(unsigned pct) const;
+    void check();
+    void become_slow(unsigned long usecs);
+    void become_fast(unsigned long usecs);
+    void resync_interests();
+    static void check_task(void *closure);
+    static void probe_done(const struct stat *, int error,
+			   unsigned long usecs, void *closure);
 
     virtual Request hl_monitor(ClientInterest *, ClientInterest::Type) = 0;
     virtual void    hl_cancel(Request) = 0;
@@ -55,6 +55,8 @@ FileSystemTable::NameTable *FileSystemTable::fs_by_name;
 const char		    FileSystemTable::mtab_name[] = MOUNTED;
 InternalClient		   *FileSystemTable::mtab_watcher;
 FileSystem		   *FileSystemTable::root;
+FileSystemTable::PolicyTable FileSystemTable::mount_policies;
+FileSystemTable::PolicyTable FileSystemTable::type_policies;
 
 #ifdef HAPPY_PURIFY
 
@@ -302,6 +304,47 @@ FileSystemTable::find(const char *path, const Cred& cr)
     return fs;
 }
 
+//////////////////////////////////////////////////////////////////////////////
+//  Policies.  Setting a policy that's already set merges the new
+//  settings into it.
+
+void
+FileSystemTable::set_mount_policy(const char *dir, const FileSystem::Policy& p)
+{
+    set_policy(mount_policies, dir, p);
+}
+
+void
+FileSystemTable::set_type_policy(const char *type, const FileSystem::Policy& p)
+{
+    set_policy(type_policies, type, p);
+}
+
+void
+FileSystemTable::set_policy(PolicyTable& table, const char *name,
+			    const FileSystem::Policy& p)
+{
+    FileSystem::Policy *pp = table.find(name);
+    if (!pp)
+    {   pp = new FileSystem::Policy;
+	table.insert(name, pp);
+    }
+    pp->merge(p);
+}
+
+FileSystem::Policy
+FileSystemTable::policy(const mntent& mnt)
+{
+    FileSystem::Policy p;
+    FileSystem::Policy *pp = type_policies.find(mnt.mnt_type);
+    if (pp)
+	p.merge(*pp);
+    pp = mount_policies.find(mnt.mnt_dir);
+    if (pp)
+	p.merge(*pp);
+    return p;
+}
+
 FileSystem *
 FileSystemTable::longest_prefix(const char *path)
 {
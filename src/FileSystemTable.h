@@ -24,17 +24,23 @@
 #define FileSystemTable_included
 
 #include "config.h"
+#include "FileSystem.h"
 #include "SmallTable.h"
 #include "StringTable.h"
 
 class Cred;
 class Event;
-class FileSystem;
 class InternalClient;
 
+struct mntent;
+
 //  FileSystemTable provides a static function, find(), which looks up
 //  a path and returns a pointer to the FileSystem where that path
 //  resides.
+//
+//  It also keeps the FileSystem Policies set in fam.conf, by mount
+//  point and by filesystem type.  policy() gives a new FileSystem
+//  the settings for its type, overridden by any for its mount point.
 
 class FileSystemTable {
 
@@ -47,10 +53,15 @@ public:
 
     static FileSystem *find(const char *path, const Cred& cr); 
 
+    static void set_mount_policy(const char *dir, const FileSystem::Policy&);
+    static void set_type_policy(const char *type, const FileSystem::Policy&);
+    static FileSystem::Policy policy(const mntent&);
+
 private:
 
     typedef SmallTable<unsigned long, FileSystem *> IDTable;
     typedef StringTable<FileSystem *> NameTable;
+    typedef StringTable<FileSystem::Policy *> PolicyTable;
 
     //  Class Variables
 
@@ -60,6 +71,8 @@ private:
     static NameTable *fs_by_name;
     static InternalClient *mtab_watcher;
     static FileSystem *root;
+    static PolicyTable mount_policies;
+    static PolicyTable type_policies;
 
     //  Class Methods
 
@@ -67,6 +80,8 @@ private:
     static void destroy_fses(NameTable *);
     static FileSystem *longest_prefix(const char *path);
     static void mtab_event_handler(const Event&, void *);
+    static void set_policy(PolicyTable&, const char *,
+			   const FileSystem::Policy&);
 
 };
 
@@ -25,25 +25,43 @@
 #include <assert.h>
 #include <errno.h>
 #include <fcntl.h>
-
-#if HAVE_IMON
-#ifdef __sgi
-#include <sys/imon.h>
-#else
-#include <linux/imon.h>
-#endif
-#endif
-
-#include <sys/sysmacros.h>
+#include <string.h>
 #include <unistd.h>
 
 #include "Interest.h"
 #include "Log.h"
+#include "MountMonitor.h"
 #include "Scheduler.h"
+#include "Stats.h"
 #include "alloc.h"
 
 int		   IMon::imonfd = -2;
 IMon::EventHandler IMon::ehandler = NULL;
+IMon::QueuedEvent *IMon::batch;
+unsigned	   IMon::batch_size;
+unsigned	   IMon::batch_alloc;
+unsigned	  *IMon::batch_index;
+unsigned	   IMon::index_size;
+unsigned	   IMon::batch_read;
+bool		   IMon::overflowed;
+
+static Stats::Counter batches("imon batches");
+static Stats::Counter events_read("imon events read");
+static Stats::Counter events_delivered("imon events delivered");
+static Stats::Counter overflows("imon overflows");
+
+static inline int
+event_kind(int event)
+{
+    return event == IMon::CHANGE ? IMon::CHANGE : IMon::EXEC;
+}
+
+static inline unsigned
+batch_hash(dev_t dev, ino_t ino, int kind)
+{
+    unsigned long long h = ((unsigned long long) dev * 31 + ino) * 2 + kind;
+    return (unsigned) ((h * 0x9E3779B97F4A7C15ULL) >> 32);
+}
 
 IMon::IMon(EventHandler h)
 {
@@ -89,7 +107,16 @@ IMon::express(const char *name, struct stat *status)
     if (!is_active())
 	return BAD;
 
-    return imon_express(name, status);
+    if (MountMonitor::express(name, status))
+	return OK;
+    if (imon_express(name, status) != OK)
+	return BAD;
+    if (MountMonitor::threshold())
+    {   struct stat st;
+	if (status || lstat(name, &st) == 0)
+	    MountMonitor::expressed(name, status ? status->st_dev : st.st_dev);
+    }
+    return OK;
 }
 
 IMon::Status
@@ -98,60 +125,112 @@ IMon::revoke(const char *name, dev_t dev, ino_t ino)
     if (!is_active())
 	return BAD;
 
+    if (MountMonitor::revoke(dev, ino))
+	return OK;
     return imon_revoke(name, dev, ino);
 }
 
+//  read_handler reads until the kernel queue is empty, or until it
+//  has read MAX_BATCH events, then delivers the batch.  If it stopped
+//  early, the descriptor is still readable and we'll be called again.
+
 void
 IMon::read_handler(int fd, void *)
 {
-#if HAVE_IMON
-    qelem_t readbuf[20];
-    int rc = read(fd, readbuf, sizeof readbuf);
-    if (rc < 0)
-        Log::perror("/dev/imon read");
-    else
-    {   assert(rc % sizeof (qelem_t) == 0);
-	rc /= sizeof (qelem_t);
-	for (int i = 0; i < rc; i++)
-	    if (readbuf[i].qe_what == IMON_OVER)
-		Log::error("imon event queue overflow");
-	    else
-	    {	dev_t dev = readbuf[i].qe_dev;
-		ino_t ino = readbuf[i].qe_inode;
-		intmask_t what = readbuf[i].qe_what;
-		Log::debug("imon said dev %d/%d, ino %ld changed%s%s%s%s%s%s",
-			   major(dev), minor(dev), ino,
-			   what & IMON_CONTENT   ? " CONTENT"   : "",
-			   what & IMON_ATTRIBUTE ? " ATTRIBUTE" : "",
-			   what & IMON_DELETE    ? " DELETE"    : "",
-			   what & IMON_EXEC      ? " EXEC"      : "",
-			   what & IMON_EXIT      ? " EXIT"      : "",
-#ifdef IMON_RENAME
-			   what & IMON_RENAME    ? " RENAME"    : "",
-#endif
-			   ""
-		    );
-		if (what & IMON_EXEC)
-		    (*ehandler)(dev, ino, EXEC);
-		if (what & IMON_EXIT)
-		    (*ehandler)(dev, ino, EXIT);
-		if (what & (IMON_CONTENT | IMON_ATTRIBUTE |
-			    IMON_DELETE
-#ifdef IMON_RENAME
-			    | IMON_RENAME
-#endif
-		    ))
-		    (*ehandler)(dev, ino, CHANGE);
-	    }
+    while (batch_read < MAX_BATCH && imon_read(fd))
+	continue;
+    flush();
+}
+
+//  flush delivers the batch, then the overflow, if there was one.
+
+void
+IMon::flush()
+{
+    if (batch_size)
+	deliver_batch();
+    batch_read = 0;
+    if (overflowed)
+    {   overflowed = false;
+	overflows++;
+	(*ehandler)(0, 0, OVERFLOW);
+    }
+}
+
+void
+IMon::deliver_batch()
+{
+    //  Empty the index before delivering.  The EventHandler may
+    //  express or revoke interest, but it never reads more events,
+    //  so the batch itself stays put until we're done with it.
+
+    unsigned n = batch_size;
+    batches++;
+    events_delivered += n;
+    Log::debug("imon batch of %u events", n);
+    for (unsigned i = 0; i < n; i++)
+	batch_index[batch[i].slot] = 0;
+    batch_size = 0;
+    for (unsigned i = 0; i < n; i++)
+	(*ehandler)(batch[i].dev, batch[i].ino, batch[i].event);
+}
+
+//  queue_event adds an event to the batch unless the batch already
+//  has one of the same kind for the same file.
+
+void
+IMon::queue_event(dev_t dev, ino_t ino, int event)
+{
+    events_read++;
+    batch_read++;
+    if (batch_size == batch_alloc)
+	grow_batch();
+
+    int kind = event_kind(event);
+    unsigned mask = index_size - 1;
+    unsigned slot = batch_hash(dev, ino, kind) & mask;
+    for (unsigned i; (i = batch_index[slot]) != 0; slot = (slot + 1) & mask)
+    {   QueuedEvent *qp = &batch[i - 1];
+	if (qp->dev == dev && qp->ino == ino
+	    && event_kind(qp->event) == kind)
+	{   qp->event = event;		// EXEC/EXIT: last one wins
+	    return;
+	}
+    }
+    QueuedEvent *qp = &batch[batch_size++];
+    qp->dev = dev;
+    qp->ino = ino;
+    qp->event = event;
+    qp->slot = slot;
+    batch_index[slot] = batch_size;
+}
+
+//  grow_batch makes room for more events.  The index is kept at
+//  least twice the size of the batch so probes stay short.
+
+void
+IMon::grow_batch()
+{
+    unsigned newalloc = batch_alloc ? batch_alloc * 2 : 256;
+    QueuedEvent *newbatch = new QueuedEvent[newalloc];
+    for (unsigned i = 0; i < batch_size; i++)
+	newbatch[i] = batch[i];
+    delete [] batch;
+    batch = newbatch;
+    batch_alloc = newalloc;
+
+    delete [] batch_index;
+    index_size = newalloc * 2;
+    batch_index = new unsigned[index_size];
+    memset(batch_index, 0, index_size * sizeof *batch_index);
+    unsigned mask = index_size - 1;
+    for (unsigned i = 0; i < batch_size; i++)
+    {   QueuedEvent *qp = &batch[i];
+	unsigned slot = batch_hash(qp->dev, qp->ino, event_kind(qp->event))
+			& mask;
+	while (batch_index[slot])
+	    slot = (slot + 1) & mask;
+	qp->slot = slot;
+	batch_index[slot] = i + 1;
     }
-#else
-    //  I forget why/how this happens, but I know it's happened to me
-    //  (something about building fam without imon support, but then it
-    //  tries and succeeds? in opening /dev/imon?)  Anyway, it shouldn't
-    //  do that.  This should be fixed.
-    Log::critical("imon event received by fam built without imon support... "
-                  "tell fam@oss.sgi.com to fix this!");
-    int i_dont_have_IMON = 0;
-    assert(i_dont_have_IMON);
-#endif  //  HAVE_IMON
 }
@@ -34,11 +34,30 @@ struct stat;
 //  IMon is an object encapsulating the interface to /dev/imon.
 //  There can only be one instantiation of the IMon object.
 //
+//  The low-level routines are implemented by one of IMonIrix,
+//  IMonLinux, IMonInotify or IMonNone, chosen by configure.
+//  IMonInotify uses inotify(7) in place of /dev/imon, and maps its
+//  watch descriptors back to the dev/ino pairs the EventHandler
+//  expects.
+//
 //  The user of this object uses express() and revoke() to
 //  express/revoke interest in a file to imon.  There is also
 //  a callback, the EventHandler.  When an imon event comes in,
 //  the EventHandler is called.
 //
+//  When the imon descriptor is readable, read_handler() drains the
+//  kernel queue, and the low-level imon_read() queues each event it
+//  reads with queue_event().  Repeats of a (dev, ino, kind) in one
+//  batch are dropped, then the EventHandler is called once for each
+//  remaining event, in the order they first arrived.  EXEC and EXIT
+//  are the same kind; the last one in the batch wins.
+//
+//  If the kernel's queue overflowed, events were lost, so after the
+//  batch the EventHandler is called with a dev/ino of 0/0 and the
+//  event OVERFLOW.
+//
+//  MountMonitor's fanotify events go through the same batch.
+//
 //  The user of the IMon object is the Interest class.
 
 class IMon {
@@ -46,7 +65,7 @@ class IMon {
 public:
 
     enum Status { OK = 0, BAD = -1 };
-    enum Event { EXEC, EXIT, CHANGE };
+    enum Event { EXEC, EXIT, CHANGE, OVERFLOW };
 
     typedef void (*EventHandler)(dev_t, ino_t, int event);
 
@@ -65,19 +84,46 @@ private:
     static int imonfd;
     static EventHandler ehandler;
 
-    static void read_handler(int fd, void *closure);
+    //  The batch, and an open-addressed index of it used to find
+    //  repeats.  Index slots hold a batch position plus one.
 
+    struct QueuedEvent {
+	dev_t dev;
+	ino_t ino;
+	int event;
+	unsigned slot;
+    };
+
+    enum { MAX_BATCH = 16384 };
+
+    static QueuedEvent *batch;
+    static unsigned batch_size;
+    static unsigned batch_alloc;
+    static unsigned *batch_index;
+    static unsigned index_size;		// power of two
+    static unsigned batch_read;		// events read, before dedup
+    static bool overflowed;
+
+    static void read_handler(int fd, void *closure);
+    static void flush();
+    static void deliver_batch();
+    static void queue_event(dev_t, ino_t, int event);
+    static void queue_overflow()	{ overflowed = true; }
+    static void grow_batch();
 
     //
     // Low-level imon routines.
     //
     static int imon_open();
+    static bool imon_read(int fd);	// true if there may be more
     Status imon_express(const char *name, struct stat *stat_return);
     Status imon_revoke(const char *name, dev_t dev, ino_t ino);
 
     IMon(const IMon&);			// Do not copy
     IMon & operator = (const IMon&);		//  or assign.
 
+friend class MountMonitor;
+
 };
 
 #endif /* !IMon_included */
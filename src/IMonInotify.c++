@@ -0,0 +1,228 @@
+//  Copyright (C) 1999 Silicon Graphics, Inc.  All Rights Reserved.
+//  
+//  This program is free software; you can redistribute it and/or modify it
+//  under the terms of version 2 of the GNU General Public License as
+//  published by the Free Software Foundation.
+//
+//  This program is distributed in the hope that it would be useful, but
+//  WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  Further, any
+//  license provided herein, whether implied or otherwise, is limited to
+//  this program in accordance with the express provisions of the GNU
+//  General Public License.  Patent licenses, if any, provided herein do not
+//  apply to combinations of this program with other product or programs, or
+//  any other product whatsoever.  This program is distributed without any
+//  warranty that the program is delivered free of the rightful claim of any
+//  third person by way of infringement or the like.  See the GNU General
+//  Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License along
+//  with this program; if not, write the Free Software Foundation, Inc., 59
+//  Temple Place - Suite 330, Boston MA 02111-1307, USA.
+
+#include "IMon.h"
+#include "Log.h"
+
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <sys/types.h>
+
+#include <errno.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "BTree.h"
+#include "Cred.h"
+#include "DevInoTable.h"
+
+//  inotify watches are per inode, and inotify_add_watch() returns the
+//  same watch descriptor for every name of an inode.  Interest
+//  revokes an inode only when its last Interest goes away, so one
+//  Watch per inode is enough.  Watches are found by watch descriptor
+//  when events arrive, and by dev/ino when Interest revokes them.
+//
+//  Only events about the watched file itself, or about names being
+//  added to or removed from a watched directory, are passed on.
+//  Changes to a file in a watched directory are reported through
+//  the file's own watch.
+//
+//  inotify has no equivalent of IMON_EXEC and IMON_EXIT, so
+//  executing/not executing events are never generated.
+
+const unsigned int INTEREST_MASK = (IN_MODIFY | IN_ATTRIB |
+				    IN_CREATE | IN_DELETE |
+				    IN_MOVED_FROM | IN_MOVED_TO |
+				    IN_DELETE_SELF | IN_MOVE_SELF |
+				    IN_DONT_FOLLOW);
+const unsigned int NAME_EVENTS = (IN_CREATE | IN_DELETE |
+				  IN_MOVED_FROM | IN_MOVED_TO);
+
+struct Watch {
+    int wd;
+    dev_t dev;
+    ino_t ino;
+};
+
+static BTree<int, Watch *> watches;
+static DevInoTable<Watch> inodes;
+
+static Watch *find_watch(dev_t dev, ino_t ino)
+{
+    return inodes.find(dev, ino);
+}
+
+static void add_watch(int wd, dev_t dev, ino_t ino)
+{
+    Watch *w = new Watch;
+    w->wd = wd;
+    w->dev = dev;
+    w->ino = ino;
+    inodes.insert(dev, ino, w);
+    watches.insert(wd, w);
+}
+
+static void forget_watch(Watch *w)
+{
+    inodes.remove(w->dev, w->ino);
+    watches.remove(w->wd);
+    delete w;
+}
+
+int IMon::imon_open()
+{
+    int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd == -1) {
+	Log::critical("can't initialize inotify: %m");
+    }
+    return fd;
+}
+
+IMon::Status IMon::imon_express(const char *name, struct stat *status)
+{
+    struct stat before, st;
+    if (status == NULL) {
+	status = &st;
+    }
+    if (lstat(name, &before) == -1) {
+	Log::info("lstat on \"%s\" failed: %m", name);
+	return BAD;
+    }
+
+    int wd = inotify_add_watch(imonfd, name, INTEREST_MASK);
+    if (wd < 0)
+    {
+        if (name[0] == '/') {
+            Log::info("inotify_add_watch on \"%s\" failed (uid: %i): %m",
+                      name, Cred::current_uid());
+        } else {
+            char * cwd = getcwd(0, 256);
+            Log::info("inotify_add_watch on \"%s\" with cwd \"%s\" failed (uid: %i): %m",
+                      name,cwd,Cred::current_uid());
+            free(cwd);
+        }
+	return BAD;
+    }
+
+    //
+    // Check for a race condition; if someone removed or replaced the
+    // file while we were adding the watch, we can't tell which inode
+    // the watch is on.  Drop the watch unless another Interest is
+    // using it.
+    //
+    Watch *w = watches.find(wd);
+    if (lstat(name, status) == -1
+	|| status->st_dev != before.st_dev
+	|| status->st_ino != before.st_ino) {
+	Log::error("File \"%s\" changed between stat and inotify_add_watch",
+		   name);
+	if (!w) {
+	    (void) inotify_rm_watch(imonfd, wd);
+	}
+	return BAD;
+    }
+
+    if (w && (w->dev != status->st_dev || w->ino != status->st_ino)) {
+	//  The watch descriptor outlived its inode; its IN_IGNORED
+	//  event hasn't been read yet.
+	forget_watch(w);
+	w = NULL;
+    }
+    if (!w) {
+	add_watch(wd, status->st_dev, status->st_ino);
+    }
+
+    Log::debug("told inotify to monitor \"%s\" = dev %d/%d, ino %d (wd %d)",
+	       name, major(status->st_dev), minor(status->st_dev),
+	       status->st_ino, wd);
+    return OK;
+}
+
+IMon::Status IMon::imon_revoke(const char *name, dev_t dev, ino_t ino)
+{
+    Watch *w = find_watch(dev, ino);
+    if (!w) {
+	//  The kernel already dropped the watch (the file was deleted).
+	Log::debug("no inotify watch to revoke for \"%s\"", name);
+	return BAD;
+    }
+    int rc = inotify_rm_watch(imonfd, w->wd);
+    forget_watch(w);
+    if (rc < 0) {
+	Log::perror("inotify_rm_watch on \"%s\" failed", name);
+	return BAD;
+    }
+    Log::debug("told inotify to forget \"%s\"", name);
+    return OK;
+}
+
+//  imon_read queues as many events as fit in one large read.
+
+bool IMon::imon_read(int fd)
+{
+    static union {
+	inotify_event event;
+	char bytes[64 * 1024];
+    } readbuf;
+
+    int rc = read(fd, &readbuf, sizeof readbuf);
+    if (rc < 0)
+    {   if (errno != EAGAIN && errno != EINTR)
+	    Log::perror("inotify read");
+	return false;
+    }
+
+    for (char *p = readbuf.bytes; p < readbuf.bytes + rc; )
+    {   inotify_event *ev = (inotify_event *) p;
+	p += sizeof *ev + ev->len;
+
+	if (ev->mask & IN_Q_OVERFLOW)
+	{   Log::error("inotify event queue overflow");
+	    queue_overflow();
+	    continue;
+	}
+	Watch *w = watches.find(ev->wd);
+	if (!w)
+	    continue;
+	if (ev->mask & IN_IGNORED)
+	{   forget_watch(w);
+	    continue;
+	}
+	if (ev->len && !(ev->mask & NAME_EVENTS))
+	    continue;
+
+	dev_t dev = w->dev;
+	ino_t ino = w->ino;
+	unsigned int what = ev->mask;
+	Log::debug("inotify said dev %d/%d, ino %ld changed%s%s%s%s%s%s",
+		   major(dev), minor(dev), ino,
+		   what & IN_MODIFY      ? " MODIFY"  : "",
+		   what & IN_ATTRIB      ? " ATTRIB"  : "",
+		   what & (IN_CREATE | IN_MOVED_TO)	? " CREATE" : "",
+		   what & (IN_DELETE | IN_MOVED_FROM)	? " DELETE" : "",
+		   what & IN_DELETE_SELF ? " DELETE_SELF" : "",
+		   what & IN_MOVE_SELF   ? " MOVE_SELF"   : "");
+	queue_event(dev, ino, CHANGE);
+    }
+    return true;
+}
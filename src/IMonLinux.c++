@@ -29,6 +29,7 @@
 #include <sys/types.h>
 #include <sys/wait.h>
 
+#include <assert.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <stdio.h>
@@ -36,6 +37,8 @@
 #include <string.h>
 #include <unistd.h>
 
+#include "Cred.h"
+
 
 #define DEV_IMON "/dev/imon"
 const intmask_t INTEREST_MASK = (IMON_CONTENT | IMON_ATTRIBUTE | IMON_DELETE |
@@ -122,12 +125,12 @@ IMon::Status IMon::imon_express(const char *name, struct stat *status)
     if (rc < 0)
     {
         if (name[0] == '/') {
-            Log::info("IMONIOC_EXPRESS on \"%s\" failed (euid: %i): %m",
-                      name, geteuid());
+            Log::info("IMONIOC_EXPRESS on \"%s\" failed (uid: %i): %m",
+                      name, Cred::current_uid());
         } else {
             char * cwd = getcwd(0, 256);
-            Log::info("IMONIOC_EXPRESS on \"%s\" with cwd \"%s\" failed (euid: %i): %m",
-                      name,cwd,geteuid());
+            Log::info("IMONIOC_EXPRESS on \"%s\" with cwd \"%s\" failed (uid: %i): %m",
+                      name,cwd,Cred::current_uid());
             free(cwd);
         }
 	return BAD;
@@ -174,3 +177,55 @@ IMon::Status IMon::imon_revoke(const char *name, dev_t dev, ino_t ino)
     Log::debug("told imon to forget \"%s\"", name);
     return OK;
 }
+
+bool IMon::imon_read(int fd)
+{
+    static qelem_t readbuf[1024];
+    int rc = read(fd, readbuf, sizeof readbuf);
+    if (rc < 0)
+    {   if (errno != EAGAIN && errno != EINTR)
+	    Log::perror("/dev/imon read");
+	return false;
+    }
+    else
+    {   assert(rc % sizeof (qelem_t) == 0);
+	rc /= sizeof (qelem_t);
+	for (int i = 0; i < rc; i++)
+	    if (readbuf[i].qe_what == IMON_OVER)
+	    {   Log::error("imon event queue overflow");
+		queue_overflow();
+	    }
+	    else
+	    {	dev_t dev = readbuf[i].qe_dev;
+		ino_t ino = readbuf[i].qe_inode;
+		intmask_t what = readbuf[i].qe_what;
+		Log::debug("imon said dev %d/%d, ino %ld changed%s%s%s%s%s%s",
+			   major(dev), minor(dev), ino,
+			   what & IMON_CONTENT   ? " CONTENT"   : "",
+			   what & IMON_ATTRIBUTE ? " ATTRIBUTE" : "",
+			   what & IMON_DELETE    ? " DELETE"    : "",
+			   what & IMON_EXEC      ? " EXEC"      : "",
+			   what & IMON_EXIT      ? " EXIT"      : "",
+#ifdef IMON_RENAME
+			   what & IMON_RENAME    ? " RENAME"    : "",
+#endif
+			   ""
+		    );
+		if (what & IMON_EXEC)
+		    queue_event(dev, ino, EXEC);
+		if (what & IMON_EXIT)
+		    queue_event(dev, ino, EXIT);
+		if (what & (IMON_CONTENT | IMON_ATTRIBUTE |
+			    IMON_DELETE
+#ifdef IMON_RENAME
+			    | IMON_RENAME
+#endif
+		    ))
+		    queue_event(dev, ino, CHANGE);
+	    }
+
+	//  A short read means the queue is empty.
+
+	return rc == sizeof readbuf / sizeof (qelem_t);
+    }
+}
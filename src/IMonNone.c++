@@ -23,6 +23,8 @@
 #include "IMon.h"
 #include "Log.h"
 
+#include <assert.h>
+
 int IMon::imon_open()
 {
     Log::info("built with IMonNone, so /dev/imon won't be opened.");
@@ -38,3 +40,13 @@ IMon::Status IMon::imon_revoke(const char *, dev_t, ino_t)
 {
     return BAD;
 }
+
+bool IMon::imon_read(int)
+{
+    //  imon_open() never succeeds, so there's nothing to read.
+    Log::critical("imon event received by fam built without imon support... "
+                  "tell fam@oss.sgi.com to fix this!");
+    int i_dont_have_IMON = 0;
+    assert(i_dont_have_IMON);
+    return false;
+}
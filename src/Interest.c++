@@ -26,7 +26,10 @@
 #include <sys/sysmacros.h>
 
 #include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #ifdef HAVE_IRIX_XTAB_VERIFICATION
 #include <stdio.h>
@@ -44,124 +47,281 @@
 #include "IMon.h"
 #include "Log.h"
 #include "Pollster.h"
+#include "Stats.h"
 #include "timeval.h"
 
-Interest *Interest::hashtable[];
+DevInoTable<Interest::Watch> Interest::watches;
+unsigned long Interest::epochs;
+unsigned long Interest::stat_epoch;
+unsigned  Interest::fanouts;
+const Interest *Interest::prefetched_for;
+const struct stat *Interest::prefetched;
+int       Interest::prefetched_error;
 IMon      Interest::imon(imon_handler);
 bool      Interest::xtab_verification = true;
-
-Interest::Interest(const char *name, FileSystem *fs, in_addr host, ExportVerification ev)
-    : hashlink(NULL),
+Interest::Rescan *Interest::rescans;
+unsigned  Interest::nrescans;
+unsigned  Interest::next_rescan;
+Scheduler::TaskID Interest::rescan_taskid;
+
+static Stats::Counter overflow_rescans("overflow rescans");
+static Stats::Counter watches_shared("watches shared");
+static Stats::Counter stats_reused("stats reused");
+
+Interest::Interest(const char *name, FileSystem *fs, in_addr host,
+		   ExportVerification ev, int dirfd, const char *dirname,
+		   bool watched)
+    : watchlink(NULL),
+      watchprev(NULL),
+      watch(NULL),
+      seen(0),
       myname(strcpy(new char[strlen(name) + 1], name)),
       scan_state(OK),
       cur_exec_state(NOT_EXECUTING),
       old_exec_state(NOT_EXECUTING),
       myhost(host),
-      mypath_exported_to_host(ev == NO_VERIFY_EXPORTED)
+      mypath_exported_to_host(ev == NO_VERIFY_EXPORTED),
+      is_watched(watched),
+      last_change(0),
+      stat_job(NULL),
+      riding(false),
+      poll_slot(0)
 {
-    memset(&old_stat, 0, sizeof(old_stat)); 
-    IMon::Status s = IMon::BAD;
-
-    s = imon.express(name, &old_stat);
-    if (s != IMon::OK)
-    {   int rc = lstat(name, &old_stat);
-	if (rc < 0)
-	{   Log::info("can't lstat %s", name);
-	    memset(&old_stat, 0, sizeof old_stat);
-	}
+    struct stat status;
+    FileSystem::LatencyTimer timer;
+    int rc = stat_file(dirfd, name, &status, fs->stats_may_be_cached());
+    timer.stop(fs);
+    if (rc < 0)
+    {   Log::info("can't lstat %s", name);
+	memset(&status, 0, sizeof status);
     }
 
-    dev = old_stat.st_dev;
-    ino = old_stat.st_ino;
+    dev = status.st_dev;
+    ino = status.st_ino;
 
     if (ev == VERIFY_EXPORTED) verify_exported_to_host();
 
-    if (s == IMon::OK) {
-        
-        if ((exported_to_host()) && (dev || ino))
-        {
-            // Insert on new chain.
-            
-            Interest **ipp = hashchain();
-            hashlink = *ipp;
-            *ipp = this;
-        }
-        else revoke();
-    }
-    
-    
+    bool expressed = false;
+    if (exported_to_host() && (dev || ino))
+	expressed = subscribe(status, dirname);
+
 #if HAVE_STAT_ST_FSTYPE_STRING
     //  Enable low-level monitoring.
     //  The NetWare filesystem is too slow to monitor, so
     //  don't even try.
 
-    if ( !strcmp( (char *) &old_stat.st_fstype, "nwfs")) {
+    if ( !strcmp( (char *) &status.st_fstype, "nwfs")) {
         return;
     }
 #endif
 
-    if (exported_to_host()) fs->ll_monitor(this, s == IMon::OK);
+    if (exported_to_host() && is_watched) fs->ll_monitor(this, expressed);
 }
 
 Interest::~Interest()
 {
+    if (stat_job)
+	StatPool::cancel(stat_job);
     Pollster::forget(this);
-    revoke();
+    unsubscribe();
     delete[] myname;
 }
 
-void
-Interest::revoke()
+//  subscribe adds this to the Watch for its dev/ino, creating the
+//  Watch and expressing interest to imon if nobody else has.  status
+//  is a fresh lstat of the file.  imon wants a path, so a name in a
+//  directory is joined onto dirname.  Returns true if imon is
+//  watching the file.
+
+bool
+Interest::subscribe(const struct stat& status, const char *dirname)
 {
-    //  Traverse our hash chain.  Delete this entry when we find it.
-    //  Also check for other entries with same dev/ino.
+    assert(!watch);
+    Watch *w = watches.find(dev, ino);
+    if (w)
+	watches_shared++;
+    else
+    {   w = new Watch;
+	w->dev = dev;
+	w->ino = ino;
+	w->first = NULL;
+	w->expressed = false;
+	w->stat = status;
+	w->generation = 0;
+	w->epoch = 0;
+	w->statter = NULL;
+	w->pooler = NULL;
+	watches.insert(dev, ino, w);
+    }
 
-    if (dev || ino)
-    {
-	bool found_same = false;
-	for (Interest *p, **pp = hashchain(); ((p = *pp) != NULL); )
-	    if (p == this)
-		*pp = p->hashlink;	// remove this from list
-	    else
-	    {   if (p->ino == ino && p->dev == dev)
-		    found_same = true;
-		pp = &p->hashlink;	// move to next element
-	    }
-	if (!found_same)
-	    (void) imon.revoke(name(), dev, ino);
+    watchlink = w->first;
+    if (watchlink)
+	watchlink->watchprev = &watchlink;
+    watchprev = &w->first;
+    w->first = this;
+    watch = w;
+
+    //  If the file was replaced since status was taken, imon is
+    //  watching the wrong inode; let polling catch up with it.
+
+    struct stat st = status;
+    char path[MAXPATHLEN];
+    const char *imon_name = name();
+    if (dirname)
+    {   (void) snprintf(path, sizeof path, "%s/%s", dirname, name());
+	imon_name = path;
+    }
+    if (!w->expressed && watched()
+	&& imon.express(imon_name, &st) == IMon::OK)
+    {   if (st.st_dev == dev && st.st_ino == ino)
+	    w->expressed = true;
+	else
+	{   Watch *other = watches.find(st.st_dev, st.st_ino);
+	    if (!other || !other->expressed)
+		(void) imon.revoke(name(), st.st_dev, st.st_ino);
+	    st = status;
+	}
+    }
+    update_stat(st);
+    seen = w->generation;
+    return w->expressed;
+}
+
+//  unsubscribe takes this off its Watch.  The last one off revokes
+//  imon's interest and deletes the Watch.
+
+void
+Interest::unsubscribe()
+{
+    Watch *w = watch;
+    if (!w)
+	return;
+
+    *watchprev = watchlink;
+    if (watchlink)
+	watchlink->watchprev = watchprev;
+    watchlink = NULL;
+    watchprev = NULL;
+    watch = NULL;
+    if (w->statter == this)
+	w->statter = NULL;
+    if (w->pooler == this)
+	w->pooler = NULL;
+    riding = false;
+
+    if (!w->first)
+    {   if (w->expressed)
+	    (void) imon.revoke(name(), w->dev, w->ino);
+	watches.remove(w->dev, w->ino);
+	delete w;
     }
 }
 
 bool
-Interest::dev_ino(dev_t newdev, ino_t newino)
+Interest::dev_ino(dev_t newdev, ino_t newino, const struct stat& status)
 {
-    // Remove from hash chain and revoke imon's interest.
+    // Leave the old Watch and join the new one.
 
-    revoke();
+    unsubscribe();
 
     dev = newdev;
     ino = newino;
 
-    if (newdev || newino)
-    {
+    if ((newdev || newino) && exported_to_host())
+	return !subscribe(status, dir_name());
+    return false;
+}
 
-        // Express interest.
-        IMon::Status s = IMon::BAD;
-	s = imon.express(name(), NULL);
-        if (s != IMon::OK) {
-            return true;
-        }
-        
-	// Insert on new chain.
+//  update_stat stores a new stat of this Interest's file in its Watch,
+//  and starts a new generation if anything about the file changed.
 
-	Interest **ipp = hashchain();
-	hashlink = *ipp;
-	*ipp = this;
-    }
-    else {
-	hashlink = NULL;
+void
+Interest::update_stat(const struct stat& status)
+{
+    struct stat& old_stat = watch->stat;
+#ifdef HAVE_STRUCT_STAT_ST_CTIM_TV_NSEC
+    bool stat_changed = (old_stat.st_ctim.tv_sec != status.st_ctim.tv_sec) ||
+                        (old_stat.st_ctim.tv_nsec != status.st_ctim.tv_nsec) ||
+                        (old_stat.st_mtim.tv_sec != status.st_mtim.tv_sec) ||
+                        (old_stat.st_mtim.tv_nsec != status.st_mtim.tv_nsec) ||
+#else
+    bool stat_changed = (old_stat.st_ctime != status.st_ctime) ||
+                        (old_stat.st_mtime != status.st_mtime) ||
+#endif
+                        (old_stat.st_mode != status.st_mode) ||
+                        (old_stat.st_uid != status.st_uid) ||
+                        (old_stat.st_gid != status.st_gid) ||
+                        (old_stat.st_size != status.st_size);
+    old_stat = status;
+    if (stat_changed)
+	watch->generation++;
+}
+
+//  stat_file lstats name relative to dirfd.  With statx(2), it asks
+//  only for the fields we compare, so filesystems that fetch
+//  attributes on demand, like NFS and overlayfs, can skip the rest;
+//  the other fields of the result are zero.  If cached_ok, attributes
+//  the kernel has cached are used without asking the server.
+
+#if HAVE_STATX
+const unsigned Interest::statx_mask = (STATX_TYPE | STATX_MODE | STATX_INO |
+				       STATX_UID | STATX_GID | STATX_SIZE |
+				       STATX_MTIME | STATX_CTIME);
+#endif
+
+int
+Interest::stat_file(int dirfd, const char *name, struct stat *sp,
+		    bool cached_ok)
+{
+#if HAVE_STATX
+    static bool have_statx = true;
+    if (have_statx)
+    {   int flags = AT_SYMLINK_NOFOLLOW;
+	flags |= cached_ok ? AT_STATX_DONT_SYNC : AT_STATX_SYNC_AS_STAT;
+	struct statx stx;
+	if (statx(dirfd, name, flags, statx_mask, &stx) == 0)
+	{   stat_from_statx(sp, stx);
+	    return 0;
+	}
+	if (errno != ENOSYS)
+	    return -1;
+	Log::debug("statx not supported; using lstat");
+	have_statx = false;
     }
-    return false;
+#endif
+    return fstatat(dirfd, name, sp, AT_SYMLINK_NOFOLLOW);
+}
+
+#if HAVE_STATX
+
+void
+Interest::stat_from_statx(struct stat *sp, const struct statx& stx)
+{
+    memset(sp, 0, sizeof *sp);
+    sp->st_dev = makedev(stx.stx_dev_major, stx.stx_dev_minor);
+    sp->st_ino = stx.stx_ino;
+    sp->st_mode = stx.stx_mode;
+    sp->st_uid = stx.stx_uid;
+    sp->st_gid = stx.stx_gid;
+    sp->st_size = stx.stx_size;
+    sp->st_mtim.tv_sec = stx.stx_mtime.tv_sec;
+    sp->st_mtim.tv_nsec = stx.stx_mtime.tv_nsec;
+    sp->st_ctim.tv_sec = stx.stx_ctime.tv_sec;
+    sp->st_ctim.tv_nsec = stx.stx_ctime.tv_nsec;
+}
+
+#endif
+
+//  same_view is true if that would get the same lstat result as this:
+//  the same user looking up the same name from the same directory.
+
+bool
+Interest::same_view(const Interest *that) const
+{
+    const char *dir = dir_name(), *thatdir = that->dir_name();
+    return cred() == that->cred()
+	&& !strcmp(name(), that->name())
+	&& (dir == thatdir || (dir && thatdir && !strcmp(dir, thatdir)));
 }
 
 /* Returns true if file changed since last stat */
@@ -171,39 +331,75 @@ Interest::do_stat()
     // Consider the case of a Directory changing into a file to be a
     // simple change, and send only a Changed event.
 
+    if (!exported_to_host())
+	return false;
+
+    //  During a fan-out, use the stat another Interest on our Watch
+    //  just took, if it would have gotten the same answer we would.
+
     struct stat status;
-    
-    int rc = lstat(name(), &status);
-    if (rc < 0) {
-	if (errno == ETIMEDOUT) {
+    Watch *w = watch;
+    if (prefetched_for == this)
+    {   prefetched_for = NULL;
+	if (prefetched)
+	    status = *prefetched;
+	else if (prefetched_error == ETIMEDOUT)
 	    return false;
+	else
+	    memset(&status, 0, sizeof status);
+    }
+    else if (w && stat_epoch && w->epoch == stat_epoch
+	  && w->statter && w->statter->same_view(this))
+    {   status = w->stat;
+	stats_reused++;
+    }
+    else
+    {   //  This lstat is newer than any the StatPool has for us.
+
+	if (stat_job)
+	{   StatPool::cancel(stat_job);
+	    stat_job = NULL;
+	    if (w && w->pooler == this)
+		w->pooler = NULL;
+	}
+	FileSystem::LatencyTimer timer;
+	int rc = stat_file(dir_fd(), name(), &status,
+			   filesystem()->stats_may_be_cached());
+	timer.stop(filesystem());
+	if (rc < 0) {
+	    if (errno == ETIMEDOUT) {
+		return false;
+	    }
+	    memset(&status, 0, sizeof status);
 	}
-        memset(&status, 0, sizeof status);
     }
 
     bool exists = status.st_mode != 0;
-    bool did_exist = old_stat.st_mode != 0;
-#ifdef HAVE_STAT_ST_CTIM_TV_NSEC
-    bool stat_changed = (old_stat.st_ctim.tv_sec != status.st_ctim.tv_sec) ||
-                        (old_stat.st_ctim.tv_nsec != status.st_ctim.tv_nsec) ||
-                        (old_stat.st_mtim.tv_sec != status.st_mtim.tv_sec) ||
-                        (old_stat.st_mtim.tv_nsec != status.st_mtim.tv_nsec) ||
-#else
-    bool stat_changed = (old_stat.st_ctime != status.st_ctime) ||
-                        (old_stat.st_mtime != status.st_mtime) ||
-#endif
-                        (old_stat.st_mode != status.st_mode) ||
-                        (old_stat.st_uid != status.st_uid) ||
-                        (old_stat.st_gid != status.st_gid) ||
-                        (old_stat.st_size != status.st_size) ||
-                        (old_stat.st_ino != status.st_ino);
-    old_stat = status;
+    bool did_exist = this->exists();
+    bool stat_changed;
 
-    //  If dev/ino changed, move this interest to the right hash chain.
+    //  If dev/ino changed, move this interest to the right Watch.
 
     bool keep_polling = false;
     if (status.st_dev != dev || status.st_ino != ino) {
-        keep_polling = dev_ino(status.st_dev, status.st_ino);
+        keep_polling = dev_ino(status.st_dev, status.st_ino, status);
+	stat_changed = true;
+    }
+    else if (w) {
+	update_stat(status);
+	stat_changed = seen != w->generation;
+    }
+    else
+	stat_changed = false;
+
+    if (stat_changed || exists != did_exist)
+	Pollster::changed(this);
+
+    if (watch) {
+	seen = watch->generation;
+	watch->epoch = stat_epoch;
+	if (watch->statter != this && stat_epoch)
+	    watch->statter = this;
     }
 
     if (exists && !did_exist)
@@ -237,6 +433,110 @@ Interest::do_scan()
     return stat_changed;
 }
 
+//  poll scans the Interest.  If the StatPool is on, the lstat is
+//  done there.  Returns false if the pool is full, so we have to be
+//  polled again later.
+
+bool
+Interest::poll()
+{
+    if (StatPool::enabled())
+	return stat_in_pool();
+    scan();
+    return true;
+}
+
+//  stat_in_pool submits our lstat to the StatPool.  When it's done,
+//  stat_done scans us with the result.  Returns false if the pool
+//  is off or full, so the caller can scan inline instead.
+
+bool
+Interest::stat_in_pool()
+{
+    if (stat_job)
+	return true;			// already on its way
+    if (!exported_to_host() || !active())
+	return true;			// nothing to stat
+
+    char path[MAXPATHLEN];
+    const char *dir = dir_name();
+    if (dir)
+    {   if (snprintf(path, sizeof path, "%s/%s", dir, name())
+	    >= (int) sizeof path)
+	    return false;
+    }
+    else if (strlen(name()) >= sizeof path)
+	return false;
+    else
+	(void) strcpy(path, name());
+
+    //  If someone on our Watch is already having the same lstat done,
+    //  wait for theirs.
+
+    Watch *w = watch;
+    if (w && w->pooler && w->pooler->same_view(this))
+    {   riding = true;
+	stats_reused++;
+	return true;
+    }
+
+    FileSystem *fs = filesystem();
+    stat_job = StatPool::submit(cred(), path, fs->stats_may_be_cached(),
+				fs->stat_group(), stat_done, this);
+    if (!stat_job)
+	return false;
+    riding = false;
+    if (w)
+	w->pooler = this;
+    return true;
+}
+
+//  scan_prefetched scans the Interest with an lstat someone else has
+//  already done: status, or NULL and error if the lstat failed.
+
+void
+Interest::scan_prefetched(const struct stat *status, int error)
+{
+    prefetched_for = this;
+    prefetched = status;
+    prefetched_error = error;
+    scan();
+    prefetched_for = NULL;
+}
+
+//  stat_done scans the Interest whose lstat the StatPool just did,
+//  then everyone who was riding on it, all in one fan-out.
+
+void
+Interest::stat_done(const struct stat *status, int error,
+		    unsigned long usecs, void *closure)
+{
+    Interest *ip = (Interest *) closure;
+    ip->stat_job = NULL;
+    ip->filesystem()->record_latency(usecs);
+
+    Watch *w = ip->watch;
+    bool riders = false;
+    if (w && w->pooler == ip)
+    {   w->pooler = NULL;
+	for (Interest *p = w->first; p; p = p->watchlink)
+	    if (p->riding)
+		riders = true;
+    }
+
+    begin_fanout();
+    ip->scan_prefetched(status, error);
+    if (riders)
+	for (Interest *p = w->first, *next = p; p; p = next)
+	{   next = p->watchlink;
+	    if (p->riding)
+	    {   p->riding = false;
+		p->scan();
+	    }
+	}
+    end_fanout();
+}
+
 void
 Interest::report_exec_state()
 {
@@ -250,25 +550,124 @@ Interest::report_exec_state()
 void
 Interest::imon_handler(dev_t device, ino_t inumber, int event)
 {
+    if (event == IMon::OVERFLOW)
+    {   imon_overflow();
+	return;
+    }
     assert(device || inumber);
+    time_t now = event == IMon::CHANGE ? time(NULL) : 0;
 
-    for (Interest *p = *hashchain(device, inumber), *next = p; p; p = next)
-    {	next = p->hashlink;
-	if (p->ino == inumber && p->dev == device)
-	{   if (event == IMon::EXEC)
-	    {   p->cur_exec_state = EXECUTING;
-		(void) p->report_exec_state();
-	    }
-	    else if (event == IMon::EXIT)
-	    {   p->cur_exec_state = NOT_EXECUTING;
-		(void) p->report_exec_state();
-	    }
-	    else
-	    {   assert(event == IMon::CHANGE);
-		p->scan();
-	    }
+    Watch *w = watches.find(device, inumber);
+    if (!w)
+	return;
+
+    //  Everyone on the Watch is scanned in one fan-out, so they can
+    //  share a single lstat.
+
+    begin_fanout();
+    for (Interest *p = w->first, *next = p; p; p = next)
+    {	next = p->watchlink;
+	if (event == IMon::EXEC)
+	{   p->cur_exec_state = EXECUTING;
+	    (void) p->report_exec_state();
+	}
+	else if (event == IMon::EXIT)
+	{   p->cur_exec_state = NOT_EXECUTING;
+	    (void) p->report_exec_state();
+	}
+	else
+	{   assert(event == IMon::CHANGE);
+	    p->last_change = now;
+	    p->scan();
 	}
     }
+    end_fanout();
+}
+
+//  imon_overflow replaces the rescan queue with every Watch imon is
+//  watching.  The rest are polled, or nobody wants them scanned yet,
+//  so an overflow lost nothing of theirs.  If an earlier overflow's
+//  rescan is still under way, its queue is out of date anyway.
+
+void
+Interest::imon_overflow()
+{
+    delete [] rescans;
+    rescans = new Rescan[watches.size()];
+    nrescans = 0;
+    next_rescan = 0;
+    for (unsigned i = 0; i < watches.nslots(); i++)
+    {   Watch *w = watches.slot(i);
+	if (!w || !w->expressed)
+	    continue;
+	Rescan *rp = &rescans[nrescans++];
+	rp->dev = w->dev;
+	rp->ino = w->ino;
+	rp->last_change = 0;
+	for (Interest *p = w->first; p; p = p->watchlink)
+	    if (p->last_change > rp->last_change)
+		rp->last_change = p->last_change;
+	rp->isdir = S_ISDIR(w->stat.st_mode);
+    }
+    qsort(rescans, nrescans, sizeof *rescans, rescan_order);
+    Log::info("imon overflow: rescanning %u inodes", nrescans);
+
+    if (!rescan_taskid)
+    {   timeval now;
+	(void) gettimeofday(&now, NULL);
+	rescan_taskid = Scheduler::install_onetime_task(now, rescan_task, NULL);
+    }
+}
+
+//  rescan_order sorts most recently changed first, then directories
+//  first, then by dev/ino.
+
+int
+Interest::rescan_order(const void *a, const void *b)
+{
+    const Rescan *ra = (const Rescan *) a, *rb = (const Rescan *) b;
+    if (ra->last_change != rb->last_change)
+	return ra->last_change > rb->last_change ? -1 : 1;
+    if (ra->isdir != rb->isdir)
+	return ra->isdir ? -1 : 1;
+    if (ra->dev != rb->dev)
+	return ra->dev < rb->dev ? -1 : 1;
+    if (ra->ino != rb->ino)
+	return ra->ino < rb->ino ? -1 : 1;
+    return 0;
+}
+
+void
+Interest::rescan_task(void *)
+{
+    rescan_taskid = 0;
+    for (unsigned n = 0; n < RESCAN_SLICE && next_rescan < nrescans; n++)
+    {   Rescan *rp = &rescans[next_rescan++];
+	Watch *w = watches.find(rp->dev, rp->ino);
+	if (!w)
+	    continue;
+	overflow_rescans++;
+	begin_fanout();
+	for (Interest *p = w->first, *next = p; p; p = next)
+	{   next = p->watchlink;
+	    p->scan();
+	}
+	end_fanout();
+    }
+
+    if (next_rescan < nrescans)
+    {   static const timeval delay = { 0, RESCAN_DELAY_USEC };
+	timeval t;
+	(void) gettimeofday(&t, NULL);
+	t += delay;
+	rescan_taskid = Scheduler::install_onetime_task(t, rescan_task, NULL);
+    }
+    else
+    {   Log::debug("overflow rescan done");
+	delete [] rescans;
+	rescans = NULL;
+	nrescans = next_rescan = 0;
+    }
 }
 
 void
@@ -23,24 +23,54 @@
 #ifndef Interest_included
 #define Interest_included
 
+#include <fcntl.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/time.h>
 #include <netinet/in.h>  //  for in_addr
 
 #include "Boolean.h"
+#include "DevInoTable.h"
+#include "Scheduler.h"
+#include "StatPool.h"
 
+class Cred;
 class Event;
 class FileSystem;
 class IMon;
 struct stat;
+struct statx;
 
 //  Interest -- abstract base class for filesystem entities of interest.
 //
 //  An Interest is monitored by imon or, if imon fails, it is polled
 //  by the Pollster.
 //
-//  All Interests are kept in a global table keyed by dev/ino.
+//  Interests on the same inode share a Watch, which holds imon's
+//  interest in the inode and the last lstat of it.  The first
+//  Interest on an inode expresses interest to imon and the last one
+//  off revokes it.  Each Interest remembers which generation of the
+//  Watch's stat it last reported, so a change seen by one Interest
+//  is reported by all of them.  When imon reports a change, or the
+//  Pollster polls, the Interests on a Watch are scanned in one
+//  fan-out, and they reuse each other's lstat instead of repeating
+//  it, as long as they'd have looked up the same name as the same
+//  user.
+//
+//  All Watches are kept in a global DevInoTable, so finding the
+//  Watch for an inode doesn't depend on how many there are.
+//
+//  When the StatPool is on, polls go through it: the lstat is done on
+//  a worker thread, and the Interest is scanned with the result when
+//  it comes back, so a hung filesystem doesn't hold up the rest.
+//  Interests on a Watch ride along on one lstat in the pool the same
+//  way they'd share one in a fan-out.
+//
+//  If imon's event queue overflows, every Watch imon is watching is
+//  queued for a rescan; polled ones will be looked at anyway.  The
+//  rescan queue is worked through a slice at a time, so a big tree
+//  doesn't stall every client.  Interests imon reported changes in
+//  most recently go first, and directories go before files.
 //
 //  The classes derived from Interest are...
 //
@@ -55,13 +85,16 @@ public:
 
     enum ExportVerification { VERIFY_EXPORTED, NO_VERIFY_EXPORTED };
 
-    Interest(const char *name, FileSystem *, in_addr host, ExportVerification);
+    Interest(const char *name, FileSystem *, in_addr host, ExportVerification,
+	     int dirfd = AT_FDCWD, const char *dirname = NULL,
+	     bool watched = true);
     virtual ~Interest();
 
     const char *name() const		{ return myname; }
-    bool exists() const		{ return old_stat.st_mode != 0; }
-    bool isdir() const    { return (old_stat.st_mode & S_IFMT) == S_IFDIR; }
+    bool exists() const		{ return watch != NULL; }
+    bool isdir() const    { return watch && S_ISDIR(watch->stat.st_mode); }
     virtual bool active() const = 0;
+    virtual FileSystem *filesystem() const = 0;
     bool needs_scan() const		{ return scan_state != OK; }
     void needs_scan(bool tf)		{ scan_state = tf ? NEEDS_SCAN : OK; }
     void mark_for_scan()		{ needs_scan(true); }
@@ -70,17 +103,29 @@ public:
 
     virtual bool scan(Interest * = 0) = 0;
     virtual void unscan(Interest * = 0) = 0;
-    void poll()				{ scan(); }
+    bool poll();
+    bool stat_in_pool();
+    void scan_prefetched(const struct stat *, int error);
 
     //  Public Class Method
 
     static void imon_handler(dev_t, ino_t, int event);
+    static void begin_fanout()	{ if (!fanouts++) stat_epoch = ++epochs; }
+    static void end_fanout()	{ if (!--fanouts) stat_epoch = 0; }
 
     static void enable_xtab_verification(bool enable);
+    static int stat_file(int dirfd, const char *name, struct stat *,
+			 bool cached_ok);
+    static void stat_from_statx(struct stat *, const struct statx&);
+    static const unsigned statx_mask;	// the fields we compare
 
 protected:
 
     bool do_stat();
+    const struct stat *last_stat() const { return watch ? &watch->stat : NULL; }
+    virtual const Cred& cred() const = 0;
+    virtual const char *dir_name() const { return NULL; }
+    virtual int dir_fd() const		{ return AT_FDCWD; }
     virtual void post_event(const Event&, const char * = NULL) = 0;
     char& ci_bits()			{ return ci_char; }
     char& dir_bits()			{ return dir_char; }
@@ -89,16 +134,34 @@ protected:
     const in_addr& host() const         { return myhost; }
     void verify_exported_to_host();
     bool exported_to_host() const       { return mypath_exported_to_host; }
+    bool watched() const		{ return is_watched; }
 
 private:
 
-    enum { HASHSIZE = 257 };
+    enum { RESCAN_SLICE = 64, RESCAN_DELAY_USEC = 20000 };
     enum ScanState	{ OK, NEEDS_SCAN };
     enum ExecState	{ EXECUTING, NOT_EXECUTING };
 
     //  Instance Variables
 
-    Interest *hashlink;
+    //  A Watch is empty when no Interest is on it.
+
+    struct Watch {
+	dev_t dev;
+	ino_t ino;
+	Interest *first;
+	bool expressed;			// imon is watching this inode
+	struct stat stat;
+	unsigned generation;		// bumped when stat changes
+	unsigned long epoch;		// fan-out stat was taken in
+	const Interest *statter;	// who took it
+	Interest *pooler;		// whose StatPool lstat we all wait on
+    };
+
+    Interest *watchlink;		// next Interest on our Watch
+    Interest **watchprev;		// what points at us
+    Watch *watch;			// NULL if file doesn't exist
+    unsigned seen;			// generation last reported
     dev_t dev;
     ino_t ino;
     char *const myname;
@@ -107,29 +170,69 @@ private:
     ExecState old_exec_state: 1;
     char ci_char;
     char dir_char;
-    struct stat old_stat;
     in_addr myhost;
     bool mypath_exported_to_host;
-    
+    const bool is_watched;		// by imon or the Pollster
+    time_t last_change;		// when imon last reported a change
+    StatPool::Job *stat_job;		// our lstat in the StatPool
+    bool riding;			// waiting on the Watch's pooler
+    unsigned poll_slot;			// where the Pollster keeps us, or 0
 
     //  Private Instance Methods
 
-    bool dev_ino(dev_t, ino_t);
-    void revoke();
+    bool dev_ino(dev_t, ino_t, const struct stat&);
+    bool subscribe(const struct stat&, const char *dirname);
+    void unsubscribe();
+    void update_stat(const struct stat&);
+    bool same_view(const Interest *) const;
     virtual void notify_created(Interest *) = 0;
     virtual void notify_deleted(Interest *) = 0;
 
     //  Class Variables
 
     static IMon imon;
-    static Interest *hashtable[HASHSIZE];
     static bool xtab_verification;
 
-    //  The Hashing Function
+    //  The dev/ino table of Watches.
+
+    static DevInoTable<Watch> watches;
+
+    //  Fan-outs are numbered; stat_epoch is the current one's number,
+    //  or zero outside of one.
+
+    static unsigned long epochs;
+    static unsigned long stat_epoch;
+    static unsigned fanouts;
+
+    //  A StatPool result is handed to do_stat through these.
+
+    static const Interest *prefetched_for;
+    static const struct stat *prefetched;
+    static int prefetched_error;
+
+    //  The overflow rescan queue.
+
+    struct Rescan {
+	dev_t dev;
+	ino_t ino;
+	time_t last_change;
+	bool isdir;
+    };
+
+    static Rescan *rescans;
+    static unsigned nrescans;
+    static unsigned next_rescan;
+    static Scheduler::TaskID rescan_taskid;
+
+    //  Private Class Methods
+
+    static void imon_overflow();
+    static int rescan_order(const void *, const void *);
+    static void rescan_task(void *);
+    static void stat_done(const struct stat *, int error,
+			  unsigned long usecs, void *closure);
 
-    static Interest **hashchain(dev_t d, ino_t i)
-			  { return &hashtable[(unsigned) (d + i) % HASHSIZE]; }
-    Interest **hashchain() const	{ return hashchain(dev, ino); }
+friend class Pollster;
 
     Interest(const Interest&);		// Do not copy
     Interest & operator = (const Interest&);	//  or assign.
@@ -20,6 +20,7 @@
 //  with this program; if not, write the Free Software Foundation, Inc., 59
 //  Temple Place - Suite 330, Boston MA 02111-1307, USA.
 
+#include "config.h"
 #include "Listener.h"
 
 #include <assert.h>
@@ -31,6 +32,9 @@
 #include <rpc/pmap_clnt.h>
 #include <rpc/clnt.h>
 #include <sys/ioctl.h>
+#if HAVE_SETFSUID
+#include <sys/fsuid.h>
+#endif
 #include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/un.h>
@@ -54,6 +58,7 @@ struct NegotiatingClient
     int sock;
     uid_t uid;
     struct sockaddr_un sun;
+    Scheduler::TaskID cleanup_task;
 };
 
 BTree<int, NegotiatingClient *> negotiating_clients;
@@ -66,7 +71,9 @@ Listener::Listener(bool sbi, bool lo, unsigned long p, unsigned long v)
   rendezvous_fd(-1),
   started_by_inetd(sbi),
   _ugly_sock(-1),
-  local_only(lo)
+  local_only(lo),
+  local_fd(-1),
+  local_path(NULL)
 {
     if (started_by_inetd)
     {
@@ -128,6 +135,12 @@ Listener::~Listener()
     {   (void) close(_ugly_sock);
 	(void) unlink("/tmp/.fam_socket");
     }
+    if (local_fd >= 0)
+    {   (void) Scheduler::remove_read_handler(local_fd);
+	(void) close(local_fd);
+	(void) unlink(local_path);
+    }
+    delete [] local_path;
 }
 
 void
@@ -194,6 +207,115 @@ Listener::accept_client(int rendezvous_fd, void *closure)
     }
 }
 
+//////////////////////////////////////////////////////////////////////////////
+//  The well-known local socket
+
+void
+Listener::listen_local(const char *path)
+{
+#ifdef SO_PEERCRED
+#ifdef HAVE_SOCKADDR_SUN_LEN
+    sockaddr_un sun = { sizeof(sockaddr_un), AF_UNIX, "" };
+#else
+    sockaddr_un sun = { AF_UNIX, "" };
+#endif
+    if (strlen(path) >= sizeof sun.sun_path)
+    {   Log::error("local socket name %s is too long", path);
+	return;
+    }
+    strcpy(sun.sun_path, path);
+
+    int sock = socket(PF_UNIX, SOCK_STREAM, 0);
+    if (sock < 0)
+    {   Log::perror("local socket(PF_UNIX, SOCK_STREAM, 0)");
+	return;
+    }
+
+    //  If something answers on the socket, another fam has it.
+    //  Otherwise it's left over from a fam that died.
+
+    if (connect(sock, (sockaddr *) &sun, sizeof sun) == 0)
+    {   Log::info("another fam is listening on %s", path);
+	close(sock);
+	return;
+    }
+    (void) unlink(path);
+
+    Cred::SuperUser.become_user();
+    mode_t oldmask = umask(0);
+    int rc = bind(sock, (sockaddr *) &sun, sizeof sun);
+    (void) umask(oldmask);
+    if (rc != 0)
+    {   Log::perror("can't bind local socket %s", path);
+	close(sock);
+	return;
+    }
+    if (chmod(path, 0666) != 0 || listen(sock, SOMAXCONN) != 0)
+    {   Log::perror("can't listen on local socket %s", path);
+	close(sock);
+	(void) unlink(path);
+	return;
+    }
+    (void) fcntl(sock, F_SETFD, FD_CLOEXEC);
+
+    local_fd = sock;
+    local_path = strcpy(new char[strlen(path) + 1], path);
+    (void) Scheduler::install_read_handler(local_fd, accept_local, this);
+    Log::debug("listening for local clients on descriptor %d (%s)",
+	       local_fd, local_path);
+#else
+    Log::info("can't authenticate clients on %s; not listening there", path);
+#endif /* !SO_PEERCRED */
+}
+
+void
+Listener::accept_local(int fd, void *)
+{
+#ifdef SO_PEERCRED
+    int client_fd = accept(fd, NULL, NULL);
+    if (client_fd < 0)
+    {   Log::perror("failed to accept new local client");
+	return;
+    }
+
+    struct ucred uc;
+    socklen_t uclen = sizeof uc;
+    if (getsockopt(client_fd, SOL_SOCKET, SO_PEERCRED, &uc, &uclen) != 0)
+    {   Log::perror("can't get credentials of local client fd %d", client_fd);
+	close(client_fd);
+	return;
+    }
+
+    //  Use the peer's own groups if the kernel says what they are.
+    //  Otherwise look up the uid's groups.
+
+    Cred cred;
+#ifdef SO_PEERGROUPS
+    int maxgroups = sysconf(_SC_NGROUPS_MAX);
+    gid_t *groups = new gid_t[maxgroups + 1];
+    socklen_t glen = maxgroups * sizeof *groups;
+    groups[0] = uc.gid;
+    if (getsockopt(client_fd, SOL_SOCKET, SO_PEERGROUPS,
+		   groups + 1, &glen) == 0)
+	cred = Cred(uc.uid, 1 + glen / sizeof *groups, groups, client_fd);
+    else
+	cred = Cred(uc.uid, client_fd);
+    delete [] groups;
+#else
+    cred = Cred(uc.uid, client_fd);
+#endif
+
+    Log::debug("client fd %d is local/trusted (pid %d, uid %d)",
+	       client_fd, uc.pid, uc.uid);
+    new LocalClient(client_fd, NULL, cred);
+    // We don't need a reference to this object.  The constructor
+    // takes care of registering it with the Scheduler.
+#endif /* SO_PEERCRED */
+}
+
+//////////////////////////////////////////////////////////////////////////////
+//  Private sockets negotiated over TCP
+
 void
 Listener::create_local_client(TCP_Client &inet_client, uid_t uid)
 {
@@ -260,7 +382,8 @@ Listener::create_local_client(TCP_Client &inet_client, uid_t uid)
     timeval nto;
     gettimeofday(&nto, NULL);
     nto.tv_sec += 60;  //  XXX that should be configurable
-    Scheduler::install_onetime_task(nto, cleanup_negotiation, nc);
+    nc->cleanup_task =
+	Scheduler::install_onetime_task(nto, cleanup_negotiation, nc);
 
     if (listen(client_sock, 1) != 0)
     {   Log::perror("localclient listen");
@@ -297,7 +420,7 @@ Listener::accept_localclient(int ofd, void *)
     }
 
     //  Keep the scheduler from helpfully cleaning this up.
-    Scheduler::remove_onetime_task(cleanup_negotiation, nc);
+    Scheduler::remove_onetime_task(nc->cleanup_task);
 
     Log::debug("client fd %d is local/trusted (socket %s, uid %d).",
                client_fd, nc->sun.sun_path, nc->uid);
@@ -463,7 +586,7 @@ Listener::read_ugly_hack(int sock, void *closure)
 }
 
 NegotiatingClient::NegotiatingClient(int fd, uid_t u, struct sockaddr_un *sunp)
-    : sock(fd), uid(u)
+    : sock(fd), uid(u), cleanup_task(0)
 {
     sun.sun_family = AF_UNIX;
     strcpy(sun.sun_path, sunp->sun_path);
@@ -485,12 +608,18 @@ cleanup_negotiation(void *closure)
     nc->sock = -1;
 
     //  Remove the temp file
+#if HAVE_SETFSUID
+    uid_t prevfsuid = setfsuid(nc->uid);
+    unlink(nc->sun.sun_path);
+    (void) setfsuid(prevfsuid);
+#else
     uid_t preveuid = geteuid();
     if (preveuid) seteuid(0);
     seteuid(nc->uid);
     unlink(nc->sun.sun_path);
     if (nc->uid) seteuid(0);
     seteuid(preveuid);
+#endif
 
     delete nc;
 }
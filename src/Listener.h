@@ -33,6 +33,14 @@
 //  If a Listener was started_by_inetd, then it listens on the
 //  already-open file descriptor 0.  Otherwise, it opens a new socket.
 //
+//  A Listener can also listen on a UNIX domain socket with a well-
+//  known name (listen_local()).  A local client connects there
+//  directly, without asking portmapper where fam is or negotiating a
+//  private socket over TCP.  The socket is open to everyone; each
+//  client's uid and groups are those of the process that connected,
+//  from SO_PEERCRED (and SO_PEERGROUPS, if the kernel has it).  If
+//  another fam is already listening on the socket, it's left alone.
+//
 //  A Listener creates TCP_Client and RemoteClient objects as
 //  connections come in.
 //
@@ -54,6 +62,8 @@ public:
 	     unsigned long program = FAMPROG, unsigned long version = FAMVERS);
     ~Listener();
 
+    void listen_local(const char *path);
+
     static void create_local_client(TCP_Client &inet_client, uid_t uid);
 
 private:
@@ -66,6 +76,8 @@ private:
     bool started_by_inetd;
     int _ugly_sock;
     bool local_only;
+    int local_fd;
+    char *local_path;
 
     //  Private Instance Methods
 
@@ -78,6 +90,7 @@ private:
     static void accept_ugly_hack(int fd, void *closure);
     static void read_ugly_hack(int fd, void *closure);
     static void accept_localclient(int fd, void *closure);
+    static void accept_local(int fd, void *closure);
 };
 
 #endif /* !Listener_included */
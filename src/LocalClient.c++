@@ -34,12 +34,16 @@ LocalClient::LocalClient(int fd, const struct sockaddr_un *addr, Cred &cred)
 {
     assert(cred.is_valid());
     sun.sun_family = AF_UNIX;
-    strncpy(sun.sun_path, addr->sun_path, sizeof(sun.sun_path));
+    sun.sun_path[0] = '\0';
+    if (addr)
+	strncpy(sun.sun_path, addr->sun_path, sizeof(sun.sun_path));
     sun.sun_path[sizeof(sun.sun_path) - 1] = '\0';
 }
 
 LocalClient::~LocalClient()
 {
-    if (geteuid() != cred.uid()) cred.become_user();
+    if (!sun.sun_path[0])
+	return;
+    cred.become_user();
     unlink(sun.sun_path);
 }
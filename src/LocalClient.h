@@ -27,7 +27,9 @@
 #include <sys/un.h>
 
 //  LocalClient is a client that has connected from the local machine
-//  on a UNIX domain socket with mode 600.
+//  on a UNIX domain socket, either one with mode 600 made for it, which
+//  is removed when the client goes away, or the well-known one (addr
+//  is NULL).
 
 class LocalClient : public TCP_Client {
 
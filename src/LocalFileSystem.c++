@@ -37,6 +37,24 @@ LocalFileSystem::dir_entries_scanned() const
     return true;
 }
 
+bool
+LocalFileSystem::stats_may_be_cached() const
+{
+    return false;
+}
+
+bool
+LocalFileSystem::stats_may_hang() const
+{
+    return false;
+}
+
+bool
+LocalFileSystem::dir_mtime_reliable() const
+{
+    return true;
+}
+
 int
 LocalFileSystem::get_attr_cache_timeout() const
 {
@@ -80,8 +98,12 @@ LocalFileSystem::ll_monitor(Interest *ip, bool imonitored)
 {
     if (!imonitored)
     {
+	if (kernel_only())
+	{   Log::debug("won't poll %s on kernel-only %s", ip->name(), dir());
+	    return;
+	}
 	Log::debug("will poll %s", ip->name());
-	Pollster::watch(ip);
+	Pollster::watch(ip, polling_interval());
     }
 }
 
@@ -95,5 +117,6 @@ LocalFileSystem::ll_notify_created(Interest *ip)
 void
 LocalFileSystem::ll_notify_deleted(Interest *ip)
 {
-    Pollster::watch(ip);
+    if (!kernel_only())
+	Pollster::watch(ip, polling_interval());
 }
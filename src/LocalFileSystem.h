@@ -29,7 +29,7 @@
 //
 //  LocalFileSystem has a null implementation of the high level
 //  interface.  Its low level interface puts nonexistent files 
-//  on the list to be polled.
+//  on the list to be polled, unless its Policy is kernel_only.
 //
 //  Note that a LocalFileSystem may represent a weird file system
 //  like a DOS floppy or and ISO-9660 CD-ROM.  Don't assume efs/xfs/ext2...
@@ -41,6 +41,9 @@ public:
     LocalFileSystem(const mntent&);
 
     virtual bool dir_entries_scanned() const;
+    virtual bool stats_may_be_cached() const;
+    virtual bool stats_may_hang() const;
+    virtual bool dir_mtime_reliable() const;
     virtual int get_attr_cache_timeout() const;
 
     // High level monitoring interface
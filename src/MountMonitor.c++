@@ -0,0 +1,423 @@
+//  Copyright (C) 1999 Silicon Graphics, Inc.  All Rights Reserved.
+//  
+//  This program is free software; you can redistribute it and/or modify it
+//  under the terms of version 2 of the GNU General Public License as
+//  published by the Free Software Foundation.
+//
+//  This program is distributed in the hope that it would be useful, but
+//  WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  Further, any
+//  license provided herein, whether implied or otherwise, is limited to
+//  this program in accordance with the express provisions of the GNU
+//  General Public License.  Patent licenses, if any, provided herein do not
+//  apply to combinations of this program with other product or programs, or
+//  any other product whatsoever.  This program is distributed without any
+//  warranty that the program is delivered free of the rightful claim of any
+//  third person by way of infringement or the like.  See the GNU General
+//  Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License along
+//  with this program; if not, write the Free Software Foundation, Inc., 59
+//  Temple Place - Suite 330, Boston MA 02111-1307, USA.
+
+#include "MountMonitor.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/sysmacros.h>
+
+#if HAVE_SYS_FANOTIFY_H
+#include <sys/fanotify.h>
+#include <sys/vfs.h>
+#endif
+
+#include "Cred.h"
+#include "Log.h"
+#include "Scheduler.h"
+#include "Stats.h"
+
+#if defined(FAN_MARK_FILESYSTEM) && defined(FAN_REPORT_DFID_NAME)
+#define MOUNT_MONITOR 1
+
+const unsigned long long MARK_MASK = (FAN_MODIFY | FAN_ATTRIB |
+				      FAN_CREATE | FAN_DELETE |
+				      FAN_MOVED_FROM | FAN_MOVED_TO |
+				      FAN_DELETE_SELF | FAN_MOVE_SELF |
+				      FAN_ONDIR);
+const unsigned long long DIRENT_EVENTS = (FAN_CREATE | FAN_DELETE |
+					  FAN_MOVED_FROM | FAN_MOVED_TO);
+#endif
+
+//  A Mount counts the inodes IMon watches on one device.
+
+struct MountMonitor::Mount {
+    enum State { UNMARKED, PENDING, MARKED, FAILED };
+    dev_t dev;
+    unsigned count;
+    State state;
+    int pathfd;			// a file on the mount, while PENDING
+    int fsid[2];
+    Mount *next;
+};
+
+//  A Handle is a file expressed on a marked filesystem.  It is on
+//  two hash chains, one by file handle and one by dev/ino.
+
+struct MountMonitor::Handle {
+    dev_t dev;
+    ino_t ino;
+    int fsid[2];
+    int type;
+    unsigned len;
+    unsigned char *bytes;
+    unsigned hash;
+    Handle *hashlink;
+    Handle *inolink;
+};
+
+unsigned		  MountMonitor::mark_threshold;
+int			  MountMonitor::fanfd = -2;
+MountMonitor::Mount	 *MountMonitor::mounts;
+MountMonitor::Handle	**MountMonitor::handle_table;
+MountMonitor::Handle	**MountMonitor::inode_table;
+unsigned		  MountMonitor::table_size;
+unsigned		  MountMonitor::nhandles;
+
+static unsigned nmarked;
+static Stats::Counter overflows("fanotify overflows");
+
+static unsigned
+hash_bytes(int type, const unsigned char *bytes, unsigned len)
+{
+    unsigned h = 2166136261u ^ type;
+    for (unsigned i = 0; i < len; i++)
+	h = (h ^ bytes[i]) * 16777619u;
+    return h;
+}
+
+static inline unsigned
+hash_inode(dev_t dev, ino_t ino)
+{
+    return (unsigned) (dev + ino);
+}
+
+MountMonitor::Mount *
+MountMonitor::find_mount(dev_t dev)
+{
+    for (Mount *mp = mounts; mp; mp = mp->next)
+	if (mp->dev == dev)
+	    return mp;
+    return NULL;
+}
+
+bool
+MountMonitor::express(const char *name, struct stat *status)
+{
+#if MOUNT_MONITOR
+    if (!nmarked)
+	return false;
+
+    struct stat before, st;
+    if (status == NULL)
+	status = &st;
+    if (lstat(name, &before) < 0)
+	return false;
+    Mount *mp = find_mount(before.st_dev);
+    if (!mp || mp->state != Mount::MARKED)
+	return false;
+
+    union {
+	file_handle fh;
+	char bytes[sizeof (file_handle) + MAX_HANDLE_SZ];
+    } handle;
+    int mount_id;
+    handle.fh.handle_bytes = MAX_HANDLE_SZ;
+    if (name_to_handle_at(AT_FDCWD, name, &handle.fh, &mount_id, 0) < 0)
+    {   Log::debug("name_to_handle_at on \"%s\" failed: %m", name);
+	return false;
+    }
+
+    //  As in IMon, make sure the file wasn't replaced while we got
+    //  its handle.
+
+    if (lstat(name, status) < 0
+	|| status->st_dev != before.st_dev
+	|| status->st_ino != before.st_ino)
+    {   Log::error("File \"%s\" changed between stat and name_to_handle_at",
+		   name);
+	return false;
+    }
+
+    for (Handle *hp = inode_table ? inode_table[hash_inode(status->st_dev,
+							   status->st_ino)
+						% table_size]
+				  : NULL;
+	 hp; hp = hp->inolink)
+	if (hp->dev == status->st_dev && hp->ino == status->st_ino)
+	    return true;		// another name for the same file
+
+    Handle *hp = new Handle;
+    hp->dev = status->st_dev;
+    hp->ino = status->st_ino;
+    memcpy(hp->fsid, mp->fsid, sizeof hp->fsid);
+    hp->type = handle.fh.handle_type;
+    hp->len = handle.fh.handle_bytes;
+    hp->bytes = new unsigned char[hp->len];
+    memcpy(hp->bytes, handle.fh.f_handle, hp->len);
+    add_handle(hp);
+    Log::debug("fanotify monitoring \"%s\" = dev %d/%d, ino %d", name,
+	       major(hp->dev), minor(hp->dev), hp->ino);
+    return true;
+#else
+    return false;
+#endif
+}
+
+void
+MountMonitor::expressed(const char *name, dev_t dev)
+{
+    if (!mark_threshold)
+	return;
+    Mount *mp = find_mount(dev);
+    if (!mp)
+    {   mp = new Mount;
+	mp->dev = dev;
+	mp->count = 0;
+	mp->state = Mount::UNMARKED;
+	mp->next = mounts;
+	mounts = mp;
+    }
+    mp->count++;
+    if (mp->state == Mount::UNMARKED && mp->count >= mark_threshold)
+    {
+#if MOUNT_MONITOR
+	mp->pathfd = open(name, O_PATH | O_NOFOLLOW | O_CLOEXEC);
+	if (mp->pathfd < 0)
+	{   Log::perror("can't open \"%s\"", name);
+	    return;			// try again with the next file
+	}
+	mp->state = Mount::PENDING;
+	timeval now;
+	(void) gettimeofday(&now, NULL);
+	(void) Scheduler::install_onetime_task(now, mark_task, mp);
+#else
+	Log::info("built without fanotify, so filesystem dev %d/%d "
+		  "won't be marked", major(mp->dev), minor(mp->dev));
+	mp->state = Mount::FAILED;
+#endif
+    }
+}
+
+bool
+MountMonitor::revoke(dev_t dev, ino_t ino)
+{
+    if (!mark_threshold)
+	return false;
+    if (nhandles)
+    {   for (Handle *hp = inode_table[hash_inode(dev, ino) % table_size];
+	     hp; hp = hp->inolink)
+	    if (hp->dev == dev && hp->ino == ino)
+	    {   remove_handle(hp);
+		return true;
+	    }
+    }
+    Mount *mp = find_mount(dev);
+    if (mp && mp->count)
+	mp->count--;
+    return false;
+}
+
+void
+MountMonitor::mark_task(void *closure)
+{
+#if MOUNT_MONITOR
+    Mount *mp = (Mount *) closure;
+    assert(mp->state == Mount::PENDING);
+    mp->state = Mount::FAILED;
+
+    Cred::SuperUser.become_user();
+    if (fanfd == -2)
+    {   fanfd = fanotify_init(FAN_CLASS_NOTIF | FAN_CLOEXEC | FAN_NONBLOCK |
+			      FAN_REPORT_FID | FAN_REPORT_DFID_NAME,
+			      O_RDONLY | O_LARGEFILE);
+	if (fanfd < 0)
+	    Log::error("can't initialize fanotify: %m");
+	else
+	    (void) Scheduler::install_read_handler(fanfd, read_handler, NULL);
+    }
+    //  fanotify_mark() won't take an O_PATH descriptor as dirfd, but
+    //  it will follow the descriptor's /proc link.
+
+    char path[40];
+    snprintf(path, sizeof path, "/proc/self/fd/%d", mp->pathfd);
+    struct statfs fs;
+    if (fanfd >= 0)
+    {   if (fstatfs(mp->pathfd, &fs) < 0)
+	    Log::perror("fstatfs on dev %d/%d failed",
+			major(mp->dev), minor(mp->dev));
+	else if (fanotify_mark(fanfd, FAN_MARK_ADD | FAN_MARK_FILESYSTEM,
+			       MARK_MASK, AT_FDCWD, path) < 0)
+	    Log::error("can't fanotify mark filesystem dev %d/%d: %m",
+		       major(mp->dev), minor(mp->dev));
+	else
+	{   memcpy(mp->fsid, &fs.f_fsid, sizeof mp->fsid);
+	    mp->state = Mount::MARKED;
+	    nmarked++;
+	    Log::info("watching filesystem dev %d/%d with fanotify "
+		      "(%u files were watched)",
+		      major(mp->dev), minor(mp->dev), mp->count);
+	}
+    }
+    (void) close(mp->pathfd);
+    mp->pathfd = -1;
+#endif
+}
+
+MountMonitor::Handle *
+MountMonitor::find_handle(const void *fsid, int type,
+			  const unsigned char *bytes, unsigned len)
+{
+    if (!nhandles)
+	return NULL;
+    unsigned hash = hash_bytes(type, bytes, len);
+    for (Handle *hp = handle_table[hash % table_size]; hp; hp = hp->hashlink)
+	if (hp->hash == hash && hp->type == type && hp->len == len
+	    && !memcmp(hp->bytes, bytes, len)
+	    && !memcmp(hp->fsid, fsid, sizeof hp->fsid))
+	    return hp;
+    return NULL;
+}
+
+void
+MountMonitor::add_handle(Handle *hp)
+{
+    if (nhandles >= table_size)
+	grow_tables();
+    hp->hash = hash_bytes(hp->type, hp->bytes, hp->len);
+    Handle **hpp = &handle_table[hp->hash % table_size];
+    hp->hashlink = *hpp;
+    *hpp = hp;
+    hpp = &inode_table[hash_inode(hp->dev, hp->ino) % table_size];
+    hp->inolink = *hpp;
+    *hpp = hp;
+    nhandles++;
+}
+
+void
+MountMonitor::remove_handle(Handle *hp)
+{
+    Handle **hpp;
+    for (hpp = &handle_table[hp->hash % table_size];
+	 *hpp != hp;
+	 hpp = &(*hpp)->hashlink)
+	continue;
+    *hpp = hp->hashlink;
+    for (hpp = &inode_table[hash_inode(hp->dev, hp->ino) % table_size];
+	 *hpp != hp;
+	 hpp = &(*hpp)->inolink)
+	continue;
+    *hpp = hp->inolink;
+    nhandles--;
+    delete [] hp->bytes;
+    delete hp;
+}
+
+//  grow_tables doubles the hash tables, so chains stay short no
+//  matter how many files are watched.
+
+void
+MountMonitor::grow_tables()
+{
+    unsigned oldsize = table_size;
+    Handle **oldhandles = handle_table, **oldinodes = inode_table;
+    table_size = oldsize ? oldsize * 2 + 1 : 257;
+    handle_table = new Handle *[table_size];
+    inode_table = new Handle *[table_size];
+    memset(handle_table, 0, table_size * sizeof *handle_table);
+    memset(inode_table, 0, table_size * sizeof *inode_table);
+    for (unsigned i = 0; i < oldsize; i++)
+	for (Handle *hp = oldhandles[i], *next; hp; hp = next)
+	{   next = hp->hashlink;
+	    Handle **hpp = &handle_table[hp->hash % table_size];
+	    hp->hashlink = *hpp;
+	    *hpp = hp;
+	    hpp = &inode_table[hash_inode(hp->dev, hp->ino) % table_size];
+	    hp->inolink = *hpp;
+	    *hpp = hp;
+	}
+    delete [] oldhandles;
+    delete [] oldinodes;
+}
+
+//  read_handler drains a batch of fanotify events.  Each event has
+//  a file handle for the object, and, for directory entry events, a
+//  file handle for the directory.  Either may belong to an expressed
+//  file.
+
+void
+MountMonitor::read_handler(int fd, void *)
+{
+#if MOUNT_MONITOR
+    static union {
+	fanotify_event_metadata md;
+	char bytes[64 * 1024];
+    } readbuf;
+
+    int rc = read(fd, &readbuf, sizeof readbuf);
+    if (rc < 0)
+    {   if (errno != EAGAIN && errno != EINTR)
+	    Log::perror("fanotify read");
+	return;
+    }
+
+    for (fanotify_event_metadata *md = &readbuf.md;
+	 FAN_EVENT_OK(md, rc);
+	 md = FAN_EVENT_NEXT(md, rc))
+    {
+	if (md->vers != FANOTIFY_METADATA_VERSION)
+	{   Log::critical("fanotify metadata version %d, expected %d",
+			  md->vers, FANOTIFY_METADATA_VERSION);
+	    return;
+	}
+	if (md->fd >= 0)
+	    (void) close(md->fd);
+	if (md->mask & FAN_Q_OVERFLOW)
+	{   Log::error("fanotify event queue overflow");
+	    overflows++;
+	    IMon::queue_overflow();
+	    continue;
+	}
+
+	char *p = (char *) md + md->metadata_len;
+	char *end = (char *) md + md->event_len;
+	while (p + sizeof (fanotify_event_info_header) <= end)
+	{   fanotify_event_info_header *hdr = (fanotify_event_info_header *) p;
+	    if (hdr->len == 0)
+		break;
+	    p += hdr->len;
+	    if (hdr->info_type == FAN_EVENT_INFO_TYPE_DFID_NAME
+		? !(md->mask & DIRENT_EVENTS)
+		: hdr->info_type != FAN_EVENT_INFO_TYPE_FID)
+		continue;
+
+	    fanotify_event_info_fid *fid = (fanotify_event_info_fid *) hdr;
+	    file_handle *fh = (file_handle *) fid->handle;
+	    Handle *hp = find_handle(&fid->fsid, fh->handle_type,
+				     fh->f_handle, fh->handle_bytes);
+	    if (hp)
+	    {   dev_t dev = hp->dev;
+		ino_t ino = hp->ino;
+		Log::debug("fanotify said dev %d/%d, ino %ld changed "
+			   "(mask 0x%llx)", major(dev), minor(dev), ino,
+			   (unsigned long long) md->mask);
+		IMon::queue_event(dev, ino, IMon::CHANGE);
+	    }
+	}
+    }
+    IMon::flush();
+#endif
+}
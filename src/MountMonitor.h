@@ -0,0 +1,106 @@
+//  Copyright (C) 1999 Silicon Graphics, Inc.  All Rights Reserved.
+//  
+//  This program is free software; you can redistribute it and/or modify it
+//  under the terms of version 2 of the GNU General Public License as
+//  published by the Free Software Foundation.
+//
+//  This program is distributed in the hope that it would be useful, but
+//  WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  Further, any
+//  license provided herein, whether implied or otherwise, is limited to
+//  this program in accordance with the express provisions of the GNU
+//  General Public License.  Patent licenses, if any, provided herein do not
+//  apply to combinations of this program with other product or programs, or
+//  any other product whatsoever.  This program is distributed without any
+//  warranty that the program is delivered free of the rightful claim of any
+//  third person by way of infringement or the like.  See the GNU General
+//  Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License along
+//  with this program; if not, write the Free Software Foundation, Inc., 59
+//  Temple Place - Suite 330, Boston MA 02111-1307, USA.
+
+#ifndef MountMonitor_included
+#define MountMonitor_included
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "Boolean.h"
+#include "IMon.h"
+
+//  MountMonitor watches whole filesystems with fanotify(7), so that
+//  the kernel memory used for monitoring doesn't grow with the number
+//  of files being monitored.  It sits alongside IMon: IMon counts the
+//  inodes it is watching on each device, and once a filesystem passes
+//  the threshold, IMon asks MountMonitor to mark it.  After that,
+//  files expressed on that filesystem are remembered here by file
+//  handle instead of being passed to IMon's backend.  Watches made
+//  before the filesystem was marked are left alone.
+//
+//  fanotify events name the changed file (and for directory entry
+//  events, the directory) by file handle.  MountMonitor maps the
+//  handles of expressed files back to dev/ino and queues CHANGE events
+//  in IMon's batch, so they're deduped and delivered just like IMon's
+//  own.  Events on files nobody expressed are dropped.
+//
+//  Whole-filesystem marks need CAP_SYS_ADMIN and Linux 5.9 or later
+//  (FAN_MARK_FILESYSTEM with FAN_REPORT_DFID_NAME).  Mount marks
+//  can't report directory entry events, so they aren't used.  If a
+//  filesystem can't be marked, IMon keeps using its backend there.
+//  Marking is done from a onetime task, as root, rather than in the
+//  middle of a scan running as some client's user.
+//
+//  The threshold is zero (disabled) unless it is set from fam.conf.
+//
+//  MountMonitor is not instantiated; its interface is static.
+
+class MountMonitor {
+
+public:
+
+    static void threshold(unsigned n)		{ mark_threshold = n; }
+    static unsigned threshold()			{ return mark_threshold; }
+
+    //  express() returns true if name is on a marked filesystem and
+    //  is now being watched here.  Otherwise, the caller should use
+    //  its backend, and call expressed() if that succeeds.
+
+    static bool express(const char *name, struct stat *status);
+    static void expressed(const char *name, dev_t dev);
+
+    //  revoke() returns true if dev/ino was being watched here.
+
+    static bool revoke(dev_t dev, ino_t ino);
+
+private:
+
+    struct Mount;
+    struct Handle;
+
+    //  Class Variables
+
+    static unsigned mark_threshold;
+    static int fanfd;
+    static Mount *mounts;
+    static Handle **handle_table;	// hashed by file handle
+    static Handle **inode_table;	// hashed by dev/ino
+    static unsigned table_size;
+    static unsigned nhandles;
+
+    //  Private Class Methods
+
+    static Mount *find_mount(dev_t dev);
+    static void mark_task(void *closure);
+    static Handle *find_handle(const void *fsid, int type,
+			       const unsigned char *bytes, unsigned len);
+    static void add_handle(Handle *);
+    static void remove_handle(Handle *);
+    static void grow_tables();
+    static void read_handler(int fd, void *closure);
+
+    MountMonitor();			// Do not instantiate.
+
+};
+
+#endif /* !MountMonitor_included */
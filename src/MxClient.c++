@@ -57,6 +57,16 @@ MxClient::interest(Request r)
     return ip;
 }
 
+//  request_name returns the path a request monitors, or NULL if
+//  there's no such request.
+
+const char *
+MxClient::request_name(Request r) const
+{
+    ClientInterest *ip = requests.find(r);
+    return ip ? ip->name() : NULL;
+}
+
 bool
 MxClient::check_new(Request request, const char *path)
 {
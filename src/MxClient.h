@@ -51,6 +51,7 @@ protected:
     void cancel(Request);
     void suspend(Request);
     void resume(Request);
+    const char *request_name(Request) const;
 
 private:
 
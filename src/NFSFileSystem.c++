@@ -41,6 +41,8 @@
 #define ACREGMIN 3
 #endif
 
+bool NFSFileSystem::use_cached_stats = false;
+
 NFSFileSystem::NFSFileSystem(const mntent& mnt)
     : FileSystem(mnt)
 {
@@ -175,6 +177,34 @@ NFSFileSystem::dir_entries_scanned() const
     return !host->is_connected();
 }
 
+//  When we poll, the client's attribute cache is good enough; asking
+//  the server on every poll just loads it down.
+
+bool
+NFSFileSystem::stats_may_be_cached() const
+{
+    return use_cached_stats && !host->is_connected();
+}
+
+//  An NFS server can stop answering, and an lstat on it waits until
+//  it comes back.
+
+bool
+NFSFileSystem::stats_may_hang() const
+{
+    return true;
+}
+
+//  The client's attribute cache can hold a directory's mtime steady
+//  while the server's copy changes, so NFS directories are always
+//  reread.
+
+bool
+NFSFileSystem::dir_mtime_reliable() const
+{
+    return false;
+}
+
 
 int
 NFSFileSystem::get_attr_cache_timeout() const
@@ -43,6 +43,9 @@ public:
     ~NFSFileSystem();
 
     virtual bool dir_entries_scanned() const;
+    virtual bool stats_may_be_cached() const;
+    virtual bool stats_may_hang() const;
+    virtual bool dir_mtime_reliable() const;
     virtual int get_attr_cache_timeout() const;
 
     // High level monitoring interface
@@ -60,8 +63,12 @@ public:
     virtual void ll_notify_created(Interest *);
     virtual void ll_notify_deleted(Interest *);
 
+    static void cached_stats(bool tf)	{ use_cached_stats = tf; }
+
 private:
 
+    static bool use_cached_stats;
+
     ServerHostRef host;
     char *remote_dir;
     unsigned remote_dir_len;
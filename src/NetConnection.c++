@@ -24,31 +24,52 @@
 
 #include <assert.h>
 #include <errno.h>
+#include <poll.h>
 #include <stdarg.h>
 #include <stddef.h>
 #include <stdio.h>
 #include <string.h>
 #include <sys/ioctl.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <unistd.h>
 #include <netinet/in.h>
 
 #include "Log.h"
+#include "Record.h"
 #include "Scheduler.h"
+#include "Stats.h"
+
+#ifndef POLLRDHUP
+#define POLLRDHUP 0			// Linux only; MSG_PEEK still sees EOF
+#endif
+
+NetConnection::Chunk *NetConnection::free_chunks;
+unsigned NetConnection::nfree_chunks;
+
+static Stats::Counter messages_sent("messages sent");
+static Stats::Counter output_writes("output writes");
+static Stats::Counter short_writes("short output writes");
 
 NetConnection::NetConnection(int a_fd,
 			     UnblockHandler uhandler, void *uclosure)
-    : fd(a_fd),
+    : ohead(NULL),
+      otail(NULL),
+      obytes(0),
+      flush_taskid(0),
+      filling(false),
+      fd(a_fd),
       iready(true), oready(true),
+      records(false),
       iend(ibuf + sizeof(ibuf)),
       itail(ibuf),
       unblock_handler(uhandler), closure(uclosure)
 {
-    // It must be the case that Length is a 32 bit int.
+    // It must be the case that Length is a 32 bit int, and any
+    // message must fit in a chunk.
     assert (sizeof(Length) == 4);
-    
-    omsgList = omsgListTail = NULL;
-    
+    assert (CHUNKSIZE >= MAXMSGSIZE + 5);
+
     // Enable nonblocking output on socket.
 
     int yes = 1;
@@ -78,6 +99,7 @@ NetConnection::NetConnection(int a_fd,
 NetConnection::~NetConnection()
 {
     shutdown(false);
+    discard_output();
 }
 
 void
@@ -95,6 +117,10 @@ NetConnection::shutdown(bool call_input)
 	{   oldh = Scheduler::remove_write_handler(fd);
 	    assert(oldh == write_handler);
 	}
+	fill();
+	if (obytes)
+	    (void) drain();
+	discard_output();
 	(void) close(fd);
 	fd = -1;
 	oready = true;
@@ -150,8 +176,32 @@ NetConnection::deliver_input()
     // Find messages and process them.
 
     char *ihead = ibuf;
-    while (iready && oready && ihead + sizeof (Length) <= itail)
+    while (iready && oready && ihead < itail)
     {
+	//  A Record's header says how long it is.
+
+	if (records && Record::is_record(ihead))
+	{   if (ihead + Record::HEADERSIZE > itail)
+		break;
+	    unsigned len = Record::size(ihead);
+	    if (len > MAXMSGSIZE)
+	    {   Log::error("fd %d record length %d bytes exceeds max of %d.",
+			   fd, len, MAXMSGSIZE);
+		shutdown();
+		return;
+	    }
+	    if (ihead + len > itail)
+		break;
+	    if (input_record(Record(ihead)) == false)
+	    {   shutdown();
+		return;
+	    }
+	    ihead += len;
+	    continue;
+	}
+
+	if (ihead + sizeof (Length) > itail)
+	    break;
         Length len;
         memcpy(&len, ihead, sizeof(Length));
 	len = ntohl(len);
@@ -187,6 +237,13 @@ NetConnection::deliver_input()
     assert(itail < iend);
 }
 
+bool
+NetConnection::input_record(const Record&)
+{
+    Log::error("fd %d got a record it can't use", fd);
+    return false;
+}
+
 bool
 NetConnection::ready_for_output() const
 {
@@ -199,6 +256,28 @@ NetConnection::ready_for_input(bool tf)
     set_handlers(tf, oready);
 }
 
+//  hung_up says whether the other end has closed the connection,
+//  without reading anything.
+
+bool
+NetConnection::hung_up() const
+{
+    if (fd < 0)
+	return true;
+    pollfd pfd;
+    pfd.fd = fd;
+    pfd.events = POLLIN | POLLRDHUP;
+    pfd.revents = 0;
+    if (poll(&pfd, 1, 0) <= 0)
+	return false;
+    bool gone = pfd.revents & (POLLHUP | POLLERR | POLLRDHUP);
+    if (!gone && pfd.revents & POLLIN)
+    {   char c;
+	gone = recv(fd, &c, 1, MSG_PEEK) == 0;
+    }
+    return gone;
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 //  Output
 
@@ -208,73 +287,295 @@ NetConnection::mprintf(const char *format, ...)
     if (fd < 0)
 	return;				// if closed, do nothing.
 
+    char *msg = reserve();
+
     va_list args;
     va_start(args, format);
-
-    msgList_t * msg = new msgList_t;
-    msg->next = NULL;
-    Length len = vsnprintf(
-        msg->msg + 4, MAXMSGSIZE + 1, format, args) + 1;
+    int n = vsnprintf(msg + sizeof (Length), MAXMSGSIZE + 1, format, args);
     va_end(args);
 
-    if (len <= 0 || len == MAXMSGSIZE+1) {
+    if (n < 0 || n >= MAXMSGSIZE) {
         Log::error("tried to write a message that was too big");
         assert(0);
         // protocol botch.  Don't send the message.
         return;
     }
-    
-    if (omsgListTail) {
-        omsgListTail = omsgListTail->next = msg;
-    } else {
-        omsgList = omsgListTail = msg;
+
+    Length len = htonl(n + 1);
+    memcpy(msg, &len, sizeof (Length));
+    sent(sizeof (Length) + n + 1);
+}
+
+void
+NetConnection::mrecord(const Record& record)
+{
+    if (fd < 0)
+	return;				// if closed, do nothing.
+
+    if (Record::HEADERSIZE + record.pathlen > MAXMSGSIZE)
+    {   Log::error("tried to write a record that was too big");
+	assert(0);
+	return;
     }
-    msg->len = 4 + len;
-    
-    len = htonl(len);
-    memcpy(msg->msg, &len, 4);
-    flush();
+    sent(record.put(reserve()));
+}
+
+bool
+NetConnection::mrecord_fds(const Record& record, const int *fds,
+			   unsigned nfds)
+{
+    if (fd < 0)
+	return false;
+    if (obytes && !drain())
+	return false;			// the socket's full
+
+    char buf[MAXMSGSIZE];
+    if (Record::HEADERSIZE + record.pathlen > sizeof buf)
+	return false;
+    iovec iov;
+    iov.iov_base = buf;
+    iov.iov_len = record.put(buf);
+
+    char control[CMSG_SPACE(MAXFDS * sizeof (int))];
+    assert(nfds <= MAXFDS);
+    msghdr msg;
+    memset(&msg, 0, sizeof msg);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = CMSG_SPACE(nfds * sizeof (int));
+    cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(nfds * sizeof (int));
+    memcpy(CMSG_DATA(cmsg), fds, nfds * sizeof (int));
+
+    ssize_t ret = sendmsg(fd, &msg, 0);
+    output_writes++;
+    if (ret <= 0)
+    {   if (errno != EWOULDBLOCK && errno != EINTR)
+	    Log::perror("fd %d can't send descriptors", fd);
+	return false;
+    }
+    messages_sent++;
+
+    //  The descriptors went with the first byte.  Queue whatever
+    //  didn't fit.
+
+    if ((size_t) ret < iov.iov_len)
+    {   unsigned rest = iov.iov_len - ret;
+	memcpy(reserve(), buf + ret, rest);
+	otail->tail += rest;
+	obytes += rest;
+	flush();
+    }
+    return true;
+}
+
+//  unblocked calls the unblock handler, for a subclass that has other
+//  places to put output.
+
+void
+NetConnection::unblocked()
+{
+    if (unblock_handler)
+	(*unblock_handler)(closure);
+}
+
+//  reserve returns where to put the next message: at the end of the
+//  last chunk, if there's room for the biggest message there.
+
+char *
+NetConnection::reserve()
+{
+    if (!otail || otail->data + CHUNKSIZE - otail->tail < MAXMSGSIZE + 5)
+    {   Chunk *c = new_chunk();
+	if (otail)
+	    otail->next = c;
+	else
+	    ohead = c;
+	otail = c;
+    }
+    return otail->tail;
+}
+
+//  sent adds a message of nbytes, just put where reserve() said, to
+//  the output.
+
+void
+NetConnection::sent(unsigned nbytes)
+{
+    otail->tail += nbytes;
+    obytes += nbytes;
+    messages_sent++;
+
+    //  If output is blocked, the write handler will flush it.  If
+    //  more_output() is making messages, flush() is already running.
+
+    if (!oready || filling)
+	return;
+    if (output_full())
+	flush();
+    else
+	want_output();
+}
+
+void
+NetConnection::want_output()
+{
+    if (oready && !filling && !flush_taskid && fd >= 0)
+    {   timeval now;
+	(void) gettimeofday(&now, NULL);
+	flush_taskid = Scheduler::install_onetime_task(now, flush_task, this);
+    }
+}
+
+void
+NetConnection::more_output()
+{ }
+
+void
+NetConnection::fill()
+{
+    if (!output_full())
+    {   filling = true;
+	more_output();
+	filling = false;
+    }
+}
+
+void
+NetConnection::flush_task(void *closure)
+{
+    NetConnection *connection = (NetConnection *) closure;
+    connection->flush_taskid = 0;
+    connection->flush();
 }
 
 void
 NetConnection::flush()
 {
-    while (omsgList) 
+    if (flush_taskid)
+    {   Scheduler::remove_onetime_task(flush_taskid);
+	flush_taskid = 0;
+    }
+    if (fd < 0)
+	return;
+
+    //  Alternate between letting the subclass fill the output and
+    //  writing it, until there's nothing more or the socket is full.
+
+    for (;;)
+    {   fill();
+	if (!obytes || !drain())
+	    break;
+    }
+    set_handlers(iready, obytes == 0);
+}
+
+//  drain writes as much queued output as the socket will take, and
+//  frees the chunks it empties.  It keeps writing until a write comes
+//  up short, so one call per writable event is enough.  Returns true
+//  if nothing is left.
+
+bool
+NetConnection::drain()
+{
+    while (ohead)
     {
-	int ret = send(fd, omsgList->msg, omsgList->len, 0);
-        if (ret < 0 && errno == EWOULDBLOCK) 
-        {
-            break;
-        } else 
-        {
-            if (ret >= 0) 
-            {
-                assert(ret == omsgList->len);
-            } else 
-            {
-                /* Since the client library can close it's fd before
-                 * getting acks from all FAMCancelMonitor requests we
-                 * may get a broken pipe error here when writing the ack.
-                 * Don't threat this as an error, since that fills the logs
-                 * with crap.
-                 */
-                if (errno == EPIPE)
-                {
-                    Log::debug("fd %d write error: %m", fd);
-                } else
-                {
-                    Log::error("fd %d write error: %m", fd);
-                }
-            }
-            msgList_t *oldHead = omsgList;
-            omsgList = omsgList->next;
-            if (omsgListTail == oldHead) {
-                omsgListTail = NULL;
-            }
-            delete oldHead;
+	iovec iov[MAXIOV];
+	int niov = 0;
+	size_t want = 0;
+	for (Chunk *c = ohead; c && niov < MAXIOV; c = c->next)
+	{   iov[niov].iov_base = c->head;
+	    iov[niov].iov_len = c->tail - c->head;
+	    want += iov[niov++].iov_len;
+	}
+
+	ssize_t ret = writev(fd, iov, niov);
+	output_writes++;
+	if (ret < 0)
+	{   if (errno == EWOULDBLOCK || errno == EINTR)
+		return false;
+
+	    /* Since the client library can close it's fd before
+	     * getting acks from all FAMCancelMonitor requests we
+	     * may get a broken pipe error here when writing the ack.
+	     * Don't threat this as an error, since that fills the logs
+	     * with crap.
+	     */
+	    if (errno == EPIPE)
+		Log::debug("fd %d write error: %m", fd);
+	    else
+		Log::error("fd %d write error: %m", fd);
+	    discard_output();
+	    return true;
+	}
+
+	//  Free what was written.  A partly written chunk stays at the
+	//  head.
+
+	obytes -= ret;
+	while (ohead && ret >= ohead->tail - ohead->head)
+	{   ret -= ohead->tail - ohead->head;
+	    Chunk *c = ohead;
+	    ohead = c->next;
+	    free_chunk(c);
 	}
+	if (!ohead)
+	    otail = NULL;
+	else
+	    ohead->head += ret;
+	if ((size_t) ret < want && ohead)
+	{   short_writes++;
+	    return false;
+	}
+    }
+    assert(obytes == 0);
+    return true;
+}
+
+void
+NetConnection::discard_output()
+{
+    if (flush_taskid)
+    {   Scheduler::remove_onetime_task(flush_taskid);
+	flush_taskid = 0;
+    }
+    while (ohead)
+    {   Chunk *c = ohead;
+	ohead = c->next;
+	free_chunk(c);
+    }
+    otail = NULL;
+    obytes = 0;
+}
+
+NetConnection::Chunk *
+NetConnection::new_chunk()
+{
+    Chunk *c = free_chunks;
+    if (c)
+    {   free_chunks = c->next;
+	nfree_chunks--;
+    }
+    else
+	c = new Chunk;
+    c->next = NULL;
+    c->head = c->tail = c->data;
+    return c;
+}
+
+void
+NetConnection::free_chunk(Chunk *c)
+{
+    if (nfree_chunks < MAXFREE)
+    {   c->next = free_chunks;
+	free_chunks = c;
+	nfree_chunks++;
     }
-    set_handlers(iready, !omsgList);
+    else
+	delete c;
 }
 
 void
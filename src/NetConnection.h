@@ -27,6 +27,10 @@
 #include "Boolean.h"
 #include <limits.h>
 
+#include "Scheduler.h"
+
+struct Record;
+
 //  NetConnection is an abstract base class that implements an event
 //  driven, flow controlled reliable datagram connection over an
 //  already open stream socket.
@@ -38,8 +42,31 @@
 //
 //  The mprintf() function outputs a message using printf-style
 //  formatting.  It appends a NUL byte to the message and prepends the
-//  message length.  It also automatically flushes the message.  If
-//  the connection has closed, mprintf() returns immediately.
+//  message length.  If the connection has closed, mprintf() returns
+//  immediately.
+//
+//  Once accept_records() has been called, a message may also be a
+//  Record (see Record.h), which says its own length.  mrecord()
+//  sends one, and input_record() is called with each one received.
+//  mrecord_fds() sends a Record with file descriptors attached.  It
+//  writes everything queued before it first, so it fails if the
+//  socket is full.
+//
+//  Output is formatted straight into a chain of fixed-size chunks,
+//  which come from a pool shared by all connections.  mprintf()
+//  doesn't write each message as it's made; it installs a onetime
+//  task to flush, so all the messages made while handling one event
+//  go out in a single writev(2).  A chunk's worth of output is
+//  flushed at once, though, so a burst doesn't pile up unsent.  A
+//  short write leaves the rest queued for the write handler.
+//  Whatever is still queued when the connection is shut down gets
+//  one last try.
+//
+//  A subclass may hold messages back instead of making them right
+//  away.  Whenever the connection has room for more output, it calls
+//  the virtual function more_output(), which should mprintf() held
+//  messages until output_full() says to stop.  want_output() asks
+//  for more_output() to be called soon.
 //
 //  When a complete message is received, the pure virtual function
 //  input_msg() is called with the length and the address of the
@@ -54,6 +81,10 @@
 //  that input is only accepted when it's possible to send a reply.
 //  The unblock handler, if any, is called whenever output becomes
 //  unblocked.
+//
+//  A subclass that has stopped reading for some other reason would
+//  never see EOF, so it can ask hung_up() whether the other end has
+//  gone away.
 
 class NetConnection {
 
@@ -71,23 +102,48 @@ public:
 protected:
 
     virtual bool input_msg(const char *data, unsigned nbytes) = 0;
+    virtual bool input_record(const Record&);
+    virtual void more_output();
     void mprintf(const char *format, ...);
+    void mrecord(const Record&);
+    bool mrecord_fds(const Record&, const int *fds, unsigned nfds);
+    void unblocked();
+    void accept_records(bool tf)	{ records = tf; }
+    void want_output();
+    bool hung_up() const;
+    bool output_full() const		{ return obytes >= CHUNKSIZE; }
 
 private:
 
     enum { MAXMSGSIZE = PATH_MAX + 40 };
     typedef u_int32_t Length;
-    typedef struct msgList_s {
-        char msg[MAXMSGSIZE+5];  //  + 4 for 32-bit length, + 1 for overflow
-        int len;
-        msgList_s * next;
-    } msgList_t;
-    
-    msgList_t *omsgList;
-    msgList_t *omsgListTail;
+
+    //  A Chunk holds queued output from head to tail.  Chunks are
+    //  big enough that any message fits in an empty one.  MAXIOV is
+    //  the most chunks written by one writev(), and MAXFREE is the
+    //  most kept in the pool.
+
+    enum { CHUNKSIZE = 16384, MAXIOV = 16, MAXFREE = 64 };
+    enum { MAXFDS = 4 };		// most passed by mrecord_fds()
+
+    struct Chunk {
+	Chunk *next;
+	char *head, *tail;
+	char data[CHUNKSIZE];
+    };
+
+    Chunk *ohead;
+    Chunk *otail;
+    unsigned obytes;
+    Scheduler::TaskID flush_taskid;
+    bool filling;			// in more_output()
+
+    static Chunk *free_chunks;
+    static unsigned nfree_chunks;
 
     int fd;
     bool iready, oready;
+    bool records;			// Records may come in
     char ibuf[MAXMSGSIZE+5];     //  + 4 for 32-bit length, + 1 for overflow
     char *iend;
     char *itail;
@@ -105,7 +161,15 @@ private:
 
     //  Output
 
+    char *reserve();
+    void sent(unsigned nbytes);
     void flush();
+    void fill();
+    bool drain();
+    void discard_output();
+    static Chunk *new_chunk();
+    static void free_chunk(Chunk *);
+    static void flush_task(void *closure);
     static void write_handler(int fd, void *closure);
 
     NetConnection(const NetConnection&); // Do not copy
@@ -22,35 +22,95 @@
 
 #include "Pollster.h"
 
+#include <stdlib.h>
+#include <string.h>
+
+#include "FileSystem.h"
 #include "Interest.h"
 #include "Log.h"
 #include "Scheduler.h"
 #include "ServerHost.h"
+#include "Stats.h"
+#include "timeval.h"
 
 bool		  Pollster::remote_polling_enabled = true;
 timeval		  Pollster::pintvl;  //  set when main() calls interval()
-Set<Interest *>	  Pollster::polled_interests;
+unsigned	  Pollster::max_intvl;
 Set<ServerHost *> Pollster::polled_hosts;
 bool		  Pollster::polling = false;
+Scheduler::TaskID Pollster::polling_taskid;
+Scheduler::TaskID Pollster::hosts_taskid;
+ServerHost	 *Pollster::host_cursor;
+unsigned	  Pollster::host_passes;
+unsigned	  Pollster::slice_polls;
+unsigned	  Pollster::slice_msecs;
+Pollster::Polled *Pollster::heap;
+unsigned	  Pollster::heap_size;
+unsigned	  Pollster::heap_alloc;
+Scheduler::TaskID Pollster::due_taskid;
+timespec	  Pollster::due_scheduled;
+
+static Stats::Counter interests_polled("interests polled");
+static Stats::Counter slices_cut("poll slices cut short");
+static Stats::Counter polls_skipped("polls skipped on slow filesystems");
+static Stats::Histogram interest_usecs("interest poll slice usecs");
+static Stats::Histogram host_usecs("host poll slice usecs");
 
 void
-Pollster::watch(Interest *ip)
+Pollster::watch(Interest *ip, unsigned secs)
 {
-    polled_interests.insert(ip);
+    if (ip->poll_slot)
+	return;
+    if (heap_size == heap_alloc)
+    {   heap_alloc = heap_alloc ? heap_alloc * 2 : 64;
+	Polled *nh = new Polled[heap_alloc];
+	if (heap_size)
+	    memcpy(nh, heap, heap_size * sizeof *heap);
+	delete [] heap;
+	heap = nh;
+    }
 
-    if (!polling)
-	start_polling();
+    Polled p;
+    p.due = Scheduler::clock();
+    p.interval = secs ? secs : min_interval();
+    p.due.tv_sec += p.interval;
+    jitter(p.due, p.interval);
+    p.ip = ip;
+    place(heap_size++, p);
+    sift_up(heap_size - 1);
+    schedule();
 }
 
 void
 Pollster::forget(Interest *ip)
 {
-    int old_size = polled_interests.size();
-    (void) polled_interests.remove(ip);
-    int new_size = polled_interests.size();
+    if (!ip->poll_slot)
+	return;
+    remove(ip->poll_slot - 1);
+    schedule();
+}
 
-    if (old_size && !new_size && !polled_hosts.size())
-	stop_polling();
+//  changed is called when an Interest sees a change.  If it's polled,
+//  it goes back to being polled as often as its FileSystem allows.
+
+void
+Pollster::changed(Interest *ip)
+{
+    if (!ip->poll_slot)
+	return;
+    unsigned i = ip->poll_slot - 1;
+    unsigned secs = ip->filesystem()->polling_interval();
+    if (!secs || heap[i].interval == secs)
+	return;
+    Polled p = heap[i];
+    p.due = Scheduler::clock();
+    p.interval = secs;
+    p.due.tv_sec += p.interval;
+    jitter(p.due, p.interval / 4.0);
+    place(i, p);
+    sift_up(i);
+    sift_down(ip->poll_slot - 1);
+    schedule();
 }
 
 void
@@ -71,19 +131,66 @@ Pollster::forget(ServerHost *ip)
     (void) polled_hosts.remove(ip);
     int new_size = polled_hosts.size();
 
-    if (old_size && !new_size && !polled_interests.size())
+    if (old_size && !new_size)
 	stop_polling();
 }
 
 //////////////////////////////////////////////////////////////////////////////
+//  A Slice starts when it's constructed.  It's spent when it has
+//  polled slice_polls files or run for slice_msecs, whichever comes
+//  first.  Zero means no limit.
+
+Pollster::Slice::Slice()
+    : start(Scheduler::clock()), polls(0)
+{ }
+
+bool
+Pollster::Slice::spent() const
+{
+    if (slice_polls && polls >= slice_polls)
+	return true;
+    return slice_msecs && polls && usecs() >= slice_msecs * 1000UL;
+}
+
+unsigned long
+Pollster::Slice::usecs() const
+{
+    timespec now = Scheduler::clock();
+    long usecs = (now.tv_sec - start.tv_sec) * 1000000L
+		 + (now.tv_nsec - start.tv_nsec) / 1000;
+    return usecs < 0 ? 0 : usecs;
+}
+
+//  jitter moves t earlier by a random time up to secs.
+
+void
+Pollster::jitter(timespec& t, double secs)
+{
+    long usecs = (long) (secs * 1000000 * (random() / (RAND_MAX + 1.0)));
+    t.tv_sec -= usecs / 1000000;
+    t.tv_nsec -= usecs % 1000000 * 1000;
+    if (t.tv_nsec < 0)
+    {   t.tv_sec--;
+	t.tv_nsec += 1000000000;
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////////
+//  Hosts are polled by a recurring task.  If one pass over the hosts
+//  takes more than a slice, hosts_task carries on where it left off.
+//  A pass that's still going when the next is due skips it.
 
 void
 Pollster::start_polling()
 {
     assert(!polling);
-    assert(polled_interests.size() || polled_hosts.size());
-    Log::debug("polling every %d seconds", pintvl.tv_sec);
-    (void) Scheduler::install_recurring_task(pintvl, polling_task, NULL);
+    assert(polled_hosts.size());
+    Log::debug("polling hosts every %d seconds", pintvl.tv_sec);
+    timespec interval = { pintvl.tv_sec, pintvl.tv_usec * 1000 };
+    timespec phase = interval;
+    jitter(phase, pintvl.tv_sec);
+    polling_taskid = Scheduler::install_recurring_task(interval, phase,
+						       polling_task, NULL);
     polling = true;
 }
 
@@ -91,44 +198,206 @@ void
 Pollster::stop_polling()
 {
     assert(polling);
-    assert(!polled_interests.size());
     assert(!polled_hosts.size());
-    (void) Scheduler::remove_recurring_task(polling_task, NULL);
+    Scheduler::remove_recurring_task(polling_taskid);
+    Scheduler::remove_onetime_task(hosts_taskid);
+    hosts_taskid = 0;
     polling = false;
-    Log::debug("will stop polling");
+    Log::debug("will stop polling hosts");
 }
 
 void
 Pollster::polling_task(void *)
 {
-    timeval t0, t1;
-    (void) gettimeofday(&t0, NULL);
+    if (hosts_taskid)
+	return;				// last pass isn't done
+    host_cursor = NULL;
+    host_passes++;
+    hosts_task(NULL);
+}
+
+void
+Pollster::hosts_task(void *)
+{
+    hosts_taskid = 0;
+    if (!remote_polling_enabled)
+	return;
+
+    Slice slice;
+    int nh = 0;
+    ServerHost *hp = host_cursor ? polled_hosts.next(host_cursor)
+				 : polled_hosts.first();
+    for ( ; hp; hp = polled_hosts.next(hp))
+    {   if (slice.spent())
+	{   hosts_taskid = Scheduler::install_onetime_task(Scheduler::clock(),
+							   hosts_task, NULL);
+	    slices_cut++;
+	    break;
+	}
+	slice.count(hp->poll(host_passes));
+	host_cursor = hp;
+	nh++;
+    }
+    if (nh)
+    {   host_usecs.add(slice.usecs());
+	Log::debug("polled %d host%s", nh, nh == 1 ? "" : "s");
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////////
+//  Interests are polled by a one-time task that's moved to whenever
+//  the next one is due.
+
+void
+Pollster::schedule()
+{
+    if (!heap_size)
+    {   if (due_taskid)
+	{   Scheduler::remove_onetime_task(due_taskid);
+	    due_taskid = 0;
+	    Log::debug("will stop polling");
+	}
+	return;
+    }
+    if (due_taskid && due_scheduled == heap[0].due)
+	return;
+    Scheduler::remove_onetime_task(due_taskid);
+    due_scheduled = heap[0].due;
+    due_taskid = Scheduler::install_onetime_task(due_scheduled,
+						 due_task, NULL);
+}
+
+//  due_task polls every Interest that's due.  Each is put back in the
+//  heap before it's polled, with its interval doubled; if the poll
+//  sees a change, changed() puts it back to the polling interval.  If
+//  the poll couldn't be done, the interval stays as it was.  No
+//  Interest is polled more often than its FileSystem allows; if it
+//  isn't to be polled at all right now (its FileSystem is slow), it's
+//  just put back to be looked at again in a polling interval.  If the
+//  slice is spent first, the rest are still due, so schedule() puts
+//  the task at a time that's passed and the Scheduler runs it again
+//  once it has checked for I/O.
+
+void
+Pollster::due_task(void *)
+{
+    due_taskid = 0;
+
+    timespec t0 = Scheduler::clock();
+    timespec horizon = t0;
+    horizon.tv_nsec += SLACK_USEC * 1000L;
+    if (horizon.tv_nsec >= 1000000000)
+    {   horizon.tv_sec++;
+	horizon.tv_nsec -= 1000000000;
+    }
 
+    unsigned max = max_intvl > min_interval() ? max_intvl : min_interval();
+    Slice slice;
     int ni = 0;
-    for (Interest *ip = polled_interests.first();
-	 ip;
-	 ip = polled_interests.next(ip))
-    {
-	ip->poll();
+    Interest::begin_fanout();
+    while (heap_size && heap[0].due <= horizon)
+    {   if (slice.spent())
+	{   slices_cut++;
+	    break;
+	}
+	Polled p = heap[0];
+	unsigned interval = p.interval;
+	unsigned least = p.ip->filesystem()->polling_interval();
+	bool skip = !least;
+	if (skip)
+	    p.interval = min_interval();
+	else
+	{   unsigned most = max > least ? max : least;
+	    p.interval = interval * 2 < most ? interval * 2 : most;
+	    if (p.interval < least)
+		p.interval = least;
+	}
+	p.due = t0;
+	p.due.tv_sec += p.interval;
+	jitter(p.due, p.interval / 4.0);
+	place(0, p);
+	sift_down(0);
+	if (skip)
+	{   polls_skipped++;
+	    continue;
+	}
+
+	if (!p.ip->poll() && p.ip->poll_slot)
+	{   unsigned i = p.ip->poll_slot - 1;
+	    p = heap[i];
+	    p.interval = interval;
+	    p.due = t0;
+	    p.due.tv_sec += interval;
+	    place(i, p);
+	    sift_up(i);
+	    sift_down(p.ip->poll_slot - 1);
+	}
+	slice.count(1);
 	ni++;
     }
+    Interest::end_fanout();
+    interests_polled += ni;
 
-    int nh = 0;
-    if (remote_polling_enabled)
-	for (ServerHost *hp = polled_hosts.first();
-	     hp;
-	     hp = polled_hosts.next(hp))
-	{
-	    hp->poll();
-	    nh++;
-	}
+    if (ni)
+    {   unsigned long usecs = slice.usecs();
+	interest_usecs.add(usecs);
+	Log::debug("polled %d interest%s in %.3f seconds",
+		   ni, ni == 1 ? "" : "s", usecs / 1000000.0);
+    }
+    schedule();
+}
+
+//////////////////////////////////////////////////////////////////////////////
+//  The heap of Interests.  An Interest's poll_slot is one more than
+//  its index in the heap.
+
+void
+Pollster::place(unsigned i, const Polled& p)
+{
+    heap[i] = p;
+    p.ip->poll_slot = i + 1;
+}
+
+void
+Pollster::sift_up(unsigned i)
+{
+    Polled p = heap[i];
+    while (i > 0)
+    {   unsigned parent = (i - 1) / 2;
+	if (!(p.due < heap[parent].due))
+	    break;
+	place(i, heap[parent]);
+	i = parent;
+    }
+    place(i, p);
+}
 
-    if ((ni || nh) && (Log::get_level() == Log::DEBUG))
-    {   (void) gettimeofday(&t1, NULL);
-	double t = t1.tv_sec - t0.tv_sec + (t1.tv_usec - t0.tv_usec)/1000000.0;
-	Log::debug("polled %d interest%s and %d host%s in %.3f seconds",
-		   ni, ni == 1 ? "" : "s",
-		   nh, nh == 1 ? "" : "s",
-		   t);
+void
+Pollster::sift_down(unsigned i)
+{
+    Polled p = heap[i];
+    for (;;)
+    {   unsigned child = 2 * i + 1;
+	if (child >= heap_size)
+	    break;
+	if (child + 1 < heap_size && heap[child + 1].due < heap[child].due)
+	    child++;
+	if (!(heap[child].due < p.due))
+	    break;
+	place(i, heap[child]);
+	i = child;
     }
+    place(i, p);
+}
+
+void
+Pollster::remove(unsigned i)
+{
+    heap[i].ip->poll_slot = 0;
+    if (--heap_size == i)
+	return;
+    Interest *moved = heap[heap_size].ip;
+    place(i, heap[heap_size]);
+    sift_up(i);
+    sift_down(moved->poll_slot - 1);
 }
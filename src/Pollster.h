@@ -27,18 +27,42 @@
 #include <stdlib.h>
 
 #include "Boolean.h"
+#include "Scheduler.h"
 #include "Set.h"
 
 class Interest;
 class ServerHost;
 
-//  The Pollster remembers what needs to be polled, and wakes up every
-//  few seconds to poll it.  The Pollster polls Interests and Hosts.
+//  The Pollster remembers what needs to be polled, and wakes up when
+//  it's time to poll it.  The Pollster polls Interests and Hosts.
 //  Each Host, if it can't connect to remote fam, polls its own Interests.
 //
-//  The Pollster's polling interval can be set or interrogated.
-//  Also, remote polling can be enabled or disabled using enable()
-//  or disable() (corresponds to "fam -l").
+//  Each Interest is polled on its own interval.  It starts at the
+//  polling interval, doubles every time a poll finds nothing new, up
+//  to the maximum interval, and drops back to the polling interval
+//  as soon as a change is seen.  Files that change often are polled
+//  often, and files that never change are hardly polled at all.  The
+//  Interests are kept in a heap ordered by when they're due, so each
+//  wakeup only touches the ones that are due.  Hosts are all polled
+//  every polling interval.
+//
+//  An Interest's polling interval is the Pollster's, unless its
+//  FileSystem says otherwise (see FileSystem::polling_interval()).
+//  watch() is told that interval by its caller, because it may be
+//  called while the Interest is still being constructed.
+//
+//  Polling is done in slices, so a lot of files to poll doesn't keep
+//  fam from its clients.  A slice ends when it has polled as many
+//  files as the slice size or run as long as the slice time; the
+//  rest are polled in the next slice, after the Scheduler has handled
+//  any I/O that's ready.  Each Interest's first poll and each later
+//  one are moved earlier by a random fraction of its interval, so
+//  files watched together don't stay lumped together.  The hosts'
+//  polling task starts at a random phase for the same reason.
+//
+//  The polling interval and the maximum interval can be set or
+//  interrogated.  Also, remote polling can be enabled or disabled
+//  using enable() or disable() (corresponds to "fam -l").
 //
 //  When there's nothing to poll, the Pollster turns itself off, so
 //  fam can sleep for a long time.
@@ -50,32 +74,93 @@ class Pollster {
 
 public:
 
-    static void watch(Interest *);
+    static void watch(Interest *, unsigned secs);
     static void forget(Interest *);
+    static void changed(Interest *);
 
     static void watch(ServerHost *);
     static void forget(ServerHost *);
 
     static void interval(unsigned secs)	{ pintvl.tv_sec = (long)secs; }
     static unsigned interval()		{ return pintvl.tv_sec; }
+    static void max_interval(unsigned secs) { max_intvl = secs; }
+    static unsigned max_interval()	{ return max_intvl; }
+    static void slice(unsigned polls, unsigned msecs)
+					{ slice_polls = polls;
+					  slice_msecs = msecs; }
     static void enable()		{ remote_polling_enabled = true; }
     static void disable()		{ remote_polling_enabled = false; }
 
 private:
 
+    //  Interests due within SLACK_USEC of a wakeup are polled then,
+    //  so Interests due at nearly the same time share one wakeup.
+
+    enum { SLACK_USEC = 500000 };
+
+    struct Polled {
+	timespec due;			// on the Scheduler's clock
+	unsigned interval;		// seconds
+	Interest *ip;
+    };
+
+    //  A Slice keeps track of how much of its budget a slice has used.
+
+    class Slice {
+
+    public:
+
+	Slice();
+	void count(unsigned n)		{ polls += n; }
+	bool spent() const;
+	unsigned long usecs() const;
+	unsigned polled() const		{ return polls; }
+
+    private:
+
+	timespec start;
+	unsigned polls;
+
+    };
+
     // Class Variables
 
     static bool remote_polling_enabled;
     static timeval pintvl;		// polling interval
-    static Set<Interest *> polled_interests;
+    static unsigned max_intvl;		// longest an Interest waits
     static Set<ServerHost *> polled_hosts;
-    static bool polling;
+    static bool polling;		// hosts are being polled
+    static Scheduler::TaskID polling_taskid;
+    static Scheduler::TaskID hosts_taskid;
+    static ServerHost *host_cursor;	// last host polled in this pass
+    static unsigned host_passes;	// passes over the hosts so far
+    static unsigned slice_polls;	// most files polled per slice
+    static unsigned slice_msecs;	// longest a slice runs
+
+    //  The heap of polled Interests, soonest due first.  Each Interest
+    //  knows where it is in the heap.
+
+    static Polled *heap;
+    static unsigned heap_size;
+    static unsigned heap_alloc;
+    static Scheduler::TaskID due_taskid;
+    static timespec due_scheduled;	// when due_task will run
 
     // Private Class Methods
 
+    static unsigned min_interval()	{ return pintvl.tv_sec > 0 ?
+						 pintvl.tv_sec : 1; }
     static void polling_task(void *closure);
+    static void hosts_task(void *closure);
+    static void due_task(void *closure);
     static void start_polling();
     static void stop_polling();
+    static void schedule();
+    static void jitter(timespec&, double secs);
+    static void place(unsigned, const Polled&);
+    static void sift_up(unsigned);
+    static void sift_down(unsigned);
+    static void remove(unsigned);
 
     Pollster();				// Do not instantiate.
 
@@ -41,7 +41,7 @@ RPC_TCP_Connector::RPC_TCP_Connector(unsigned long p,
 				     ConnectHandler ch,
                                      void *cl)
     : state(IDLE), sockfd(-1), program(p), version(v),
-      connect_handler(ch), closure(cl)
+      retry_taskid(0), connect_handler(ch), closure(cl)
 {
     memset(&address, 0, sizeof address);
     address.sin_family = AF_INET;
@@ -74,7 +74,7 @@ RPC_TCP_Connector::deactivate()
 	sockfd = -1;
     }
     if (state == PAUSING)
-	(void) Scheduler::remove_onetime_task(retry_task, this);
+	Scheduler::remove_onetime_task(retry_taskid);
     state = IDLE;
 }
 
@@ -201,7 +201,8 @@ RPC_TCP_Connector::try_again()
     if (retry_interval < MAX_RETRY_INTERVAL)
 	retry_interval *= 2;
 
-    Scheduler::install_onetime_task(next_time, retry_task, this);
+    retry_taskid = Scheduler::install_onetime_task(next_time,
+						   retry_task, this);
 }
 
 void
@@ -27,6 +27,7 @@
 #include <netinet/in.h>
 
 #include "Boolean.h"
+#include "Scheduler.h"
 
 //  An RPC_TCP_Connector is an object that connects to a server.
 //  Specifically, a service registered with portmapper that uses
@@ -79,6 +80,7 @@ private:
     unsigned long program;
     unsigned long version;
     int retry_interval;
+    Scheduler::TaskID retry_taskid;
     const ConnectHandler connect_handler;
     void *closure;
 
@@ -34,133 +34,276 @@
 
 //  Define a bunch of class-global variables.
 
-Scheduler::IOTypeInfo	 Scheduler::read(&FDInfo::read);
-Scheduler::IOTypeInfo	 Scheduler::write(&FDInfo::write);
 unsigned int		 Scheduler::nfds;
 Scheduler::FDInfo	*Scheduler::fdinfo;
 unsigned int		 Scheduler::nfdinfo_alloc;
 
-unsigned int		 Scheduler::ntasks;
-Scheduler::TimedProc	 Scheduler::recurring_proc;
-void			*Scheduler::recurring_closure;
-timeval			 Scheduler::next_task_time;
-timeval			 Scheduler::recurring_interval;
-Scheduler::onetime_task	*Scheduler::first_task;
+Scheduler::timed_task	*Scheduler::tasks;
+unsigned int		 Scheduler::ntasks_alloc;
+unsigned int		 Scheduler::free_task;
+unsigned int		*Scheduler::heap;
+unsigned int		 Scheduler::heap_size;
+Scheduler::Nanosecs	 Scheduler::tasks_time;
 bool			 Scheduler::running;
 
 
 //////////////////////////////////////////////////////////////////////////////
-//  One time task code
+//  Timed task code
+
+static const long long NSEC_PER_SEC = 1000000000;
+static const long long NSEC_PER_USEC = 1000;
+
+Scheduler::Nanosecs
+Scheduler::now()
+{
+#ifdef CLOCK_MONOTONIC
+    timespec ts;
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) == 0)
+	return ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+#endif
+    timeval tv;
+    (void) gettimeofday(&tv, NULL);
+    return tv.tv_sec * NSEC_PER_SEC + tv.tv_usec * NSEC_PER_USEC;
+}
+
+Scheduler::TaskID
+Scheduler::task_id(unsigned int slot)
+{
+    return tasks[slot].generation << SLOT_BITS | (slot + 1);
+}
+
+//  alloc_task returns the index of a free slot in the tasks array,
+//  growing the array (and the heap, which is the same size) if
+//  there are no free slots.
+
+unsigned int
+Scheduler::alloc_task()
+{
+    if (!free_task)
+    {
+	unsigned newalloc = ntasks_alloc * 3 / 2 + 10;
+	assert(newalloc < (TaskID) 1 << SLOT_BITS);
+	timed_task *newtasks = new timed_task[newalloc];
+	unsigned int *newheap = new unsigned int[newalloc];
+	for (unsigned i = 0; i < ntasks_alloc; i++)
+	    newtasks[i] = tasks[i];
+	for (unsigned i = 0; i < heap_size; i++)
+	    newheap[i] = heap[i];
+	delete [] tasks;
+	delete [] heap;
+	tasks = newtasks;
+	heap = newheap;
+
+	// Put the new slots on the free list.
+
+	for (unsigned i = ntasks_alloc; i < newalloc; i++)
+	{   tasks[i].proc = NULL;
+	    tasks[i].closure = NULL;
+	    tasks[i].generation = 0;
+	    tasks[i].heap_index = i + 1 < newalloc ? i + 2 : 0;
+	}
+	free_task = ntasks_alloc + 1;
+	ntasks_alloc = newalloc;
+    }
+
+    //  free_task and the free list links are slot numbers plus one,
+    //  so that zero can end the list.
+
+    unsigned int slot = free_task - 1;
+    free_task = tasks[slot].heap_index;
+    return slot;
+}
 
 void
-Scheduler::install_onetime_task(const timeval& when,
-				TimedProc proc, void *closure)
+Scheduler::free_task_slot(unsigned int slot)
+{
+    timed_task *tp = &tasks[slot];
+    tp->proc = NULL;
+    tp->closure = NULL;
+    tp->generation++;
+    tp->heap_index = free_task;
+    free_task = slot + 1;
+}
+
+bool
+Scheduler::heap_less(unsigned int i, unsigned int j)
 {
-    onetime_task **fp = &first_task;
-    while (*fp && (*fp)->when < when)
-	fp = &(*fp)->next;
-    onetime_task *nt = new onetime_task;
-    nt->next = *fp;
-    *fp = nt;
-    nt->when = when;
-    nt->proc = proc;
-    nt->closure = closure;
-    ntasks++;
+    return tasks[heap[i]].when < tasks[heap[j]].when;
 }
 
 void
-Scheduler::remove_onetime_task(TimedProc proc, void *closure)
+Scheduler::heap_swap(unsigned int i, unsigned int j)
 {
-    onetime_task *p, **pp = &first_task;
-    while ((p = *pp) != NULL)
-    {
-        if (p->proc == proc && p->closure == closure)
-	{   *pp = p->next;
-	    delete p;
-	    ntasks--;
+    unsigned int t = heap[i];
+    heap[i] = heap[j];
+    heap[j] = t;
+    tasks[heap[i]].heap_index = i;
+    tasks[heap[j]].heap_index = j;
+}
+
+void
+Scheduler::heap_up(unsigned int i)
+{
+    while (i > 0 && heap_less(i, (i - 1) / 2))
+    {   heap_swap(i, (i - 1) / 2);
+	i = (i - 1) / 2;
+    }
+}
+
+void
+Scheduler::heap_down(unsigned int i)
+{
+    for (;;)
+    {   unsigned int least = i, l = 2 * i + 1, r = 2 * i + 2;
+	if (l < heap_size && heap_less(l, least))
+	    least = l;
+	if (r < heap_size && heap_less(r, least))
+	    least = r;
+	if (least == i)
 	    break;
-	}    
-	pp = &p->next;
+	heap_swap(i, least);
+	i = least;
     }
 }
 
-//////////////////////////////////////////////////////////////////////////////
-//  Recurring task code
+//  heap_remove takes the task at heap position i out of the heap and
+//  frees its slot.
 
 void
-Scheduler::install_recurring_task(const timeval& interval,
-				  TimedProc proc, void *closure)
+Scheduler::heap_remove(unsigned int i)
 {
-    timeval now;
+    assert(i < heap_size);
+    unsigned int slot = heap[i];
+    if (i != --heap_size)
+    {   heap[i] = heap[heap_size];
+	tasks[heap[i]].heap_index = i;
+	heap_up(i);
+	heap_down(i);
+    }
+    free_task_slot(slot);
+}
 
-    assert(!recurring_proc);
+Scheduler::TaskID
+Scheduler::install_task(Nanosecs when, Nanosecs interval,
+			TimedProc proc, void *closure)
+{
     assert(proc);
-    assert(interval.tv_sec >= 0);
-    assert(interval.tv_usec >= 0 && interval.tv_usec < 1000000);
-    assert(interval.tv_sec || interval.tv_usec);
-
-    recurring_proc = proc;
-    recurring_closure = closure;
-    recurring_interval = interval;
-    ntasks++;
-    (void) gettimeofday(&now, NULL);
-    next_task_time = now + interval;
+    if (when <= tasks_time)
+	when = tasks_time + 1;		// not until after the next io_wait
+    unsigned int slot = alloc_task();
+    timed_task *tp = &tasks[slot];
+    tp->when = when;
+    tp->interval = interval;
+    tp->proc = proc;
+    tp->closure = closure;
+    tp->heap_index = heap_size;
+    heap[heap_size++] = slot;
+    heap_up(tp->heap_index);
+    return task_id(slot);
 }
 
 void
-Scheduler::remove_recurring_task(TimedProc proc, void *closure)
+Scheduler::remove_task(TaskID id)
 {
-    assert(proc == recurring_proc);
-    assert(closure == recurring_closure);
+    TaskID mask = ((TaskID) 1 << SLOT_BITS) - 1;
+    unsigned int slot = (id & mask) - 1;
+    if (id && slot < ntasks_alloc && tasks[slot].proc && task_id(slot) == id)
+	heap_remove(tasks[slot].heap_index);
+}
+
+//  install_onetime_task converts the time of day it's given to the
+//  monotonic clock.
 
-    recurring_proc = NULL;
-    recurring_closure = closure;
-    timerclear(&recurring_interval);
-    ntasks--;
+Scheduler::TaskID
+Scheduler::install_onetime_task(const timeval& when,
+				TimedProc proc, void *closure)
+{
+    timeval tod;
+    (void) gettimeofday(&tod, NULL);
+    timeval delta = when - tod;
+    Nanosecs when_ns = now() + delta.tv_sec * NSEC_PER_SEC
+				+ delta.tv_usec * NSEC_PER_USEC;
+    return install_task(when_ns, 0, proc, closure);
 }
 
-//  do_tasks activates all timer based tasks.  It also sets
-//  next_task_time to the absolute time when it should next be
-//  invoked.
+timespec
+Scheduler::clock()
+{
+    Nanosecs t = now();
+    timespec ts;
+    ts.tv_sec = t / NSEC_PER_SEC;
+    ts.tv_nsec = t % NSEC_PER_SEC;
+    return ts;
+}
 
-void
-Scheduler::do_tasks()
+Scheduler::TaskID
+Scheduler::install_onetime_task(const timespec& when,
+				TimedProc proc, void *closure)
 {
-    if (ntasks)
-    {
-        timeval now;
-	(void) gettimeofday(&now, NULL);
-	if (recurring_proc && now >= next_task_time)
-	{
-	    // Time for the next task.
+    assert(when.tv_nsec >= 0 && when.tv_nsec < NSEC_PER_SEC);
+    return install_task(when.tv_sec * NSEC_PER_SEC + when.tv_nsec, 0,
+			proc, closure);
+}
 
-            (*recurring_proc)(recurring_closure);
-	    next_task_time += recurring_interval;
+//////////////////////////////////////////////////////////////////////////////
+//  Recurring task code
 
-	    // If the clock has jumped ahead or we've gotten too far behind,
-	    // postpone the next task.
+Scheduler::TaskID
+Scheduler::install_recurring_task(const timeval& interval,
+				  TimedProc proc, void *closure)
+{
+    assert(interval.tv_sec >= 0);
+    assert(interval.tv_usec >= 0 && interval.tv_usec < 1000000);
+    timespec ts;
+    ts.tv_sec = interval.tv_sec;
+    ts.tv_nsec = interval.tv_usec * NSEC_PER_USEC;
+    return install_recurring_task(ts, ts, proc, closure);
+}
 
-	    if (next_task_time < now)
-		next_task_time = now + recurring_interval;
-	}
-	else
-	{   timeval time_left = next_task_time - now;
-	    if (recurring_interval < time_left)
-	    {
-		// More time left than we started with -- clock must have
-		// run backward.  Reset next_task_time to sane value.
-
-		next_task_time = now + recurring_interval;
-	    }
-	}
+Scheduler::TaskID
+Scheduler::install_recurring_task(const timespec& interval,
+				  const timespec& phase,
+				  TimedProc proc, void *closure)
+{
+    assert(interval.tv_sec >= 0);
+    assert(interval.tv_nsec >= 0 && interval.tv_nsec < NSEC_PER_SEC);
+    assert(interval.tv_sec || interval.tv_nsec);
+    assert(phase.tv_sec >= 0);
+    assert(phase.tv_nsec >= 0 && phase.tv_nsec < NSEC_PER_SEC);
+
+    Nanosecs intvl = interval.tv_sec * NSEC_PER_SEC + interval.tv_nsec;
+    Nanosecs when = now() + phase.tv_sec * NSEC_PER_SEC + phase.tv_nsec;
+    return install_task(when, intvl, proc, closure);
+}
 
-	while (first_task && first_task->when < now)
-	{   TimedProc proc = first_task->proc;
-	    void *closure = first_task->closure;
-	    remove_onetime_task(proc, closure);
-	    (*proc)(closure);
+//  do_tasks activates all timed tasks that are due.  A recurring task
+//  is rescheduled before it is activated, so it may remove itself.
+//  If it has fallen more than an interval behind, the activations
+//  it missed are skipped and it stays in phase.  Tasks installed
+//  while this runs are left for the next call, even if they're due.
+
+void
+Scheduler::do_tasks()
+{
+    if (!heap_size)
+	return;
+    Nanosecs t = now();
+    tasks_time = t;
+    while (heap_size && tasks[heap[0]].when <= t)
+    {   timed_task *tp = &tasks[heap[0]];
+	TimedProc proc = tp->proc;
+	void *closure = tp->closure;
+	if (tp->interval)
+	{   tp->when += tp->interval;
+	    if (tp->when <= t)
+		tp->when += ((t - tp->when) / tp->interval + 1) * tp->interval;
+	    heap_down(0);
 	}
+	else
+	    heap_remove(0);
+	(*proc)(closure);
     }
+    tasks_time = 0;
 }
 
 //  calc_timeout calculates the timeout to pass to select().
@@ -174,18 +317,14 @@ Scheduler::calc_timeout()
 {
     static timeval sleep_interval;
     
-    if (ntasks)
+    if (heap_size)
     {
-	timeval wake_time;
-	if (recurring_proc)
-	    wake_time = next_task_time;
-	if (!recurring_proc || first_task && first_task->when < wake_time)
-	    wake_time = first_task->when;
-	timeval now;
-	(void) gettimeofday(&now, NULL);
-	sleep_interval = wake_time - now;
-	if (sleep_interval.tv_sec < 0)
-	    timerclear(&sleep_interval);
+	Nanosecs left = tasks[heap[0]].when - now();
+	if (left < 0)
+	    left = 0;
+	left += NSEC_PER_USEC - 1;		// round up
+	sleep_interval.tv_sec = left / NSEC_PER_SEC;
+	sleep_interval.tv_usec = left % NSEC_PER_SEC / NSEC_PER_USEC;
 	return &sleep_interval;
     }
     else
@@ -245,103 +384,86 @@ Scheduler::trim_fdinfo()
 
 Scheduler::IOHandler
 Scheduler::install_io_handler(int fd, IOHandler handler, void *closure,
-			      IOTypeInfo *iotype)
+			      IOType iotype)
 {
     assert(fd >= 0);
     assert(handler);
     FDInfo *fp = fd_to_info(fd);
-    IOHandler old_handler = (fp->*(iotype->iotype)).handler;
-    (fp->*(iotype->iotype)).handler = handler;
-    (fp->*(iotype->iotype)).closure = closure;
-    assert(!old_handler || FD_ISSET(fd, &iotype->fds));
-    if (!FD_ISSET(fd, &iotype->fds))
-    {
-        FD_SET(fd, &iotype->fds);
-        iotype->nbitsset++;
-    }
+    IOHandler old_handler = (fp->*iotype).handler;
+    (fp->*iotype).handler = handler;
+    (fp->*iotype).closure = closure;
+    if (!old_handler)
+	io_watch(fd, fp->read.handler != NULL, fp->write.handler != NULL);
     return old_handler;
 }
 
 Scheduler::IOHandler
-Scheduler::remove_io_handler(int fd, IOTypeInfo *iotype)
+Scheduler::remove_io_handler(int fd, IOType iotype)
 {
     assert(fd >= 0 && fd < nfds);
     FDInfo *fp = fd_to_info(fd);
-    IOHandler old_handler = (fp->*(iotype->iotype)).handler;
-    (fp->*(iotype->iotype)).handler = NULL;
-    (fp->*(iotype->iotype)).closure = NULL;
-    trim_fdinfo();
+    IOHandler old_handler = (fp->*iotype).handler;
+    (fp->*iotype).handler = NULL;
+    (fp->*iotype).closure = NULL;
     assert(old_handler);
-    if (FD_ISSET(fd, &iotype->fds))
-    {
-        FD_CLR(fd, &iotype->fds);
-        iotype->nbitsset--;
-    }
+    io_watch(fd, fp->read.handler != NULL, fp->write.handler != NULL);
+    trim_fdinfo();			// fp is not valid after this.
     return old_handler;
 }
 
 Scheduler::IOHandler
 Scheduler::install_read_handler(int fd, IOHandler handler, void *closure)
 {
-    return install_io_handler(fd, handler, closure, &read);
+    return install_io_handler(fd, handler, closure, &FDInfo::read);
 }
 
 Scheduler::IOHandler
 Scheduler::remove_read_handler(int fd)
 {
-    return remove_io_handler(fd, &read);
+    return remove_io_handler(fd, &FDInfo::read);
 }
 
 Scheduler::IOHandler
 Scheduler::install_write_handler(int fd, IOHandler handler, void *closure)
 {
-    return install_io_handler(fd, handler, closure, &write);
+    return install_io_handler(fd, handler, closure, &FDInfo::write);
 }
 
 Scheduler::IOHandler
 Scheduler::remove_write_handler(int fd)
 {
-    return remove_io_handler(fd, &write);
+    return remove_io_handler(fd, &FDInfo::write);
 }
 
+//  handle_io is called by the readiness backend for each descriptor
+//  that is ready.  An earlier handler in the same pass may have
+//  removed this descriptor's handler, so check that it is still there.
+
 void
-Scheduler::handle_io(const fd_set *fds, FDInfo::FDIOHandler FDInfo::* iotype)
+Scheduler::handle_io(int fd, IOType iotype)
 {
-    if (fds)
-	for (int fd = 0; fd < nfds; fd++)
-	    if (FD_ISSET(fd, fds))
-	    {   FDInfo *fp = &fdinfo[fd];
-		assert(iotype == &FDInfo::read || iotype == &FDInfo::write);
-		(fp->*iotype).handler(fd, (fp->*iotype).closure);
-		// Remember, handler may move fdinfo array.
-	    }
+    assert(iotype == &FDInfo::read || iotype == &FDInfo::write);
+    if (fd < nfds)
+    {   FDInfo *fp = &fdinfo[fd];
+	if ((fp->*iotype).handler)
+	    (fp->*iotype).handler(fd, (fp->*iotype).closure);
+	// Remember, handler may move fdinfo array.
+    }
 }
 
 // Scheduling priorities defined here: writable descriptors have
 // highest priority, followed by exceptionable descriptors, then
 // readable descriptors, then timed tasks have the lowest priority.
+// The readiness backend's io_wait() takes care of the I/O part.
 
 void
 Scheduler::select()
 {
-    fd_set readfds, writefds;
-    readfds = Scheduler::read.fds;
-    writefds =  Scheduler::write.fds;
-    timeval *timeout   = calc_timeout();
+    timeval *timeout = calc_timeout();
 
-    int status = ::select(nfds, &readfds, &writefds, 0, timeout);
+    // Wait for I/O, and do it if it's ready.
 
-    if (status == -1 && errno != EINTR)
-    {   Log::perror("select");		// Oh, no!
-	::exit(1);
-    }
-    if (status > 0)
-    {
-	// I/O is ready -- find it and do it.
-
-	handle_io( &writefds, &FDInfo::write );
-	handle_io(  &readfds, &FDInfo::read  );
-    }
+    io_wait(timeout);
 
     // Check for tasks now.
 
@@ -24,6 +24,7 @@
 #define Scheduler_included
 
 #include <sys/time.h>
+#include <time.h>
 #include <string.h>
 
 #include "Boolean.h"
@@ -33,10 +34,29 @@
 //  by calling them.
 //
 //  A recurring task will be activated at fixed intervals of real
-//  time.  It is unpredictable when the Scheduler will first activate
-//  a recurring task.
+//  time.  Its first activation is one phase after it is installed,
+//  and later activations follow at multiples of its interval after
+//  that.  If the Scheduler falls behind, missed activations are
+//  skipped rather than run back to back.  The timeval form of
+//  install_recurring_task uses the interval as the phase.
 //
-//  A onetime task will be activated at a particular time.
+//  A onetime task will be activated at a particular time.  A task
+//  installed while timed tasks are being run, to run at a time that
+//  has already come, waits until the Scheduler has checked for I/O
+//  again.  So a long job can be done in slices, each installing a
+//  onetime task for the next, without starving the descriptors.
+//
+//  Installing a task returns a TaskID, which is used to remove the
+//  task.  Removing a onetime task that has already been activated,
+//  or any task that has already been removed, is harmless, so the
+//  TaskID doesn't need to be cleared when the task runs.  All timed
+//  tasks are kept in one heap, so installation and removal take
+//  O(log n) time.
+//
+//  Timed tasks are driven by CLOCK_MONOTONIC, so setting the system
+//  clock neither fires tasks early nor stalls them.  A onetime task's
+//  time of day is converted to the monotonic clock when the task is
+//  installed.
 //
 //  Events are those defined by select(2) -- file descriptors that are
 //  ready to be read, written or checked for exceptional conditions.
@@ -45,14 +65,20 @@
 //  The installation and removal routines return the previously
 //  installed handler.
 //
+//  How the Scheduler waits for events is up to its readiness backend,
+//  which is chosen by configure the same way the IMon backend is.
+//  SchedulerSelect.c++ uses select(2), and is limited to FD_SETSIZE
+//  descriptors.  SchedulerEpoll.c++ uses epoll(7), so the cost of
+//  each wait is proportional to the number of ready descriptors, not
+//  to the highest descriptor number.  The backend is told whenever
+//  the set of handlers on a descriptor changes (io_watch()), and it
+//  calls handle_io() for each ready descriptor (io_wait()).
+//
 //  Scheduler has fixed priorities -- write events precede exception
 //  events precede read events precede timed tasks.
 //
 //  USE: There are no instances of Scheduler; all its interface
 //  routines are static, and are called, e.g., "Scheduler::loop();"
-//
-//  RESTRICTIONS: Because we currently need only a single recurring
-//  task, multiple recurring tasks are not implemented.
 
 class Scheduler {
 
@@ -60,18 +86,27 @@ public:
 
     typedef void (*IOHandler)(int fd, void *closure);
     typedef void (*TimedProc)(void *closure);
+    typedef unsigned long TaskID;	// 0 is never a valid TaskID
 
-    //  One-time tasks.
+    //  One-time tasks.  A timeval is a time of day; a timespec is a
+    //  time on the Scheduler's clock, which setting the time of day
+    //  doesn't move.
 
-    static void install_onetime_task(const timeval& when,
-				     TimedProc, void *closure);
-    static void remove_onetime_task(TimedProc, void *closure);
+    static timespec clock();
+    static TaskID install_onetime_task(const timeval& when,
+				       TimedProc, void *closure);
+    static TaskID install_onetime_task(const timespec& when,
+				       TimedProc, void *closure);
+    static void remove_onetime_task(TaskID id)	{ remove_task(id); }
 
     //  Recurring tasks.
 
-    static void install_recurring_task(const timeval& interval,
-				       TimedProc, void *closure);
-    static void remove_recurring_task(TimedProc, void *closure);
+    static TaskID install_recurring_task(const timeval& interval,
+					 TimedProc, void *closure);
+    static TaskID install_recurring_task(const timespec& interval,
+					 const timespec& phase,
+					 TimedProc, void *closure);
+    static void remove_recurring_task(TaskID id)	{ remove_task(id); }
 
     //  I/O handlers.
 
@@ -81,6 +116,11 @@ public:
     static IOHandler install_write_handler(int fd, IOHandler, void *closure);
     static IOHandler remove_write_handler(int fd);
 
+    //  The highest descriptor number the backend can handle, plus one,
+    //  or 0 if it has no limit.
+
+    static unsigned int max_fds();
+
     //  Mainline code.
 
     static void select();
@@ -100,40 +140,48 @@ private:
 	} read, write;
     };
 
-    //  Per-I/O type info is the file descriptor set passed to select(),
-    //  the number of bits set there, and the offset into the FDInfo
-    //  for the corresponding I/O type.
+    //  An IOType is the offset into the FDInfo for an I/O type.
 
-    struct IOTypeInfo {
-	FDInfo::FDIOHandler FDInfo::* iotype;
-	unsigned int nbitsset;		// number of bits set in fds
-	fd_set fds;
-	IOTypeInfo(FDInfo::FDIOHandler FDInfo::* a_iotype) :
-            iotype(a_iotype), nbitsset(0) { FD_ZERO(&fds); }
-    };
+    typedef FDInfo::FDIOHandler FDInfo::* IOType;
+
+    //  Timed tasks live in the tasks array, and are ordered by a
+    //  binary heap of indices into that array.  Each task knows its
+    //  position in the heap, so it can be removed without a search.
+    //  Free task slots are chained through heap_index.  Times are
+    //  nanoseconds on the monotonic clock.
+    //
+    //  A TaskID is a slot number plus one in the low half, and the
+    //  slot's generation number in the high half.  The generation is
+    //  incremented each time the slot is freed, so a stale TaskID
+    //  doesn't match the slot's next occupant.
+
+    enum { SLOT_BITS = sizeof (TaskID) * 4 };
 
-    struct onetime_task {
-	onetime_task *next;
-	timeval when;
-	Scheduler::TimedProc proc;
+    typedef long long Nanosecs;
+
+    struct timed_task {
+	Nanosecs when;
+	Nanosecs interval;		// zero for onetime tasks
+	Scheduler::TimedProc proc;	// NULL if slot is free
 	void *closure;
+	TaskID generation;
+	unsigned int heap_index;
     };
 
     // I/O event related variables
 
-    static IOTypeInfo read, write;
     static FDInfo *fdinfo;
     static unsigned int nfds;
     static unsigned int nfdinfo_alloc;
 
     // Timed task related variables
 
-    static unsigned int ntasks;
-    static timeval next_task_time;
-    static TimedProc recurring_proc;
-    static void *recurring_closure;
-    static timeval recurring_interval;
-    static onetime_task *first_task;
+    static timed_task *tasks;
+    static unsigned int ntasks_alloc;
+    static unsigned int free_task;
+    static unsigned int *heap;
+    static unsigned int heap_size;
+    static Nanosecs tasks_time;		// when do_tasks started, or zero
     static bool running;
 
     // I/O event related functions
@@ -142,12 +190,29 @@ private:
     static void trim_fdinfo();
     static IOHandler install_io_handler(int fd,
 					IOHandler handler, void *closure,
-					IOTypeInfo *iotype);
-    static IOHandler remove_io_handler(int fd, IOTypeInfo *iotype);
-    static void handle_io(const fd_set *fds, FDInfo::FDIOHandler FDInfo::* iotype);
+					IOType iotype);
+    static IOHandler remove_io_handler(int fd, IOType iotype);
+    static void handle_io(int fd, IOType iotype);
+
+    // Readiness backend functions
+
+    static void io_watch(int fd, bool readable, bool writable);
+    static void io_wait(timeval *timeout);
 
     // Timed task related functions
 
+    static Nanosecs now();
+    static TaskID install_task(Nanosecs when, Nanosecs interval,
+			       TimedProc, void *closure);
+    static void remove_task(TaskID);
+    static TaskID task_id(unsigned int slot);
+    static unsigned int alloc_task();
+    static void free_task_slot(unsigned int slot);
+    static bool heap_less(unsigned int i, unsigned int j);
+    static void heap_swap(unsigned int i, unsigned int j);
+    static void heap_up(unsigned int i);
+    static void heap_down(unsigned int i);
+    static void heap_remove(unsigned int i);
     static void do_tasks();
     static timeval *calc_timeout();
 
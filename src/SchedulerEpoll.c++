@@ -0,0 +1,123 @@
+//  Copyright (C) 1999 Silicon Graphics, Inc.  All Rights Reserved.
+//  
+//  This program is free software; you can redistribute it and/or modify it
+//  under the terms of version 2 of the GNU General Public License as
+//  published by the Free Software Foundation.
+//
+//  This program is distributed in the hope that it would be useful, but
+//  WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  Further, any
+//  license provided herein, whether implied or otherwise, is limited to
+//  this program in accordance with the express provisions of the GNU
+//  General Public License.  Patent licenses, if any, provided herein do not
+//  apply to combinations of this program with other product or programs, or
+//  any other product whatsoever.  This program is distributed without any
+//  warranty that the program is delivered free of the rightful claim of any
+//  third person by way of infringement or the like.  See the GNU General
+//  Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License along
+//  with this program; if not, write the Free Software Foundation, Inc., 59
+//  Temple Place - Suite 330, Boston MA 02111-1307, USA.
+
+#include "Scheduler.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+
+#include "Log.h"
+
+//  This readiness backend uses epoll(7).  The kernel keeps the set of
+//  descriptors we're interested in, so a wait costs time proportional
+//  to the number of ready descriptors, and there is no limit on the
+//  descriptor numbers we can handle.
+//
+//  The epoll set is level triggered, so if more descriptors are ready
+//  than fit in the event buffer, the rest are reported on the next
+//  pass.
+
+enum { MAXEVENTS = 1024 };
+
+static int epfd = -1;
+static epoll_event ready_events[MAXEVENTS];
+
+static int
+epoll_fd()
+{
+    if (epfd < 0)
+    {   epfd = epoll_create(MAXEVENTS);
+	if (epfd < 0)
+	{   Log::perror("epoll_create");
+	    exit(1);
+	}
+	(void) fcntl(epfd, F_SETFD, FD_CLOEXEC);
+    }
+    return epfd;
+}
+
+unsigned int
+Scheduler::max_fds()
+{
+    return 0;
+}
+
+void
+Scheduler::io_watch(int fd, bool readable, bool writable)
+{
+    //  Try to modify an existing registration first.  If the descriptor
+    //  isn't registered yet (or it's been closed and its number reused),
+    //  add it.
+
+    epoll_event ev;
+    memset(&ev, 0, sizeof ev);
+    ev.events = (readable ? EPOLLIN : 0) | (writable ? EPOLLOUT : 0);
+    ev.data.fd = fd;
+
+    int rc;
+    if (!readable && !writable)
+    {   rc = epoll_ctl(epoll_fd(), EPOLL_CTL_DEL, fd, &ev);
+	if (rc < 0 && (errno == ENOENT || errno == EBADF))
+	    rc = 0;			// already gone
+    }
+    else
+    {   rc = epoll_ctl(epoll_fd(), EPOLL_CTL_MOD, fd, &ev);
+	if (rc < 0 && errno == ENOENT)
+	    rc = epoll_ctl(epoll_fd(), EPOLL_CTL_ADD, fd, &ev);
+    }
+    if (rc < 0)
+	Log::perror("epoll_ctl on descriptor %d", fd);
+}
+
+void
+Scheduler::io_wait(timeval *timeout)
+{
+    //  Round the timeout up to the next millisecond so we don't wake
+    //  up just before a task is due and spin.
+
+    int ms = -1;
+    if (timeout)
+	ms = timeout->tv_sec * 1000 + (timeout->tv_usec + 999) / 1000;
+
+    int nready = epoll_wait(epoll_fd(), ready_events, MAXEVENTS, ms);
+
+    if (nready == -1 && errno != EINTR)
+    {   Log::perror("epoll_wait");	// Oh, no!
+	::exit(1);
+    }
+
+    //  Errors and hangups are reported as both readable and writable,
+    //  like select() does.  Writes first.
+
+    int i;
+    for (i = 0; i < nready; i++)
+	if (ready_events[i].events & (EPOLLOUT | EPOLLERR | EPOLLHUP))
+	    handle_io(ready_events[i].data.fd, &FDInfo::write);
+    for (i = 0; i < nready; i++)
+	if (ready_events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP))
+	    handle_io(ready_events[i].data.fd, &FDInfo::read);
+}
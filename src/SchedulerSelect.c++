@@ -0,0 +1,89 @@
+//  Copyright (C) 1999 Silicon Graphics, Inc.  All Rights Reserved.
+//  
+//  This program is free software; you can redistribute it and/or modify it
+//  under the terms of version 2 of the GNU General Public License as
+//  published by the Free Software Foundation.
+//
+//  This program is distributed in the hope that it would be useful, but
+//  WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  Further, any
+//  license provided herein, whether implied or otherwise, is limited to
+//  this program in accordance with the express provisions of the GNU
+//  General Public License.  Patent licenses, if any, provided herein do not
+//  apply to combinations of this program with other product or programs, or
+//  any other product whatsoever.  This program is distributed without any
+//  warranty that the program is delivered free of the rightful claim of any
+//  third person by way of infringement or the like.  See the GNU General
+//  Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License along
+//  with this program; if not, write the Free Software Foundation, Inc., 59
+//  Temple Place - Suite 330, Boston MA 02111-1307, USA.
+
+#include "Scheduler.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#if HAVE_SYS_SELECT_H
+#include <sys/select.h>
+#endif
+
+#include "Log.h"
+
+//  This readiness backend uses select(2).  It keeps one descriptor
+//  set for each I/O type, and on each pass it tests every descriptor
+//  up to the highest one that has a handler.
+
+static fd_set read_fds, write_fds;
+
+unsigned int
+Scheduler::max_fds()
+{
+    return FD_SETSIZE;
+}
+
+void
+Scheduler::io_watch(int fd, bool readable, bool writable)
+{
+    if (fd >= FD_SETSIZE)
+    {   Log::error("descriptor %d is beyond FD_SETSIZE (%d), ignoring it",
+		   fd, FD_SETSIZE);
+	return;
+    }
+    if (readable)
+	FD_SET(fd, &read_fds);
+    else
+	FD_CLR(fd, &read_fds);
+    if (writable)
+	FD_SET(fd, &write_fds);
+    else
+	FD_CLR(fd, &write_fds);
+}
+
+void
+Scheduler::io_wait(timeval *timeout)
+{
+    fd_set readfds = read_fds, writefds = write_fds;
+    unsigned int n = nfds < FD_SETSIZE ? nfds : FD_SETSIZE;
+
+    int status = ::select(n, &readfds, &writefds, 0, timeout);
+
+    if (status == -1 && errno != EINTR)
+    {   Log::perror("select");		// Oh, no!
+	::exit(1);
+    }
+    if (status > 0)
+    {
+	// I/O is ready -- find it and do it.  Writes first.
+
+	int fd;
+	for (fd = 0; fd < n; fd++)
+	    if (FD_ISSET(fd, &writefds))
+		handle_io(fd, &FDInfo::write);
+	for (fd = 0; fd < n; fd++)
+	    if (FD_ISSET(fd, &readfds))
+		handle_io(fd, &FDInfo::read);
+    }
+}
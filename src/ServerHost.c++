@@ -44,7 +44,7 @@ ServerHost::ServerHost(const hostent& hent)
     : refcount(0), connector(Listener::FAMPROG, Listener::FAMVERS,
 		((in_addr *) hent.h_addr)->s_addr, connect_handler, this),
       connection(NULL), unique_request(1), deferred_scans(NULL), last(NULL),
-      min_time(0)
+      min_time(0), deferred_scan_taskid(0), timeout_taskid(0)
 {
     // Save first component of full hostname.
 
@@ -63,10 +63,10 @@ ServerHost::ServerHost(const hostent& hent)
 ServerHost::~ServerHost()
 {
     assert(!active());
-    Scheduler::remove_onetime_task(deferred_scan_task, this);
+    Scheduler::remove_onetime_task(deferred_scan_taskid);
     if (is_connected())
     {	delete connection;
-	Scheduler::remove_onetime_task(timeout_task, this);
+	Scheduler::remove_onetime_task(timeout_taskid);
     }
     else
 	Pollster::forget(this);
@@ -88,7 +88,7 @@ void
 ServerHost::activate()
 {
     if (is_connected())
-        Scheduler::remove_onetime_task(timeout_task, this);
+        Scheduler::remove_onetime_task(timeout_taskid);
     else
     {   connector.activate();
 	Pollster::watch(this);
@@ -103,7 +103,7 @@ ServerHost::deactivate()
     {   timeval t;
 	(void) gettimeofday(&t, NULL);
 	t.tv_sec += Pollster::interval();
-	Scheduler::install_onetime_task(t, timeout_task, this);
+	timeout_taskid = Scheduler::install_onetime_task(t, timeout_task, this);
     }
     else
     {   connector.deactivate();
@@ -174,7 +174,7 @@ ServerHost::disconnect_handler(void *closure)
         // We're in the timeout period waiting to close the
         // connection.  Remove the timeout callback and don't poll
         // this host
-        Scheduler::remove_onetime_task(timeout_task, host);
+        Scheduler::remove_onetime_task(host->timeout_taskid);
         delete host->connection;
         host->connection = NULL;
     }
@@ -283,10 +283,11 @@ ServerHost::defer_scan(int when, int retries, Request r, const char *path)
     //  or we didn't have any task scheduled at all, tell the scheduler.
     if (!min_time || then < min_time)
     {	if (min_time)
-	    Scheduler::remove_onetime_task(deferred_scan_task, this);
+	    Scheduler::remove_onetime_task(deferred_scan_taskid);
 	min_time = then;
 	timeval t = { then, 0 };
-	Scheduler::install_onetime_task(t, deferred_scan_task, this);
+	deferred_scan_taskid =
+	    Scheduler::install_onetime_task(t, deferred_scan_task, this);
     }
 }
 
@@ -334,7 +335,8 @@ ServerHost::deferred_scan_task(void *closure)
         //  We still have some deferred scans which need to happen later.
         min_time = ds->when;
         timeval t = { ds->when, 0 };
-        Scheduler::install_onetime_task(t, deferred_scan_task, host);
+        host->deferred_scan_taskid =
+            Scheduler::install_onetime_task(t, deferred_scan_task, host);
     }
     else min_time = 0;
 }
@@ -403,9 +405,20 @@ ServerHost::send_resume(Request r)
 //////////////////////////////////////////////////////////////////////////////
 //  Polling
 
-void
-ServerHost::poll()
+//  poll polls the requests on this host, except those on a slow
+//  FileSystem that isn't to be polled on the Pollster's pass'th pass.
+//  It returns how many requests it polled.
+
+unsigned
+ServerHost::poll(unsigned pass)
 {
+    unsigned n = 0;
     for (Request r = requests.first(); r; r = requests.next(r))
-	requests.find(r)->poll();
+    {   ClientInterest *cip = requests.find(r);
+	if (cip->filesystem()->polled_on_pass(pass))
+	{   cip->poll();
+	    n++;
+	}
+    }
+    return n;
 }
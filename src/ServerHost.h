@@ -75,7 +75,7 @@ public:
     void send_suspend(Request);
     void send_resume(Request);
 
-    void poll();
+    unsigned poll(unsigned pass);
 
 private:
 
@@ -118,6 +118,8 @@ private:
     DeferredScan *deferred_scans;
     DeferredScan *last;
     int min_time;
+    Scheduler::TaskID deferred_scan_taskid;
+    Scheduler::TaskID timeout_taskid;
 
     //  Private Instance Methods
 
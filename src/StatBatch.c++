@@ -0,0 +1,243 @@
+//  Copyright (C) 1999 Silicon Graphics, Inc.  All Rights Reserved.
+//  
+//  This program is free software; you can redistribute it and/or modify it
+//  under the terms of version 2 of the GNU General Public License as
+//  published by the Free Software Foundation.
+//
+//  This program is distributed in the hope that it would be useful, but
+//  WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  Further, any
+//  license provided herein, whether implied or otherwise, is limited to
+//  this program in accordance with the express provisions of the GNU
+//  General Public License.  Patent licenses, if any, provided herein do not
+//  apply to combinations of this program with other product or programs, or
+//  any other product whatsoever.  This program is distributed without any
+//  warranty that the program is delivered free of the rightful claim of any
+//  third person by way of infringement or the like.  See the GNU General
+//  Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License along
+//  with this program; if not, write the Free Software Foundation, Inc., 59
+//  Temple Place - Suite 330, Boston MA 02111-1307, USA.
+
+#include "config.h"
+#include "StatBatch.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#if HAVE_LINUX_IO_URING_H && HAVE_STATX
+#define USE_IO_URING 1
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+#include "Interest.h"
+#include "Log.h"
+#include "Stats.h"
+
+bool	StatBatch::ring_tried;
+int	StatBatch::ring_fd = -1;
+
+static Stats::Counter batched_stats("batched stats");
+static Stats::Counter ring_stats("io_uring stats");
+
+void
+StatBatch::stat(int dirfd, unsigned n, const char *const names[],
+		struct stat statuses[], int errors[], bool cached_ok)
+{
+    assert(n <= MAX_BATCH);
+    batched_stats += n;
+    if (ring_stat(dirfd, n, names, statuses, errors, cached_ok))
+	return;
+    for (unsigned i = 0; i < n; i++)
+	errors[i] = Interest::stat_file(dirfd, names[i], &statuses[i],
+					cached_ok) < 0 ? errno : 0;
+}
+
+#if USE_IO_URING
+
+//  The ring's memory, shared with the kernel, as io_uring_setup(2)
+//  lays it out.  We're the only submitter and the only reaper, so
+//  only the indices the kernel moves need atomic loads.
+//
+//  The statx buffers are static, not on the stack: if the ring has to
+//  be torn down with requests in flight, the kernel may still write
+//  into them.
+
+static struct {
+    void *sq_map, *cq_map;
+    size_t sq_size, cq_size;
+    struct io_uring_sqe *sqes;
+    size_t sqes_size;
+    unsigned *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_cqe *cqes;
+} ring;
+
+static struct statx statxes[StatBatch::MAX_BATCH];
+
+static void
+close_ring(int& fd)
+{
+    if (ring.sqes)
+	(void) munmap(ring.sqes, ring.sqes_size);
+    if (ring.cq_map && ring.cq_map != ring.sq_map)
+	(void) munmap(ring.cq_map, ring.cq_size);
+    if (ring.sq_map)
+	(void) munmap(ring.sq_map, ring.sq_size);
+    memset(&ring, 0, sizeof ring);
+    (void) close(fd);
+    fd = -1;
+}
+
+bool
+StatBatch::setup_ring()
+{
+    ring_tried = true;
+    struct io_uring_params p;
+    memset(&p, 0, sizeof p);
+    ring_fd = syscall(__NR_io_uring_setup, MAX_BATCH, &p);
+    if (ring_fd < 0)
+    {   Log::debug("can't set up io_uring: %s; stat'ing one at a time",
+		   strerror(errno));
+	return false;
+    }
+    (void) fcntl(ring_fd, F_SETFD, FD_CLOEXEC);
+
+    ring.sq_size = p.sq_off.array + p.sq_entries * sizeof (unsigned);
+    ring.cq_size = p.cq_off.cqes + p.cq_entries * sizeof (struct io_uring_cqe);
+    bool single = p.features & IORING_FEAT_SINGLE_MMAP;
+    if (single && ring.cq_size > ring.sq_size)
+	ring.sq_size = ring.cq_size;
+    ring.sqes_size = p.sq_entries * sizeof (struct io_uring_sqe);
+
+    void *sq = mmap(NULL, ring.sq_size, PROT_READ | PROT_WRITE,
+		    MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+    ring.sq_map = sq == MAP_FAILED ? NULL : sq;
+    void *cq = sq;
+    if (!single && ring.sq_map)
+	cq = mmap(NULL, ring.cq_size, PROT_READ | PROT_WRITE,
+		  MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_CQ_RING);
+    ring.cq_map = cq == MAP_FAILED ? NULL : cq;
+    void *sqes = MAP_FAILED;
+    if (ring.cq_map)
+	sqes = mmap(NULL, ring.sqes_size, PROT_READ | PROT_WRITE,
+		    MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED)
+    {   Log::perror("can't map io_uring");
+	close_ring(ring_fd);
+	return false;
+    }
+    ring.sqes = (struct io_uring_sqe *) sqes;
+
+    char *sqp = (char *) ring.sq_map, *cqp = (char *) ring.cq_map;
+    ring.sq_tail = (unsigned *) (sqp + p.sq_off.tail);
+    ring.sq_mask = (unsigned *) (sqp + p.sq_off.ring_mask);
+    ring.sq_array = (unsigned *) (sqp + p.sq_off.array);
+    ring.cq_head = (unsigned *) (cqp + p.cq_off.head);
+    ring.cq_tail = (unsigned *) (cqp + p.cq_off.tail);
+    ring.cq_mask = (unsigned *) (cqp + p.cq_off.ring_mask);
+    ring.cqes = (struct io_uring_cqe *) (cqp + p.cq_off.cqes);
+    Log::debug("stat'ing directory entries through io_uring");
+    return true;
+}
+
+//  ring_stat submits a statx for each name, then waits for them all.
+//  Returns false if there's no ring, so the caller should stat the
+//  names itself.  A kernel too old to statx through io_uring fails
+//  each request with EINVAL; then the ring is given up on and those
+//  names are stat'd here.
+
+bool
+StatBatch::ring_stat(int dirfd, unsigned n, const char *const names[],
+		     struct stat statuses[], int errors[], bool cached_ok)
+{
+    if (!ring_tried)
+	(void) setup_ring();
+    if (ring_fd < 0)
+	return false;
+
+    int flags = AT_SYMLINK_NOFOLLOW;
+    flags |= cached_ok ? AT_STATX_DONT_SYNC : AT_STATX_SYNC_AS_STAT;
+    unsigned tail = *ring.sq_tail, mask = *ring.sq_mask;
+    for (unsigned i = 0; i < n; i++, tail++)
+    {   unsigned index = tail & mask;
+	struct io_uring_sqe *sqe = &ring.sqes[index];
+	memset(sqe, 0, sizeof *sqe);
+	sqe->opcode = IORING_OP_STATX;
+	sqe->fd = dirfd;
+	sqe->addr = (unsigned long) names[i];
+	sqe->len = Interest::statx_mask;
+	sqe->off = (unsigned long) &statxes[i];
+	sqe->statx_flags = flags;
+	sqe->user_data = i;
+	ring.sq_array[index] = index;
+    }
+    __atomic_store_n(ring.sq_tail, tail, __ATOMIC_RELEASE);
+
+    unsigned to_submit = n, reaped = 0;
+    bool unsupported = false;
+    while (reaped < n)
+    {   int rc = syscall(__NR_io_uring_enter, ring_fd, to_submit,
+			 n - reaped, IORING_ENTER_GETEVENTS, NULL, 0);
+	if (rc < 0)
+	{   if (errno == EINTR || errno == EAGAIN)
+		continue;
+	    Log::perror("io_uring_enter");
+	    close_ring(ring_fd);
+	    return false;
+	}
+	to_submit -= (unsigned) rc < to_submit ? rc : to_submit;
+
+	unsigned head = *ring.cq_head;
+	unsigned cq_tail = __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE);
+	for ( ; head != cq_tail; head++, reaped++)
+	{   const struct io_uring_cqe *cqe = &ring.cqes[head & *ring.cq_mask];
+	    unsigned i = cqe->user_data;
+	    if (cqe->res == 0)
+	    {   Interest::stat_from_statx(&statuses[i], statxes[i]);
+		errors[i] = 0;
+	    }
+	    else if (cqe->res == -EINVAL)
+	    {   unsupported = true;
+		errors[i] = EINVAL;
+	    }
+	    else
+		errors[i] = -cqe->res;
+	}
+	__atomic_store_n(ring.cq_head, head, __ATOMIC_RELEASE);
+    }
+    ring_stats += n;
+
+    if (unsupported)
+    {   Log::debug("io_uring can't statx; stat'ing one at a time");
+	close_ring(ring_fd);
+	for (unsigned i = 0; i < n; i++)
+	    if (errors[i] == EINVAL)
+		errors[i] = Interest::stat_file(dirfd, names[i], &statuses[i],
+						cached_ok) < 0 ? errno : 0;
+    }
+    return true;
+}
+
+#else
+
+bool
+StatBatch::setup_ring()
+{
+    ring_tried = true;
+    return false;
+}
+
+bool
+StatBatch::ring_stat(int, unsigned, const char *const [],
+		     struct stat [], int [], bool)
+{
+    return false;
+}
+
+#endif /* USE_IO_URING */
@@ -0,0 +1,70 @@
+//  Copyright (C) 1999 Silicon Graphics, Inc.  All Rights Reserved.
+//  
+//  This program is free software; you can redistribute it and/or modify it
+//  under the terms of version 2 of the GNU General Public License as
+//  published by the Free Software Foundation.
+//
+//  This program is distributed in the hope that it would be useful, but
+//  WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  Further, any
+//  license provided herein, whether implied or otherwise, is limited to
+//  this program in accordance with the express provisions of the GNU
+//  General Public License.  Patent licenses, if any, provided herein do not
+//  apply to combinations of this program with other product or programs, or
+//  any other product whatsoever.  This program is distributed without any
+//  warranty that the program is delivered free of the rightful claim of any
+//  third person by way of infringement or the like.  See the GNU General
+//  Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License along
+//  with this program; if not, write the Free Software Foundation, Inc., 59
+//  Temple Place - Suite 330, Boston MA 02111-1307, USA.
+
+#ifndef StatBatch_included
+#define StatBatch_included
+
+#include <sys/stat.h>
+
+#include "Boolean.h"
+
+//  StatBatch lstats a batch of names in one directory together.
+//  Where fam was built with io_uring, the lstats are submitted to the
+//  kernel as one batch of statx requests relative to the directory's
+//  descriptor, and reaped together, instead of costing a system call
+//  each.  Without io_uring, or if the kernel won't set up a ring, the
+//  names are stat'd one at a time.
+//
+//  stat() fills in statuses[i] and errors[i] for each names[i]:
+//  errors[i] is zero if the lstat worked, or the errno if it didn't.
+//  At most MAX_BATCH names can be done at once.
+//
+//  StatBatch is not instantiated; its interface is static.
+
+class StatBatch {
+
+public:
+
+    enum { MAX_BATCH = 64 };
+
+    static void stat(int dirfd, unsigned n, const char *const names[],
+		     struct stat statuses[], int errors[], bool cached_ok);
+
+private:
+
+    //  Class Variables
+
+    static bool ring_tried;
+    static int ring_fd;
+
+    //  Private Class Methods
+
+    static bool setup_ring();
+    static bool ring_stat(int dirfd, unsigned n, const char *const names[],
+			  struct stat statuses[], int errors[],
+			  bool cached_ok);
+
+    StatBatch();			// Do not instantiate.
+
+};
+
+#endif /* !StatBatch_included */
@@ -0,0 +1,283 @@
+//  Copyright (C) 1999 Silicon Graphics, Inc.  All Rights Reserved.
+//  
+//  This program is free software; you can redistribute it and/or modify it
+//  under the terms of version 2 of the GNU General Public License as
+//  published by the Free Software Foundation.
+//
+//  This program is distributed in the hope that it would be useful, but
+//  WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  Further, any
+//  license provided herein, whether implied or otherwise, is limited to
+//  this program in accordance with the express provisions of the GNU
+//  General Public License.  Patent licenses, if any, provided herein do not
+//  apply to combinations of this program with other product or programs, or
+//  any other product whatsoever.  This program is distributed without any
+//  warranty that the program is delivered free of the rightful claim of any
+//  third person by way of infringement or the like.  See the GNU General
+//  Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License along
+//  with this program; if not, write the Free Software Foundation, Inc., 59
+//  Temple Place - Suite 330, Boston MA 02111-1307, USA.
+
+#include "config.h"
+#include "StatPool.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#if HAVE_SYS_EVENTFD_H
+#include <sys/eventfd.h>
+#endif
+
+#include "Interest.h"
+#include "Log.h"
+#include "Scheduler.h"
+#include "Stats.h"
+#include "timeval.h"
+
+unsigned	 StatPool::nthreads;
+unsigned	 StatPool::nstarted;
+unsigned	 StatPool::outstanding;
+int		 StatPool::wakefd[2] = { -1, -1 };
+pthread_mutex_t	 StatPool::lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t	 StatPool::work = PTHREAD_COND_INITIALIZER;
+StatPool::Job	*StatPool::queue;
+StatPool::Job  **StatPool::queue_tail = &StatPool::queue;
+StatPool::Job	*StatPool::done;
+StatPool::Job  **StatPool::done_tail = &StatPool::done;
+
+static Stats::Counter pool_stats("pool stats");
+static Stats::Counter pool_full("pool full");
+
+//  threads sets the number of worker threads.  Workers can only be
+//  different users if each can set its own credentials, so without
+//  setfsuid the pool stays off.  Once started, the pool can't shrink.
+
+void
+StatPool::threads(unsigned n)
+{
+#if !HAVE_SETFSUID
+    if (n)
+    {   Log::error("stat threads need setfsuid(2); stat'ing inline");
+	n = 0;
+    }
+#endif
+    if (n < nstarted)
+	n = nstarted;
+    nthreads = n;
+}
+
+//  submit queues an lstat of path as cred.  Returns NULL if the pool
+//  is off, or full, or holding as many of the group's jobs as it may.
+
+StatPool::Job *
+StatPool::submit(const Cred& cred, const char *path, bool cached_ok,
+		 Group *group, DoneProc proc, void *closure)
+{
+    if (!nthreads)
+	return NULL;
+    if (nstarted < nthreads && !start())
+	return NULL;
+    if (outstanding >= MAX_OUTSTANDING || group->outstanding >= MAX_GROUP)
+    {   pool_full++;
+	return NULL;
+    }
+
+    Job *jp = new Job;
+    jp->next = NULL;
+    jp->group = group;
+    jp->cred = cred;
+    (void) strncpy(jp->path, path, sizeof jp->path - 1);
+    jp->path[sizeof jp->path - 1] = '\0';
+    jp->cached_ok = cached_ok;
+    jp->error = 0;
+    jp->usecs = 0;
+    jp->proc = proc;
+    jp->closure = closure;
+    outstanding++;
+    group->outstanding++;
+    pool_stats++;
+
+    pthread_mutex_lock(&lock);
+    *queue_tail = jp;
+    queue_tail = &jp->next;
+    pthread_cond_signal(&work);
+    pthread_mutex_unlock(&lock);
+    return jp;
+}
+
+//  cancel keeps a job's DoneProc from being called.  The job itself
+//  is freed when it comes back.
+
+void
+StatPool::cancel(Job *jp)
+{
+    jp->proc = NULL;
+}
+
+StatPool::Group *
+StatPool::new_group()
+{
+    return new Group;
+}
+
+//  release frees the group, unless it still has jobs out; then the
+//  last one frees it.
+
+void
+StatPool::release(Group *group)
+{
+    if (group->outstanding)
+	group->released = true;
+    else
+	delete group;
+}
+
+//  start creates the eventfd and whatever threads haven't been
+//  started yet.  The workers block every signal, so signals are
+//  still delivered to the main thread.
+
+bool
+StatPool::start()
+{
+    if (wakefd[0] < 0)
+    {
+#if HAVE_SYS_EVENTFD_H
+	wakefd[0] = wakefd[1] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (wakefd[0] < 0)
+#else
+	if (pipe(wakefd) < 0)
+#endif
+	{   Log::perror("can't create stat pool's wakeup descriptor");
+	    nthreads = nstarted;
+	    return false;
+	}
+#if !HAVE_SYS_EVENTFD_H
+	for (int i = 0; i < 2; i++)
+	{   (void) fcntl(wakefd[i], F_SETFL, O_NONBLOCK);
+	    (void) fcntl(wakefd[i], F_SETFD, FD_CLOEXEC);
+	}
+#endif
+	(void) Scheduler::install_read_handler(wakefd[0], done_handler, NULL);
+    }
+
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    while (nstarted < nthreads)
+    {   pthread_t thread;
+	int rc = pthread_create(&thread, NULL, worker, NULL);
+	if (rc)
+	{   errno = rc;
+	    Log::perror("can't start stat thread");
+	    nthreads = nstarted;
+	    break;
+	}
+	(void) pthread_detach(thread);
+	nstarted++;
+    }
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    Log::debug("%u stat thread%s running", nstarted, nstarted == 1 ? "" : "s");
+    return nstarted != 0;
+}
+
+//  next_job takes the oldest job whose group can have another one
+//  running, or returns NULL if there's none.  Called with lock held.
+
+StatPool::Job *
+StatPool::next_job()
+{
+    Job **jpp = &queue;
+    while (*jpp && (*jpp)->group->running >= per_group())
+	jpp = &(*jpp)->next;
+    Job *jp = *jpp;
+    if (jp)
+    {   *jpp = jp->next;
+	if (!*jpp)
+	    queue_tail = jpp;
+	jp->group->running++;
+    }
+    return jp;
+}
+
+//  worker is a worker thread.  It takes jobs off the queue, stats
+//  them, and puts them on the done list, waking the main thread if
+//  the list was empty.  A job held back for its group may run once
+//  this one's done, so another worker is woken then too.
+
+void *
+StatPool::worker(void *)
+{
+    for (;;)
+    {   pthread_mutex_lock(&lock);
+	Job *jp;
+	while (!(jp = next_job()))
+	    pthread_cond_wait(&work, &lock);
+	pthread_mutex_unlock(&lock);
+
+	jp->cred.become_user();
+	timeval t0, t1;
+	(void) gettimeofday(&t0, NULL);
+	if (Interest::stat_file(AT_FDCWD, jp->path, &jp->status,
+				jp->cached_ok) < 0)
+	    jp->error = errno;
+	(void) gettimeofday(&t1, NULL);
+	timeval t = t1 - t0;
+	jp->usecs = t.tv_sec < 0 ? 0 : t.tv_sec * 1000000UL + t.tv_usec;
+
+	pthread_mutex_lock(&lock);
+	if (jp->group->running-- == per_group() && queue)
+	    pthread_cond_signal(&work);
+	bool wake = !done;
+	jp->next = NULL;
+	*done_tail = jp;
+	done_tail = &jp->next;
+	pthread_mutex_unlock(&lock);
+
+	if (wake)
+	{
+#if HAVE_SYS_EVENTFD_H
+	    uint64_t one = 1;
+#else
+	    char one = 1;
+#endif
+	    (void) write(wakefd[1], &one, sizeof one);
+	}
+    }
+    return NULL;
+}
+
+//  done_handler runs on the main thread.  It takes every finished
+//  job and calls its DoneProc, in the order the jobs finished.  A
+//  DoneProc may submit or cancel other jobs.
+
+void
+StatPool::done_handler(int fd, void *)
+{
+    char buf[64];
+    while (read(fd, buf, sizeof buf) > 0)
+	continue;
+
+    pthread_mutex_lock(&lock);
+    Job *list = done;
+    done = NULL;
+    done_tail = &done;
+    pthread_mutex_unlock(&lock);
+
+    while (list)
+    {   Job *jp = list;
+	list = jp->next;
+	outstanding--;
+	if (jp->proc)
+	    (*jp->proc)(jp->error ? NULL : &jp->status, jp->error,
+			jp->usecs, jp->closure);
+	Group *group = jp->group;
+	if (!--group->outstanding && group->released)
+	    delete group;
+	delete jp;
+    }
+}
@@ -0,0 +1,145 @@
+//  Copyright (C) 1999 Silicon Graphics, Inc.  All Rights Reserved.
+//  
+//  This program is free software; you can redistribute it and/or modify it
+//  under the terms of version 2 of the GNU General Public License as
+//  published by the Free Software Foundation.
+//
+//  This program is distributed in the hope that it would be useful, but
+//  WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  Further, any
+//  license provided herein, whether implied or otherwise, is limited to
+//  this program in accordance with the express provisions of the GNU
+//  General Public License.  Patent licenses, if any, provided herein do not
+//  apply to combinations of this program with other product or programs, or
+//  any other product whatsoever.  This program is distributed without any
+//  warranty that the program is delivered free of the rightful claim of any
+//  third person by way of infringement or the like.  See the GNU General
+//  Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License along
+//  with this program; if not, write the Free Software Foundation, Inc., 59
+//  Temple Place - Suite 330, Boston MA 02111-1307, USA.
+
+#ifndef StatPool_included
+#define StatPool_included
+
+#include <pthread.h>
+#include <sys/param.h>
+#include <sys/stat.h>
+
+#include "Boolean.h"
+#include "Cred.h"
+
+//  StatPool runs lstats on a few worker threads, so a slow or hung
+//  filesystem only holds up the threads stat'ing it, not all of fam.
+//
+//  submit() queues an lstat of a path as a user.  A worker takes the
+//  user's credentials for itself alone (setfsuid and setfsgid don't
+//  touch the other threads), does the lstat, and puts the job on the
+//  completion queue.  The completion queue is signalled through an
+//  eventfd that the Scheduler watches, so the job's DoneProc is
+//  called on the main thread, like every other handler in fam, with
+//  the lstat's result and how long it took in microseconds.  Nothing
+//  but the lstat itself happens on a worker.
+//
+//  Jobs are bounded.  When too many are outstanding, submit() returns
+//  NULL and the caller decides whether to wait or stat inline.  A job
+//  that's cancelled still runs, but its DoneProc is not called.
+//
+//  Each job belongs to a Group, one per filesystem.  No more than
+//  all but one of the threads run a Group's jobs at once, and only
+//  MAX_GROUP of its jobs may be outstanding, so a hung filesystem
+//  can tie up neither every thread nor the whole queue.  A Group is
+//  made by new_group() and freed once release() has been called and
+//  its last job is done.
+//
+//  The number of threads comes from the stat_threads option in
+//  fam.conf.  With zero threads, the pool is off and everyone stats
+//  inline as before.  The threads are started by the first submit(),
+//  after fam has become a daemon.
+//
+//  StatPool is not instantiated; its interface is static.
+
+class StatPool {
+
+public:
+
+    typedef void (*DoneProc)(const struct stat *, int error,
+			     unsigned long usecs, void *closure);
+
+    class Job;
+    class Group;
+
+    static void threads(unsigned n);
+    static unsigned threads()		{ return nthreads; }
+    static bool enabled()		{ return nthreads != 0; }
+
+    static Job *submit(const Cred&, const char *path, bool cached_ok,
+		       Group *, DoneProc, void *closure);
+    static void cancel(Job *);
+    static Group *new_group();
+    static void release(Group *);
+
+    class Group {
+
+    private:
+
+	unsigned outstanding;		// submitted and not yet done
+	unsigned running;		// on a thread now; under lock
+	bool released;
+
+	Group()				: outstanding(0), running(0),
+					  released(false) { }
+
+    friend class StatPool;
+
+    };
+
+    class Job {
+
+    private:
+
+	Job *next;
+	Group *group;
+	Cred cred;
+	char path[MAXPATHLEN];
+	bool cached_ok;
+	struct stat status;
+	int error;
+	unsigned long usecs;
+	DoneProc proc;			// NULL if cancelled
+	void *closure;
+
+    friend class StatPool;
+
+    };
+
+private:
+
+    enum { MAX_OUTSTANDING = 1024, MAX_GROUP = 256 };
+
+    //  Class Variables
+
+    static unsigned nthreads;
+    static unsigned nstarted;
+    static unsigned outstanding;	// submitted and not yet done
+    static int wakefd[2];
+    static pthread_mutex_t lock;
+    static pthread_cond_t work;
+    static Job *queue, **queue_tail;	// waiting for a thread
+    static Job *done, **done_tail;	// waiting for the main thread
+
+    //  Private Class Methods
+
+    static bool start();
+    static unsigned per_group()		{ return nthreads > 1 ? nthreads - 1
+							      : 1; }
+    static Job *next_job();
+    static void *worker(void *);
+    static void done_handler(int fd, void *closure);
+
+    StatPool();				// Do not instantiate.
+
+};
+
+#endif /* !StatPool_included */
@@ -0,0 +1,106 @@
+//  Copyright (C) 1999 Silicon Graphics, Inc.  All Rights Reserved.
+//  
+//  This program is free software; you can redistribute it and/or modify it
+//  under the terms of version 2 of the GNU General Public License as
+//  published by the Free Software Foundation.
+//
+//  This program is distributed in the hope that it would be useful, but
+//  WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  Further, any
+//  license provided herein, whether implied or otherwise, is limited to
+//  this program in accordance with the express provisions of the GNU
+//  General Public License.  Patent licenses, if any, provided herein do not
+//  apply to combinations of this program with other product or programs, or
+//  any other product whatsoever.  This program is distributed without any
+//  warranty that the program is delivered free of the rightful claim of any
+//  third person by way of infringement or the like.  See the GNU General
+//  Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License along
+//  with this program; if not, write the Free Software Foundation, Inc., 59
+//  Temple Place - Suite 330, Boston MA 02111-1307, USA.
+
+#include "Stats.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "Log.h"
+
+//  counters and histograms are zero before any constructor runs, so
+//  Counters and Histograms can be defined in any file.
+
+Stats::Counter		*Stats::counters;
+Stats::Histogram	*Stats::histograms;
+Scheduler::TaskID	 Stats::report_taskid;
+
+Stats::Counter::Counter(const char *name)
+    : myname(name), count(0), next(counters)
+{
+    counters = this;
+}
+
+Stats::Histogram::Histogram(const char *name)
+    : myname(name), next(histograms)
+{
+    memset(bucket, 0, sizeof bucket);
+    histograms = this;
+}
+
+//  Value v goes in bucket 0 if it's zero, otherwise in the bucket
+//  one past its highest set bit.
+
+void
+Stats::Histogram::add(unsigned long v)
+{
+    unsigned b = 0;
+    while (v)
+    {   b++;
+	v >>= 1;
+    }
+    bucket[b]++;
+}
+
+void
+Stats::report()
+{
+    for (Counter *cp = counters; cp; cp = cp->next)
+	Log::log(Log::INFO, "stats: %s %lu", cp->myname, cp->count);
+    for (Histogram *hp = histograms; hp; hp = hp->next)
+    {   char buf[1024];
+	size_t len = 0;
+	for (unsigned b = 0; b < Histogram::NBUCKETS; b++)
+	    if (hp->bucket[b] && len < sizeof buf - 1)
+	    {   int n;
+		if (b < 8 * sizeof (unsigned long))
+		    n = snprintf(buf + len, sizeof buf - len, " <%lu:%lu",
+				 1UL << b, hp->bucket[b]);
+		else
+		    n = snprintf(buf + len, sizeof buf - len, " big:%lu",
+				 hp->bucket[b]);
+		if (n > 0)
+		    len += n;
+		if (len > sizeof buf - 1)	// truncated
+		    len = sizeof buf - 1;
+	    }
+	Log::log(Log::INFO, "stats: %s%s", hp->myname, len ? buf : " none");
+    }
+}
+
+void
+Stats::report_every(unsigned secs)
+{
+    Scheduler::remove_recurring_task(report_taskid);
+    report_taskid = 0;
+    if (secs)
+    {   timeval interval = { secs, 0 };
+	report_taskid = Scheduler::install_recurring_task(interval,
+							  report_task, NULL);
+    }
+}
+
+void
+Stats::report_task(void *)
+{
+    report();
+}
@@ -0,0 +1,102 @@
+//  Copyright (C) 1999 Silicon Graphics, Inc.  All Rights Reserved.
+//  
+//  This program is free software; you can redistribute it and/or modify it
+//  under the terms of version 2 of the GNU General Public License as
+//  published by the Free Software Foundation.
+//
+//  This program is distributed in the hope that it would be useful, but
+//  WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  Further, any
+//  license provided herein, whether implied or otherwise, is limited to
+//  this program in accordance with the express provisions of the GNU
+//  General Public License.  Patent licenses, if any, provided herein do not
+//  apply to combinations of this program with other product or programs, or
+//  any other product whatsoever.  This program is distributed without any
+//  warranty that the program is delivered free of the rightful claim of any
+//  third person by way of infringement or the like.  See the GNU General
+//  Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License along
+//  with this program; if not, write the Free Software Foundation, Inc., 59
+//  Temple Place - Suite 330, Boston MA 02111-1307, USA.
+
+#ifndef Stats_included
+#define Stats_included
+
+#include "Boolean.h"
+#include "Scheduler.h"
+
+//  Stats keeps famd's performance counters.  A Stats::Counter is
+//  declared as a static object next to the code it counts, and links
+//  itself onto a list when it's constructed.  report() logs every
+//  counter; report_every() installs a recurring task to do that.
+//  The interval comes from the stats_interval option in fam.conf,
+//  and is zero (no reports) by default.
+//
+//  A Stats::Histogram is declared the same way, and counts values in
+//  power-of-two buckets: 0, 1, 2-3, 4-7, and so on.  It's reported
+//  as the bound and count of each bucket that isn't empty, e.g.
+//  "<16:40" means 40 values from 8 to 15.
+//
+//  Stats is not instantiated; its interface is static.
+
+class Stats {
+
+public:
+
+    class Counter {
+
+    public:
+
+	Counter(const char *name);
+
+	void operator += (unsigned long n)	{ count += n; }
+	void operator ++ (int)			{ count++; }
+	unsigned long value() const		{ return count; }
+
+    private:
+
+	const char *myname;
+	unsigned long count;
+	Counter *next;
+
+    friend class Stats;
+
+    };
+
+    class Histogram {
+
+    public:
+
+	Histogram(const char *name);
+
+	void add(unsigned long);
+
+    private:
+
+	enum { NBUCKETS = 8 * sizeof (unsigned long) + 1 };
+
+	const char *myname;
+	unsigned long bucket[NBUCKETS];
+	Histogram *next;
+
+    friend class Stats;
+
+    };
+
+    static void report();
+    static void report_every(unsigned secs);
+
+private:
+
+    static Counter *counters;
+    static Histogram *histograms;
+    static Scheduler::TaskID report_taskid;
+
+    static void report_task(void *closure);
+
+    Stats();				// Do not instantiate.
+
+};
+
+#endif /* !Stats_included */
@@ -33,6 +33,7 @@
 #include "Event.h"
 #include "Interest.h"
 #include "Log.h"
+#include "Record.h"
 #include "Scanner.h"
 #include "Listener.h"
 
@@ -41,7 +42,8 @@
 
 TCP_Client::TCP_Client(in_addr host, int fd, Cred &cr)
     : MxClient(host), cred(cr), my_scanner(NULL),
-      conn(fd, input_handler, unblock_handler, this),
+      conn(fd, input_handler, record_handler, unblock_handler, name_handler,
+	   this),
       insecure_compat_suggested(false)
 {
     assert(fd >= 0);
@@ -75,6 +77,13 @@ TCP_Client::input_handler(const char *msg, unsigned nbytes, void *closure)
     }
 }
 
+bool
+TCP_Client::record_handler(const Record& record, void *closure)
+{
+    TCP_Client *client = (TCP_Client *) closure;
+    return client->input_record(record);
+}
+
 bool
 TCP_Client::input_msg(const char *msg, int size)
 {
@@ -183,6 +192,73 @@ TCP_Client::input_msg(const char *msg, int size)
 
     // Process the message.
 
+    switch (opcode)
+    {
+    case 'N':				// Client Name
+	Log::debug("%s said: %s is %s, and %s a unix domain socket",
+                   name(), name(), filename,
+                   (got_N_with_groups ? "wants" : "doesn't want"));
+	if (*filename && strcmp(filename, "test"))
+	    name(filename);		// set this client's name
+
+        //  Check to see whether this client wants to switch to a unix
+        //  domain socket.  Create it owned by the uid the client says
+        //  they're running as.
+        if (got_N_with_groups) Listener::create_local_client(*this, uid);
+
+	//  The request number is the newest protocol version the
+	//  client speaks.  Records don't say who sent them, so only a
+	//  client we already know gets to use them.
+	if (reqnum >= Record::PROTOCOL && cred.is_valid())
+	{   Log::debug("%s speaks protocol version %d", name(), reqnum);
+	    conn.use_records();
+	}
+	break;
+
+    case 'V':				// Version
+	//  Once obsolete, now used by clients to list what they
+	//  understand.  Older fams ignore it.
+	Log::debug("%s said: it understands \"%s\"", name(), filename);
+	if (has_word(filename, "overflow"))
+	    conn.overflow_ok(true);
+	if (has_word(filename, "ring"))
+	    conn.use_ring();
+	break;
+
+    //
+    //  Ignore these obsolete messages.
+    //
+    case 'D':
+    case 'E':
+	break;
+
+    default:
+	return request(opcode, reqnum, filename, msg_cred);
+    }
+
+    return true;
+}
+
+bool
+TCP_Client::input_record(const Record& record)
+{
+    assert(cred.is_valid());
+    if (record.pathlen > PATH_MAX)
+    {   Log::error("%s path name too long (%d chars)", name(), record.pathlen);
+	return false;
+    }
+    char filename[PATH_MAX + 1];
+    memcpy(filename, record.path, record.pathlen);
+    filename[record.pathlen] = '\0';
+    return request(record.opcode, record.request, filename, cred);
+}
+
+//  request handles the messages that may come as Records.
+
+bool
+TCP_Client::request(char opcode, Request reqnum, const char *filename,
+		    const Cred& msg_cred)
+{
     switch (opcode)
     {
     case 'W':				// Monitor File
@@ -213,28 +289,6 @@ TCP_Client::input_msg(const char *msg, int size)
 	MxClient::resume(reqnum);
 	break;
 
-    case 'N':				// Client Name
-	Log::debug("%s said: %s is %s, and %s a unix domain socket",
-                   name(), name(), filename,
-                   (got_N_with_groups ? "wants" : "doesn't want"));
-	if (*filename && strcmp(filename, "test"))
-	    name(filename);		// set this client's name
-
-        //  Check to see whether this client wants to switch to a unix
-        //  domain socket.  Create it owned by the uid the client says
-        //  they're running as.
-        if (got_N_with_groups) Listener::create_local_client(*this, uid);
-
-	break;
-
-    //
-    //  Ignore these obsolete messages.
-    //
-    case 'D':
-    case 'V':
-    case 'E':
-	break;
-
     default:
 	Log::error("%s said unknown request '%c' ('\\%3o')",
 		   name(), opcode, opcode & 0377);
@@ -244,6 +298,24 @@ TCP_Client::input_msg(const char *msg, int size)
     return true;
 }
 
+//  has_word says whether a list of words separated by spaces
+//  includes the word.
+
+bool
+TCP_Client::has_word(const char *list, const char *word)
+{
+    size_t len = strlen(word);
+    for (const char *p = list; *p; )
+    {   while (*p == ' ')
+	    p++;
+	size_t n = strcspn(p, " ");
+	if (n == len && !strncmp(p, word, len))
+	    return true;
+	p += n;
+    }
+    return false;
+}
+
 //////////////////////////////////////////////////////////////////////////////
 //  Output
 
@@ -276,10 +348,17 @@ TCP_Client::unblock_handler(void *closure)
 	client->conn.ready_for_input(true);
 }
 
+const char *
+TCP_Client::name_handler(Request request, void *closure)
+{
+    TCP_Client *client = (TCP_Client *) closure;
+    return client->request_name(request);
+}
+
 bool
 TCP_Client::ready_for_events()
 {
-    return conn.ready_for_output();
+    return conn.ready_for_events();
 }
 
 void
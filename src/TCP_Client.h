@@ -67,9 +67,14 @@ private:
     bool insecure_compat_suggested;
 
     bool input_msg(const char *msg, int size);
+    bool input_record(const Record&);
+    bool request(char opcode, Request, const char *filename, const Cred&);
+    static bool has_word(const char *list, const char *word);
 
     static bool input_handler(const char *msg, unsigned nbytes, void *closure);
+    static bool record_handler(const Record&, void *closure);
     static void unblock_handler(void *closure);
+    static const char *name_handler(Request, void *closure);
 
 };
 
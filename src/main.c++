@@ -24,6 +24,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <signal.h>
+#include <sys/resource.h>
 #include <sys/stat.h>
 #if HAVE_SYSSGI
 #include <sys/syssgi.h>
@@ -37,8 +38,14 @@
 #include "Log.h"
 #include "Pollster.h"
 #include "Scheduler.h"
+#include "ClientConnection.h"
 #include "Cred.h"
+#include "FileSystemTable.h"
 #include "Interest.h"
+#include "MountMonitor.h"
+#include "NFSFileSystem.h"
+#include "StatPool.h"
+#include "Stats.h"
 
 const char *program_name;
 
@@ -49,8 +56,21 @@ struct config_opts
     config_opts();
     const char *config_file;  // do not free this
     char *untrusted_user;
+    const char *local_socket;
     int pollster_interval;  // in seconds
+    unsigned max_polling_interval;  // in seconds
+    unsigned poll_slice_size;
+    unsigned poll_slice_msecs;
+    unsigned slow_fs_threshold;  // in milliseconds
+    unsigned slow_fs_polling_interval;  // in seconds
     int activity_timeout;   // in seconds
+    unsigned mount_monitor_threshold;
+    unsigned stats_interval;  // in seconds
+    bool nfs_cached_stats;
+    unsigned stat_threads;
+    unsigned client_queue_events;
+    unsigned client_queue_bytes;
+    unsigned event_ring_size;
     bool disable_pollster;
     bool local_only;
     bool xtab_verification;
@@ -61,14 +81,32 @@ struct config_opts
 };
 #define CFG_INSECURE_COMPAT "insecure_compatibility"
 #define CFG_LOCAL_ONLY "local_only"
+#define CFG_LOCAL_SOCKET "local_socket"
 #define CFG_XTAB_VERIFICATION "xtab_verification"
 #define CFG_UNTRUSTED_USER "untrusted_user"
 #define CFG_IDLE_TIMEOUT "idle_timeout"
 #define CFG_NFS_POLLING_INTERVAL "nfs_polling_interval"
+#define CFG_MAX_POLLING_INTERVAL "max_polling_interval"
+#define CFG_POLL_SLICE_SIZE "poll_slice_size"
+#define CFG_POLL_SLICE_MSECS "poll_slice_msecs"
+#define CFG_SLOW_FS_THRESHOLD "slow_fs_threshold"
+#define CFG_SLOW_FS_POLLING_INTERVAL "slow_fs_polling_interval"
+#define CFG_MOUNT_MONITOR_THRESHOLD "mount_monitor_threshold"
+#define CFG_STATS_INTERVAL "stats_interval"
+#define CFG_NFS_CACHED_STATS "nfs_cached_stats"
+#define CFG_STAT_THREADS "stat_threads"
+#define CFG_CLIENT_QUEUE_EVENTS "client_queue_events"
+#define CFG_CLIENT_QUEUE_BYTES "client_queue_bytes"
+#define CFG_EVENT_RING_SIZE "event_ring_size"
+#define CFG_MOUNT_POLICY "mount"
+#define CFG_FSTYPE_POLICY "fstype"
 static void parse_config(config_opts &opts);
 static void parse_config_line(config_opts &opts, int line,
                               const char *k, const char *v);
 static bool is_true(const char *str);
+static const char *policy_key(const char *key, const char *word);
+static bool parse_policy(config_opts &opts, int line, const char *key,
+                         const char *val, FileSystem::Policy &policy);
 
 static const char *basename2(const char *p)
 {
@@ -254,7 +292,18 @@ int main(int argc, char *argv[])
         exit(1);
     }
     Pollster::interval(opts.pollster_interval);
+    Pollster::max_interval(opts.max_polling_interval);
+    Pollster::slice(opts.poll_slice_size, opts.poll_slice_msecs);
+    FileSystem::slow_threshold(opts.slow_fs_threshold);
+    FileSystem::slow_polling_interval(opts.slow_fs_polling_interval);
     Activity::timeout(opts.activity_timeout);
+    MountMonitor::threshold(opts.mount_monitor_threshold);
+    Stats::report_every(opts.stats_interval);
+    NFSFileSystem::cached_stats(opts.nfs_cached_stats);
+    StatPool::threads(opts.stat_threads);
+    ClientConnection::max_queued(opts.client_queue_events,
+				 opts.client_queue_bytes);
+    ClientConnection::ring_size(opts.event_ring_size);
     if (opts.disable_pollster) Pollster::disable();
     if (!opts.local_only) {
         Interest::enable_xtab_verification(opts.xtab_verification);
@@ -280,13 +329,33 @@ int main(int argc, char *argv[])
     }
     (void) signal(SIGPIPE, SIG_IGN);
 
+    //  Every monitored directory holds a descriptor open, so allow
+    //  as many descriptors as we can -- but no more than the Scheduler
+    //  can wait on, or the ones past that would never be serviced.
+
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0)
+    {   rlim_t want = rl.rlim_max;
+	unsigned int cap = Scheduler::max_fds();
+	if (cap && (want == RLIM_INFINITY || want > cap))
+	    want = cap;
+	if (rl.rlim_cur != want)
+	{   rl.rlim_cur = want;
+	    if (setrlimit(RLIMIT_NOFILE, &rl) < 0)
+		Log::perror("setrlimit(RLIMIT_NOFILE)");
+	}
+    }
+
 #if HAVE_SGI_NOHANG
     // Ignore SIGCHLD because we run nfsunhang to unhang down nfs
     // mounts, and we don't care about the exit status of nfsunhang
     // (since we poll anyway) and we don't want to create zombies.
     (void) signal(SIGCHLD, SIG_IGN);
 #endif
-    new Listener(started_by_inetd, opts.local_only, program, version);
+    Listener *listener =
+	new Listener(started_by_inetd, opts.local_only, program, version);
+    if (*opts.local_socket)
+	listener->listen_local(opts.local_socket);
     Scheduler::loop();
     return 0;
 }
@@ -348,6 +417,7 @@ static void
 parse_config_line(config_opts &opts, int lineno, const char *key, const char *val)
 {
     char *p;
+    const char *name;
     unsigned secs;
 
     if(!strcmp(key, CFG_UNTRUSTED_USER))
@@ -360,6 +430,10 @@ parse_config_line(config_opts &opts, int lineno, const char *key, const char *va
     {
         opts.local_only = is_true(val);
     }
+    else if(!strcmp(key, CFG_LOCAL_SOCKET))
+    {
+        opts.local_socket = strdup(val);
+    }
     else if(!strcmp(key, CFG_IDLE_TIMEOUT))
     {
 	secs = strtoul(val, &p, 10);
@@ -386,6 +460,153 @@ parse_config_line(config_opts &opts, int lineno, const char *key, const char *va
 	    opts.pollster_interval = secs;
 	}
     }
+    else if(!strcmp(key, CFG_MAX_POLLING_INTERVAL))
+    {
+	secs = strtoul(val, &p, 10);
+	if (*p)
+	{
+	    Log::error("config file %s line %d: ignoring invalid value for %s",
+		       opts.config_file, lineno, key);
+	}
+	else
+	{
+	    opts.max_polling_interval = secs;
+	}
+    }
+    else if(!strcmp(key, CFG_POLL_SLICE_SIZE))
+    {
+	unsigned n = strtoul(val, &p, 10);
+	if (*p)
+	{
+	    Log::error("config file %s line %d: ignoring invalid value for %s",
+		       opts.config_file, lineno, key);
+	}
+	else
+	{
+	    opts.poll_slice_size = n;
+	}
+    }
+    else if(!strcmp(key, CFG_POLL_SLICE_MSECS))
+    {
+	unsigned n = strtoul(val, &p, 10);
+	if (*p)
+	{
+	    Log::error("config file %s line %d: ignoring invalid value for %s",
+		       opts.config_file, lineno, key);
+	}
+	else
+	{
+	    opts.poll_slice_msecs = n;
+	}
+    }
+    else if(!strcmp(key, CFG_SLOW_FS_THRESHOLD))
+    {
+	unsigned n = strtoul(val, &p, 10);
+	if (*p)
+	{
+	    Log::error("config file %s line %d: ignoring invalid value for %s",
+		       opts.config_file, lineno, key);
+	}
+	else
+	{
+	    opts.slow_fs_threshold = n;
+	}
+    }
+    else if(!strcmp(key, CFG_SLOW_FS_POLLING_INTERVAL))
+    {
+	secs = strtoul(val, &p, 10);
+	if (*p)
+	{
+	    Log::error("config file %s line %d: ignoring invalid value for %s",
+		       opts.config_file, lineno, key);
+	}
+	else
+	{
+	    opts.slow_fs_polling_interval = secs;
+	}
+    }
+    else if(!strcmp(key, CFG_MOUNT_MONITOR_THRESHOLD))
+    {
+	unsigned n = strtoul(val, &p, 10);
+	if (*p)
+	{
+	    Log::error("config file %s line %d: ignoring invalid value for %s",
+		       opts.config_file, lineno, key);
+	}
+	else
+	{
+	    opts.mount_monitor_threshold = n;
+	}
+    }
+    else if(!strcmp(key, CFG_STATS_INTERVAL))
+    {
+	secs = strtoul(val, &p, 10);
+	if (*p)
+	{
+	    Log::error("config file %s line %d: ignoring invalid value for %s",
+		       opts.config_file, lineno, key);
+	}
+	else
+	{
+	    opts.stats_interval = secs;
+	}
+    }
+    else if(!strcmp(key, CFG_NFS_CACHED_STATS))
+    {
+        opts.nfs_cached_stats = is_true(val);
+    }
+    else if(!strcmp(key, CFG_STAT_THREADS))
+    {
+	unsigned n = strtoul(val, &p, 10);
+	if (*p)
+	{
+	    Log::error("config file %s line %d: ignoring invalid value for %s",
+		       opts.config_file, lineno, key);
+	}
+	else
+	{
+	    opts.stat_threads = n;
+	}
+    }
+    else if(!strcmp(key, CFG_CLIENT_QUEUE_EVENTS))
+    {
+	unsigned n = strtoul(val, &p, 10);
+	if (*p)
+	{
+	    Log::error("config file %s line %d: ignoring invalid value for %s",
+		       opts.config_file, lineno, key);
+	}
+	else
+	{
+	    opts.client_queue_events = n;
+	}
+    }
+    else if(!strcmp(key, CFG_CLIENT_QUEUE_BYTES))
+    {
+	unsigned n = strtoul(val, &p, 10);
+	if (*p)
+	{
+	    Log::error("config file %s line %d: ignoring invalid value for %s",
+		       opts.config_file, lineno, key);
+	}
+	else
+	{
+	    opts.client_queue_bytes = n;
+	}
+    }
+    else if(!strcmp(key, CFG_EVENT_RING_SIZE))
+    {
+	unsigned n = strtoul(val, &p, 10);
+	if (*p)
+	{
+	    Log::error("config file %s line %d: ignoring invalid value for %s",
+		       opts.config_file, lineno, key);
+	}
+	else
+	{
+	    opts.event_ring_size = n;
+	}
+    }
     else if(!strcmp(key, CFG_XTAB_VERIFICATION))
     {
         opts.xtab_verification = is_true(val);
@@ -417,6 +638,18 @@ parse_config_line(config_opts &opts, int lineno, const char *key, const char *va
     {
         opts.disable_mac = is_true(val);
     }
+    else if((name = policy_key(key, CFG_MOUNT_POLICY)) != NULL)
+    {
+        FileSystem::Policy policy;
+        if(parse_policy(opts, lineno, key, val, policy))
+            FileSystemTable::set_mount_policy(name, policy);
+    }
+    else if((name = policy_key(key, CFG_FSTYPE_POLICY)) != NULL)
+    {
+        FileSystem::Policy policy;
+        if(parse_policy(opts, lineno, key, val, policy))
+            FileSystemTable::set_type_policy(name, policy);
+    }
     else
     {
         Log::error("config file %s line %d: unrecognized key \"%s\"",
@@ -425,14 +658,102 @@ parse_config_line(config_opts &opts, int lineno, const char *key, const char *va
 }
 
 
+//  policy_key returns the rest of key if it's word followed by blanks
+//  and something else, e.g. "/usr" if key is "mount /usr".
+
+static const char *
+policy_key(const char *key, const char *word)
+{
+    size_t len = strlen(word);
+    if(strncmp(key, word, len) || !isspace(key[len]))
+        return NULL;
+    key += len;
+    while(isspace(*key)) ++key;
+    return *key ? key : NULL;
+}
+
+//  parse_policy reads a list of FileSystem::Policy settings separated
+//  by commas, e.g. "poll_interval 30, scan_entries no".  A boolean
+//  setting without a value is true.  If any setting is bad, the whole
+//  line is ignored.
+
+static bool
+parse_policy(config_opts &opts, int lineno, const char *key,
+             const char *val, FileSystem::Policy &policy)
+{
+    char buf[PATH_MAX + 64];
+    char *last;
+    (void) strncpy(buf, val, sizeof buf - 1);
+    buf[sizeof buf - 1] = '\0';
+    for(char *name = strtok_r(buf, ",", &last);
+        name != NULL;
+        name = strtok_r(NULL, ",", &last))
+    {
+        while(isspace(*name)) ++name;
+        char *arg = name;
+        while(*arg && !isspace(*arg)) ++arg;
+        if(*arg) *arg++ = '\0';
+        while(isspace(*arg)) ++arg;
+        char *end = arg + strlen(arg);
+        while(end > arg && isspace(end[-1])) *--end = '\0';
+
+        if(!strcmp(name, "kernel_only"))
+        {
+            policy.kernel_only = !*arg || is_true(arg);
+        }
+        else if(!strcmp(name, "scan_entries"))
+        {
+            policy.scan_entries = !*arg || is_true(arg);
+        }
+        else if(!strcmp(name, "poll_interval") ||
+                !strcmp(name, "max_entries"))
+        {
+            char *p;
+            unsigned n = strtoul(arg, &p, 10);
+            if(!*arg || *p)
+            {
+                Log::error("config file %s line %d: ignoring %s because "
+                           "of invalid value for %s",
+                           opts.config_file, lineno, key, name);
+                return false;
+            }
+            if(!strcmp(name, "poll_interval"))
+                policy.poll_interval = n;
+            else
+                policy.max_entries = n;
+        }
+        else
+        {
+            Log::error("config file %s line %d: ignoring %s because "
+                       "of unrecognized setting \"%s\"",
+                       opts.config_file, lineno, key, name);
+            return false;
+        }
+    }
+    return true;
+}
+
 config_opts::config_opts()
 {
     memset(this, 0, sizeof(config_opts));
 
     config_file = FAM_CONF;
     untrusted_user = NULL;
+    local_socket = FAM_SOCKET;
     pollster_interval = 6;
+    max_polling_interval = 600;
+    poll_slice_size = 1000;
+    poll_slice_msecs = 20;
+    slow_fs_threshold = 1000;
+    slow_fs_polling_interval = 60;
     activity_timeout = 5;
+    mount_monitor_threshold = 0;
+    stats_interval = 0;
+    nfs_cached_stats = false;
+    stat_threads = 4;
+    client_queue_events = 65536;
+    client_queue_bytes = 4 * 1024 * 1024;
+    event_ring_size = 0;
     disable_pollster = false;
     local_only = false;
     xtab_verification = true;
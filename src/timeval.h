@@ -24,6 +24,7 @@
 #define timeval_included
 
 #include <sys/time.h>
+#include <time.h>
 
 //////////////////////////////////////////////////////////////////////////////
 //  Define a few arithmetic ops on timevals.  Makes code much more
@@ -87,4 +88,25 @@ operator != (const timeval& left, const timeval& right)
     return timercmp(&left, &right, != );
 }
 
+//  Timespecs only need comparing.
+
+inline int
+operator < (const timespec& left, const timespec& right)
+{
+    return left.tv_sec < right.tv_sec
+	|| (left.tv_sec == right.tv_sec && left.tv_nsec < right.tv_nsec);
+}
+
+inline int
+operator <= (const timespec& left, const timespec& right)
+{
+    return !(right < left);
+}
+
+inline int
+operator == (const timespec& left, const timespec& right)
+{
+    return left.tv_sec == right.tv_sec && left.tv_nsec == right.tv_nsec;
+}
+
 #endif /* !timeval_included */